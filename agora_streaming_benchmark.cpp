@@ -0,0 +1,330 @@
+//  Offline benchmark for the streaming hot path: TS parsing, frame metadata, playlist switching and the pacing
+//  send loop of agora_streaming_controlled, driven against local HLS fixtures with a stub
+//  IVideoEncodedImageSender, so no token, channel or network is needed.
+//
+//  Fixtures: python3 convert/webrtc_converter.py convert/bella.mp4 --bitrate 1500 --output /tmp/bella
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+#include "AgoraRefCountedObject.h"
+#include "common/log.h"
+#include "common/opt_parser.h"
+#include "common/streaming/segment_store.h"
+#include "common/streaming/stream_util.h"
+#include "common/streaming/video_send_task.h"
+
+#define DEFAULT_BENCH_FRAMES (3000)
+#define DEFAULT_BENCH_SWITCHES (20)
+#define DEFAULT_BENCH_PACE_S (5)
+#define BENCH_FRAMES_PER_SWITCH (30)
+
+/* ====== Allocation Counting ================================= */
+
+// Every operator new in the process, so a phase can report allocations per frame
+static std::atomic<unsigned long long> allocations{0};
+
+// Out of line like the deletes below, or GCC flags the inlined malloc() against them
+__attribute__((noinline)) void* operator new(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+// Out of line, or GCC flags the inlined free() against the new expressions it pairs with
+void* operator new[](std::size_t size) { return operator new(size); }
+__attribute__((noinline)) void operator delete(void* p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete[](void* p) noexcept { free(p); }
+
+/* ====== Stub Sender ================================= */
+
+// Takes frames in place of the SDK sender and only counts them
+class BenchmarkSender : public agora::rtc::IVideoEncodedImageSender {
+public:
+  bool sendEncodedVideoImage(const uint8_t* imageBuffer, size_t length,
+                             const agora::rtc::EncodedVideoFrameInfo& videoEncodedFrameInfo) override {
+    (void)imageBuffer;
+    (void)videoEncodedFrameInfo;
+    frames.fetch_add(1, std::memory_order_relaxed);
+    bytes.fetch_add(length, std::memory_order_relaxed);
+    return true;
+  }
+
+  std::atomic<unsigned long long> frames{0};
+  std::atomic<unsigned long long> bytes{0};
+};
+
+/* ====== Reporting ================================= */
+
+static int64_t threadCpuNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+// Sorts `samples` in place
+static int64_t percentile(std::vector<int64_t>& samples, double p) {
+  if (samples.empty()) return 0;
+  std::sort(samples.begin(), samples.end());
+  size_t i = static_cast<size_t>(p * (samples.size() - 1) + 0.5);
+  return samples[i];
+}
+
+// Upper bound of the bucket holding the p-th sample; the overflow bucket reports the last bound
+static int64_t histogramPercentileUs(const MetricHistogram& h, double p) {
+  unsigned long long count = h.count.get();
+  if (count == 0) return 0;
+  unsigned long long rank = static_cast<unsigned long long>(p * (count - 1)) + 1;
+  unsigned long long seen = 0;
+  for (size_t i = 0; i < METRIC_BUCKETS; ++i) {
+    seen += h.buckets[i].get();
+    if (seen >= rank) {
+      return kMetricBoundsUs[i < METRIC_BUCKETS - 1 ? i : i - 1];
+    }
+  }
+  return kMetricBoundsUs[METRIC_BUCKETS - 2];
+}
+
+/* ====== Benchmark Phases ================================= */
+
+struct BenchmarkOptions {
+  std::string videoFile;
+  std::string switchVideoFile; // default: videoFile
+  int frames = DEFAULT_BENCH_FRAMES;
+  int switches = DEFAULT_BENCH_SWITCHES;
+  int paceSeconds = DEFAULT_BENCH_PACE_S;
+  SampleOptions sample;
+};
+
+// Pulls frames straight from a PlaylistManager and sends them with no pacing: the parser and
+// send call cost per frame, looping the playlist as the stream would
+static bool runParsePhase(const BenchmarkOptions& options,
+                          agora::agora_refptr<agora::rtc::IVideoEncodedImageSender> sender) {
+  auto manager = std::make_shared<PlaylistManager>();
+  if (!manager->initialize(options.videoFile)) {
+    AG_LOG(ERROR, "Failed to initialize playlist manager for %s", options.videoFile.c_str());
+    return false;
+  }
+
+  std::vector<int64_t> cpuNs;
+  cpuNs.reserve(options.frames);
+  unsigned long long bytes = 0;
+  unsigned long long allocationsBefore = allocations.load();
+  auto start = std::chrono::steady_clock::now();
+  while (cpuNs.size() < static_cast<size_t>(options.frames)) {
+    int64_t cpuStart = threadCpuNs();
+    std::unique_ptr<HelperH264Frame> frame = manager->getNextFrame();
+    if (!frame) {
+      AG_LOG(ERROR, "Playlist %s ran dry after %zu frames", options.videoFile.c_str(), cpuNs.size());
+      return false;
+    }
+    bytes += frame->bufferLen;
+    sendOneH264Frame(options.sample.video.frameRate, std::move(frame), sender);
+    cpuNs.push_back(threadCpuNs() - cpuStart);
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  unsigned long long allocated = allocations.load() - allocationsBefore;
+
+  printf("parse:  %zu AUs in %.3f s, %.0f AUs/s, %.1f MB/s, %.2f allocations/frame, "
+         "cpu/frame p50 %.1f us p99 %.1f us, peak AU %.1f KB\n",
+         cpuNs.size(), seconds, cpuNs.size() / seconds, bytes / seconds / 1e6,
+         static_cast<double>(allocated) / cpuNs.size(), percentile(cpuNs, 0.50) / 1e3,
+         percentile(cpuNs, 0.99) / 1e3, MetricsRegistry::instance().segments().peakAuBytes.get() / 1024.0);
+  return true;
+}
+
+// Writes each placement's metadata into frames pulled as in the parse phase: the cost of the
+// stage alone, and how many frames took it in place rather than through a pooled copy
+static bool runMetadataPhase(const BenchmarkOptions& options, const std::string& placement) {
+  auto manager = std::make_shared<PlaylistManager>();
+  if (!manager->initialize(options.videoFile)) {
+    AG_LOG(ERROR, "Failed to initialize playlist manager for %s", options.videoFile.c_str());
+    return false;
+  }
+  FrameMetadata metadata;
+  metadata.configure(placement, options.sample.video.metadataPayload);
+
+  std::vector<int64_t> cpuNs;
+  cpuNs.reserve(options.frames);
+  unsigned long long added = 0;
+  unsigned long long inPlace = 0;
+  unsigned long long allocationsBefore = allocations.load();
+  while (cpuNs.size() < static_cast<size_t>(options.frames)) {
+    std::unique_ptr<HelperH264Frame> frame = manager->getNextFrame();
+    if (!frame) {
+      AG_LOG(ERROR, "Playlist %s ran dry after %zu frames", options.videoFile.c_str(), cpuNs.size());
+      return false;
+    }
+    const uint8_t* before = frame->buffer;
+    int lenBefore = frame->bufferLen;
+    int64_t cpuStart = threadCpuNs();
+    metadata.apply(*frame, cpuNs.size());
+    cpuNs.push_back(threadCpuNs() - cpuStart);
+    added += frame->bufferLen - lenBefore;
+    inPlace += frame->buffer == before;
+  }
+  unsigned long long allocated = allocations.load() - allocationsBefore;
+
+  printf("meta:   %-7s %zu frames, %.1f bytes/frame added, %.1f%% in place, %.2f allocations/frame "
+         "(with parsing), cpu/frame p50 %.2f us p99 %.2f us\n",
+         placement.c_str(), cpuNs.size(), static_cast<double>(added) / cpuNs.size(),
+         100.0 * inPlace / cpuNs.size(), static_cast<double>(allocated) / cpuNs.size(),
+         percentile(cpuNs, 0.50) / 1e3, percentile(cpuNs, 0.99) / 1e3);
+  return true;
+}
+
+// Preloads and cuts over between the two videos, alternating, with a few frames in between
+static bool runSwitchPhase(const BenchmarkOptions& options,
+                           agora::agora_refptr<agora::rtc::IVideoEncodedImageSender> sender) {
+  auto manager = std::make_shared<PlaylistManager>();
+  if (!manager->initialize(options.videoFile)) {
+    AG_LOG(ERROR, "Failed to initialize playlist manager for %s", options.videoFile.c_str());
+    return false;
+  }
+
+  std::vector<int64_t> preloadUs, cutUs;
+  for (int i = 0; i < options.switches; ++i) {
+    for (int f = 0; f < BENCH_FRAMES_PER_SWITCH; ++f) {
+      std::unique_ptr<HelperH264Frame> frame = manager->getNextFrame();
+      if (frame) sendOneH264Frame(options.sample.video.frameRate, std::move(frame), sender);
+    }
+
+    const std::string& next = (i % 2 == 0) ? options.switchVideoFile : options.videoFile;
+    auto start = std::chrono::steady_clock::now();
+    if (!manager->preloadNewPlaylist(next)) {
+      AG_LOG(ERROR, "Failed to preload %s", next.c_str());
+      return false;
+    }
+    auto preloaded = std::chrono::steady_clock::now();
+    std::unique_ptr<HelperH264Frame> frame;
+    if (!manager->switchToNewPlaylist() || !(frame = manager->getNextFrame())) {
+      AG_LOG(ERROR, "Failed to switch to %s", next.c_str());
+      return false;
+    }
+    sendOneH264Frame(options.sample.video.frameRate, std::move(frame), sender);
+    auto sent = std::chrono::steady_clock::now();
+
+    preloadUs.push_back(std::chrono::duration_cast<std::chrono::microseconds>(preloaded - start).count());
+    cutUs.push_back(std::chrono::duration_cast<std::chrono::microseconds>(sent - preloaded).count());
+  }
+
+  printf("switch: %d switches, preload p50 %lld us p99 %lld us, cut to first frame p50 %lld us p99 %lld us\n",
+         options.switches, (long long)percentile(preloadUs, 0.50), (long long)percentile(preloadUs, 0.99),
+         (long long)percentile(cutUs, 0.50), (long long)percentile(cutUs, 0.99));
+  return true;
+}
+
+// The real send task (prefetcher, pacing, switch handling) for a while, switching once a second
+static bool runPacePhase(const BenchmarkOptions& options,
+                         agora::agora_refptr<agora::rtc::IVideoEncodedImageSender> sender) {
+  auto manager = std::make_shared<PlaylistManager>(options.sample.lookahead);
+  if (!manager->initialize(options.videoFile)) {
+    AG_LOG(ERROR, "Failed to initialize playlist manager for %s", options.videoFile.c_str());
+    return false;
+  }
+  auto renditions = std::make_shared<RenditionController>();
+  auto metrics = MetricsRegistry::instance().addStream("benchmark");
+  CommandQueue commands;
+  std::atomic<bool> stop{false};
+
+  std::thread sendThread(SampleSendVideoH264Task, options.sample, sender,
+                         agora::agora_refptr<agora::rtc::IAudioEncodedFrameSender>(), manager,
+                         std::shared_ptr<PlaylistManager>(), renditions, metrics, std::ref(commands),
+                         std::cref(stop));
+  for (int s = 0; s < options.paceSeconds; ++s) {
+    if (s > 0) {
+      commands.push(Command(Command::SWITCH_VIDEO, s % 2 == 1 ? options.switchVideoFile : options.videoFile));
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+  }
+  stop = true;
+  commands.push(Command(Command::EXIT, ""));
+  sendThread.join();
+
+  printf("pace:   %llu frames in %d s (%s), %llu underruns, lateness p50 <= %lld us p99 <= %lld us, "
+         "%llu switches p50 <= %lld us p99 <= %lld us\n",
+         metrics->framesSent.get(), options.paceSeconds, options.sample.video.pacing.c_str(),
+         metrics->underruns.get(), (long long)histogramPercentileUs(metrics->latenessUs, 0.50),
+         (long long)histogramPercentileUs(metrics->latenessUs, 0.99), metrics->switchUs.count.get(),
+         (long long)histogramPercentileUs(metrics->switchUs, 0.50),
+         (long long)histogramPercentileUs(metrics->switchUs, 0.99));
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  BenchmarkOptions options;
+  opt_parser optParser;
+
+  optParser.add_long_opt("videoFile", &options.videoFile, "The video file (.ts) or local playlist (.m3u8) / must");
+  optParser.add_long_opt("switchVideoFile", &options.switchVideoFile,
+                         "Second video the switch phases alternate with / default is --videoFile");
+  optParser.add_long_opt("frames", &options.frames, "Frames parsed and sent in the parse phase / default is 3000");
+  optParser.add_long_opt("switches", &options.switches, "Switches in the switch phase / default is 20");
+  optParser.add_long_opt("paceSeconds", &options.paceSeconds,
+                         "Duration of the paced send loop phase, 0 skips it / default is 5");
+  optParser.add_long_opt("pacing", &options.sample.video.pacing,
+                         "Pace phase frame pacing: fps or pts / default is fps");
+  optParser.add_long_opt("fps", &options.sample.video.frameRate, "Pace phase frame rate / default is 30");
+  optParser.add_long_opt("metadataPayload", &options.sample.video.metadataPayload,
+                         "Metadata phase payload: timestamp, frame or text:<string> / default is timestamp");
+
+  if ((argc <= 1) || !optParser.parse_opts(argc, argv)) {
+    std::ostringstream strStream;
+    optParser.print_usage(argv[0], strStream);
+    std::cout << strStream.str() << std::endl;
+    return -1;
+  }
+
+  if (options.videoFile.empty()) {
+    AG_LOG(ERROR, "Must provide videoFile!");
+    return -1;
+  }
+  if (options.switchVideoFile.empty()) {
+    options.switchVideoFile = options.videoFile;
+  }
+  if (options.frames <= 0 || options.switches < 0 || options.paceSeconds < 0) {
+    AG_LOG(ERROR, "Invalid frames %d / switches %d / pace seconds %d!", options.frames, options.switches,
+           options.paceSeconds);
+    return -1;
+  }
+  if (options.sample.video.frameRate <= 0 ||
+      (options.sample.video.pacing != "fps" && options.sample.video.pacing != "pts")) {
+    AG_LOG(ERROR, "Invalid pacing %s at %d fps!", options.sample.video.pacing.c_str(),
+           options.sample.video.frameRate);
+    return -1;
+  }
+  if (!FrameMetadata().configure("none", options.sample.video.metadataPayload)) {
+    AG_LOG(ERROR, "Unknown metadata payload %s!", options.sample.video.metadataPayload.c_str());
+    return -1;
+  }
+  options.sample.prefetch.highWater = options.sample.prefetch.depth;
+  options.sample.prefetch.lowWater = options.sample.prefetch.highWater / 2;
+  SegmentStore::instance().setBudget((size_t)options.sample.segmentStoreMb << 20);
+
+  setLogger(quietLogger);
+
+  BenchmarkSender* benchmarkSender = new agora::RefCountedObject<BenchmarkSender>();
+  agora::agora_refptr<agora::rtc::IVideoEncodedImageSender> sender = benchmarkSender;
+
+  if (!runParsePhase(options, sender)) return -1;
+  if (!runMetadataPhase(options, "trailer") || !runMetadataPhase(options, "sei")) return -1;
+  if (options.switches > 0 && !runSwitchPhase(options, sender)) return -1;
+  if (options.paceSeconds > 0 && !runPacePhase(options, sender)) return -1;
+  printf("total:  %llu frames, %llu bytes sent\n", benchmarkSender->frames.load(),
+         benchmarkSender->bytes.load());
+  return 0;
+}
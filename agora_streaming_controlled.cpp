@@ -29,6 +29,7 @@
 #include <unistd.h>
 #include <cstdio>
 #include <functional>
+#include <future>
 #include <memory>
 #include <vector>
 #include <fstream>
@@ -40,6 +41,9 @@
 #include <atomic>
 #include <condition_variable>
 #include <queue>
+#include <cerrno>
+#include <map>
+#include <algorithm>
 
 #include "IAgoraService.h"
 #include "NGIAgoraRtcConnection.h"
@@ -50,847 +54,656 @@
 #include "common/sample_connection_observer.h"
 #include "common/sample_local_user_observer.h"
 
+#include "NGIAgoraAudioTrack.h"
 #include "NGIAgoraLocalUser.h"
 #include "NGIAgoraMediaNodeFactory.h"
 #include "NGIAgoraMediaNode.h"
 #include "NGIAgoraVideoTrack.h"
 
+#include "common/streaming/command_queue.h"
+#include "common/streaming/control_channel.h"
+#include "common/streaming/disk_cache.h"
+#include "common/streaming/metrics_registry.h"
+#include "common/streaming/playlist_manager.h"
+#include "common/streaming/preload_executor.h"
+#include "common/streaming/rendition_controller.h"
+#include "common/streaming/sample_options.h"
+#include "common/streaming/segment_fetcher.h"
+#include "common/streaming/segment_store.h"
+#include "common/streaming/stream_util.h"
+#include "common/streaming/video_send_task.h"
+
 #define DEFAULT_CONNECT_TIMEOUT_MS (3000)
-#define DEFAULT_FRAME_RATE (30)
-#define DEFAULT_VIDEO_FILE "test_data/send_video.ts"
-#define CACHE_BASE_PATH "/home/ubuntu/tscache"
-
-/* ====== Command Structure for Dynamic Switching =============== */
-struct Command {
-  enum Type {
-    SWITCH_VIDEO,
-    EXIT
-  };
-  
-  Type type;
-  std::string data;
-  
-  Command(Type t, const std::string& d) : type(t), data(d) {}
-};
 
-// Utility function to check if a string represents a valid integer
-static bool isInteger(const std::string& str) {
-  if (str.empty()) return false;
-  
-  size_t start = 0;
-  if (str[0] == '-' || str[0] == '+') {
-    start = 1;
-    if (str.length() == 1) return false; // Just a sign character
-  }
-  
-  for (size_t i = start; i < str.length(); ++i) {
-    if (!std::isdigit(str[i])) {
-      return false;
-    }
-  }
-  return true;
-}
+/* ====== Global Command Queue ================================= */
 
-static bool isVerboseLoggingEnabled() {
-  // You can control this via environment variable or command line
-  const char* verbose = getenv("AGORA_VERBOSE");
-  return verbose && (strcmp(verbose, "1") == 0 || strcmp(verbose, "true") == 0);
-}
+static CommandQueue commandQueue;
 
-static void quietLogger(const char* msg) {
-  // Only log important messages, filter out verbose ones
-  std::string message(msg);
-  
-  // Skip verbose segment switching and H.264 detection messages
-  if (message.find("Switching to segment") != std::string::npos ||
-      message.find("Found H.264 stream on PID") != std::string::npos ||
-      message.find("Parsed M3U8: found") != std::string::npos ||
-      message.find("Using cached segment") != std::string::npos ||
-      message.find("Downloading:") != std::string::npos) {
+/* ====== Command Processing ================================= */
+
+void processStdinCommands() {
+  std::string line;
+  while (!exitFlag && std::getline(std::cin, line)) {
+    if (line.empty()) continue;
     
-    // Only show these if verbose mode is enabled
-    if (isVerboseLoggingEnabled()) {
-      std::fprintf(stderr, "[VERBOSE] %s\n", msg);
+    // Parse command
+    if (line == "EXIT") {
+      commandQueue.push(Command(Command::EXIT, ""));
+      break;
+    } else if (line.find("SWITCH_VIDEO:") == 0) {
+      std::string videoFile = line.substr(13); // Length of "SWITCH_VIDEO:"
+      if (!videoFile.empty()) {
+        commandQueue.push(Command(Command::SWITCH_VIDEO, videoFile));
+        printf("Received switch video command: %s\n", videoFile.c_str());
+      }
+    } else if (line.find("QUEUE_VIDEO:") == 0) {
+      std::string videoFile = line.substr(12); // Length of "QUEUE_VIDEO:"
+      if (!videoFile.empty()) {
+        commandQueue.push(Command(Command::QUEUE_VIDEO, videoFile));
+        printf("Received queue video command: %s\n", videoFile.c_str());
+      }
+    } else if (line.find("SEEK:") == 0) {
+      std::string position = line.substr(5); // Length of "SEEK:"
+      if (!position.empty()) {
+        commandQueue.push(Command(Command::SEEK, position));
+        printf("Received seek command: %s\n", position.c_str());
+      }
+    } else if (line == "CLEAR_QUEUE" || line.find("CLEAR_QUEUE:") == 0) {
+      commandQueue.push(Command(Command::CLEAR_QUEUE, line.size() > 12 ? line.substr(12) : std::string()));
+    } else if (line.find("WARM_VIDEO:") == 0) {
+      std::string videos = line.substr(11); // Length of "WARM_VIDEO:"
+      if (!videos.empty()) {
+        commandQueue.push(Command(Command::WARM_VIDEO, videos));
+        printf("Received warm video command: %s\n", videos.c_str());
+      }
+    } else if (line.find("ADD_STREAM:") == 0) {
+      std::string stream = line.substr(11); // Length of "ADD_STREAM:"
+      if (!stream.empty()) {
+        commandQueue.push(Command(Command::ADD_STREAM, stream));
+        printf("Received add stream command: %s\n", stream.c_str());
+      }
+    } else if (line.find("ASSIGN:") == 0) {
+      std::string assignment = line.substr(7); // Length of "ASSIGN:"
+      if (!assignment.empty()) {
+        commandQueue.push(Command(Command::ASSIGN, assignment));
+        printf("Received assign command: %s\n", assignment.c_str());
+      }
+    } else if (line.find("REMOVE_STREAM:") == 0) {
+      std::string streamId = line.substr(14); // Length of "REMOVE_STREAM:"
+      if (!streamId.empty()) {
+        commandQueue.push(Command(Command::REMOVE_STREAM, streamId));
+        printf("Received remove stream command: %s\n", streamId.c_str());
+      }
+    } else {
+      printf("Unknown command: %s\n", line.c_str());
     }
-    return;
   }
-  
-  // Log important messages normally
-  std::fprintf(stderr, "%s\n", msg);
 }
 
-/* ====== Global Command Queue ================================= */
-class CommandQueue {
-private:
-  std::queue<Command> commands_;
-  std::mutex mutex_;
-  std::condition_variable cv_;
-
-public:
-  void push(const Command& cmd) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    commands_.push(cmd);
-    cv_.notify_one();
+static bool readFull(int fd, uint8_t* data, size_t len) {
+  while (len > 0) {
+    ssize_t n = read(fd, data, len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data += n;
+    len -= n;
   }
-  
-  bool pop(Command& cmd, int timeoutMs = 100) {
-    std::unique_lock<std::mutex> lock(mutex_);
-    if (cv_.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this] { return !commands_.empty(); })) {
-      cmd = commands_.front();
-      commands_.pop();
-      return true;
-    }
-    return false;
-  }
-  
-  bool empty() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return commands_.empty();
-  }
-};
-
-static CommandQueue commandQueue;
-static std::atomic<bool> exitFlag{false};
-
-/* ====== HelperH264Frame structure ================================= */
-struct HelperH264Frame {
-  bool isKeyFrame;
-  std::unique_ptr<uint8_t[]> buffer;
-  int bufferLen;
-  
-  HelperH264Frame(bool key, std::unique_ptr<uint8_t[]> buf, int len)
-    : isKeyFrame(key), buffer(std::move(buf)), bufferLen(len) {}
-};
-
-/* ====== Utility Functions ================================= */
-
-// Create directory recursively
-bool createDirectoryRecursive(const std::string& path) {
-  std::string command = "mkdir -p \"" + path + "\"";
-  return system(command.c_str()) == 0;
-}
-
-// Check if file exists
-bool fileExists(const std::string& path) {
-  struct stat st;
-  return stat(path.c_str(), &st) == 0;
+  return true;
 }
 
-// Extract cache path from URL
-std::string extractCachePath(const std::string& url) {
-  size_t vbaPos = url.find("/vba/");
-  if (vbaPos == std::string::npos) {
-    // Fallback: use last part of URL path
-    size_t lastSlash = url.find_last_of('/');
-    if (lastSlash != std::string::npos) {
-      return url.substr(lastSlash + 1);
+// Reads framed JSON requests from --controlFd (see ControlChannel) until the peer closes it.
+// Verbs: switch (video, low, at_ms, position_ms), queue and preload (video, low, position_ms),
+// clear_queue, seek (position_ms), warm (video, several separated by spaces), stats and exit; with
+// --multi also add_stream (stream, channel, uid, video, token) and remove_stream (stream), and the
+// stream verbs name their stream; with --standby also assign (channel, uid, video, position_ms).
+void processControlCommands(int fd, bool multiStream, bool standby) {
+  ControlChannel& channel = ControlChannel::instance();
+  while (!exitFlag) {
+    uint8_t header[4];
+    if (!readFull(fd, header, sizeof(header))) break;
+    uint32_t len = (uint32_t(header[0]) << 24) | (uint32_t(header[1]) << 16) | (uint32_t(header[2]) << 8) | header[3];
+    if (len > CONTROL_MAX_MESSAGE) {
+      channel.send("{\"id\":0,\"status\":\"error\",\"error\":\"message too large\"}");
+      break; // framing is lost
     }
-    return "default";
-  }
-  return url.substr(vbaPos + 1); // Skip the leading slash
-}
+    std::string body(len, '\0');
+    if (len && !readFull(fd, reinterpret_cast<uint8_t*>(&body[0]), len)) break;
 
-// Download file using curl
-bool downloadFile(const std::string& url, const std::string& outputPath) {
-  // Create directory for the file
-  size_t lastSlash = outputPath.find_last_of('/');
-  if (lastSlash != std::string::npos) {
-    std::string dir = outputPath.substr(0, lastSlash);
-    if (!createDirectoryRecursive(dir)) {
-      fprintf(stderr, "Failed to create directory: %s\n", dir.c_str());
-      return false;
+    std::map<std::string, std::string> request;
+    uint64_t id = 0;
+    if (!parseJsonObject(body, request) || (id = std::strtoull(request["id"].c_str(), nullptr, 10)) == 0) {
+      channel.send("{\"id\":0,\"status\":\"error\",\"error\":\"malformed request\"}");
+      continue;
     }
-  }
-  
-  std::string command = "curl -s -L \"" + url + "\" -o \"" + outputPath + "\"";
-  printf("Downloading: %s\n", url.c_str());
-  return system(command.c_str()) == 0;
-}
+    const std::string& verb = request["cmd"];
+    const std::string& stream = request["stream"];
+    const std::string& video = request["video"];
+    std::string prefix = multiStream ? stream + " " : std::string();
+    const std::string& position = request["position_ms"];
+    std::string at = isInteger(position) && position[0] != '-' ? "@" + position : std::string();
+    std::string target = request["low"].empty() ? video + at : video + at + " " + request["low"] + at;
 
-// Get base URL from a full URL
-std::string getBaseUrl(const std::string& url) {
-  size_t lastSlash = url.find_last_of('/');
-  if (lastSlash != std::string::npos) {
-    return url.substr(0, lastSlash + 1);
+    Command cmd(Command::EXIT, "");
+    cmd.id = id;
+    if (verb == "switch" || verb == "queue" || verb == "preload") {
+      if (video.empty() || (multiStream && stream.empty())) {
+        channel.error(id, multiStream ? "video and stream required" : "video required");
+        continue;
+      }
+      cmd.type = verb == "preload" ? Command::PRELOAD_VIDEO
+               : verb == "queue"   ? Command::QUEUE_VIDEO
+                                   : Command::SWITCH_VIDEO;
+      cmd.data = prefix + target;
+      cmd.atMs = std::strtoll(request["at_ms"].c_str(), nullptr, 10);
+    } else if (verb == "clear_queue") {
+      if (multiStream && stream.empty()) {
+        channel.error(id, "stream required");
+        continue;
+      }
+      cmd.type = Command::CLEAR_QUEUE;
+      cmd.data = stream;
+    } else if (verb == "seek") {
+      if (at.empty() || (multiStream && stream.empty())) {
+        channel.error(id, multiStream ? "position_ms and stream required" : "position_ms required");
+        continue;
+      }
+      cmd.type = Command::SEEK;
+      cmd.data = prefix + position;
+    } else if (verb == "warm") {
+      if (video.empty()) {
+        channel.error(id, "video required");
+        continue;
+      }
+      cmd.type = Command::WARM_VIDEO;
+      cmd.data = video;
+    } else if (verb == "add_stream" && multiStream) {
+      if (stream.empty() || request["channel"].empty() || request["uid"].empty() || video.empty()) {
+        channel.error(id, "stream, channel, uid and video required");
+        continue;
+      }
+      cmd.type = Command::ADD_STREAM;
+      cmd.data = stream + " " + request["channel"] + " " + request["uid"] + " " + video;
+      if (!request["token"].empty()) {
+        cmd.data += " " + request["token"];
+      }
+    } else if (verb == "assign" && standby) {
+      if (request["channel"].empty() || request["uid"].empty() || video.empty()) {
+        channel.error(id, "channel, uid and video required");
+        continue;
+      }
+      cmd.type = Command::ASSIGN;
+      cmd.data = request["channel"] + "," + request["uid"] + "," + video + at;
+    } else if (verb == "remove_stream" && multiStream) {
+      cmd.type = Command::REMOVE_STREAM;
+      cmd.data = stream;
+    } else if (verb == "stats") {
+      std::string report = MetricsRegistry::instance().report();
+      report.erase(report.find_last_not_of('\n') + 1);
+      channel.reply(id, "done", ",\"metrics\":" + report);
+      continue;
+    } else if (verb == "exit") {
+      channel.reply(id, "done");
+      commandQueue.push(Command(Command::EXIT, ""));
+      break;
+    } else {
+      channel.error(id, "unknown command: " + verb);
+      continue;
+    }
+    printf("Received control command %llu: %s %s\n", static_cast<unsigned long long>(id), verb.c_str(),
+           cmd.data.c_str());
+    channel.reply(id, "accepted");
+    commandQueue.push(cmd);
   }
-  return url;
 }
 
-/* ====== M3U8 Parser ================================= */
+/* ====== Stream Sessions ================================= */
 
-struct M3U8Segment {
-  std::string url;
-  std::string localPath;
-  double duration;
-};
-
-class M3U8Parser {
-public:
-  bool parseM3U8(const std::string& m3u8Path, const std::string& baseUrl = "");
-  bool downloadSegments(const std::string& cacheBasePath);
-  const std::vector<M3U8Segment>& getSegments() const { return segments_; }
-  
-private:
-  std::vector<M3U8Segment> segments_;
-  std::string baseUrl_;
+// One published channel: its connection, video track and playlist. The default mode runs a
+// single session, --multi hosts any number of them on one shared IAgoraService.
+struct StreamSession {
+  std::string streamId;
+  std::string channelId;
+  std::string userId;
+  std::string token;
+  std::string videoFile;
+  agora::agora_refptr<agora::rtc::IRtcConnection> connection;
+  std::shared_ptr<SampleConnectionObserver> connObserver;
+  std::shared_ptr<SampleLocalUserObserver> localUserObserver;
+  agora::agora_refptr<agora::rtc::IVideoEncodedImageSender> videoFrameSender;
+  agora::agora_refptr<agora::rtc::ILocalVideoTrack> customVideoTrack;
+  agora::agora_refptr<agora::rtc::IAudioEncodedFrameSender> audioFrameSender; // null without --audio
+  agora::agora_refptr<agora::rtc::ILocalAudioTrack> customAudioTrack;
+  std::shared_ptr<PlaylistManager> playlistManager;
+  std::shared_ptr<PlaylistManager> lowPlaylistManager; // simulcast low stream, null when off
+  std::shared_ptr<RenditionController> renditions = std::make_shared<RenditionController>();
+  std::shared_ptr<StreamMetrics> metrics;
+  CommandQueue commands;
+  uint64_t addId = 0; // control channel request that added the stream, answered once it is ready
+  std::atomic<bool> stop{false};
+  std::atomic<bool> finished{false};
+  std::thread sendThread;
 };
 
-bool M3U8Parser::parseM3U8(const std::string& m3u8Path, const std::string& baseUrl) {
-  baseUrl_ = baseUrl;
-  segments_.clear();
-  
-  std::ifstream file(m3u8Path);
-  if (!file.is_open()) {
-    fprintf(stderr, "Failed to open M3U8 file: %s\n", m3u8Path.c_str());
+// Loads the session's playlists, which may download them and their first segments. Runs while
+// openStreamSession joins the channel, so neither waits for the other.
+static bool loadStreamMedia(const SampleOptions& options, StreamSession& session) {
+  if (!session.playlistManager->initialize(resolveRenditions(session.videoFile, *session.renditions))) {
+    AG_LOG(ERROR, "Failed to initialize playlist manager for %s", session.videoFile.c_str());
     return false;
   }
-  
-  std::string line;
-  double duration = 0.0;
-  
-  while (std::getline(file, line)) {
-    // Remove carriage return if present
-    if (!line.empty() && line.back() == '\r') {
-      line.pop_back();
-    }
-    
-    if (line.empty() || line[0] == '#') {
-      // Parse duration from #EXTINF lines
-      if (line.find("#EXTINF:") == 0) {
-        size_t colonPos = line.find(':');
-        size_t commaPos = line.find(',');
-        if (colonPos != std::string::npos && commaPos != std::string::npos) {
-          std::string durationStr = line.substr(colonPos + 1, commaPos - colonPos - 1);
-          duration = std::stod(durationStr);
-        }
-      }
-      continue;
-    }
-    
-    // This is a segment URL
-    M3U8Segment segment;
-    segment.duration = duration;
-    
-    if (line.find("http://") == 0 || line.find("https://") == 0) {
-      // Absolute URL
-      segment.url = line;
-    } else {
-      // Relative URL
-      segment.url = baseUrl_ + line;
-    }
-    
-    segments_.push_back(segment);
-    duration = 0.0; // Reset for next segment
-  }
-  
-  printf("Parsed M3U8: found %zu segments\n", segments_.size());
-  return !segments_.empty();
-}
-
-bool M3U8Parser::downloadSegments(const std::string& cacheBasePath) {
-  for (auto& segment : segments_) {
-    // Extract filename from URL
-    std::string filename;
-    size_t lastSlash = segment.url.find_last_of('/');
-    if (lastSlash != std::string::npos) {
-      filename = segment.url.substr(lastSlash + 1);
-    } else {
-      filename = segment.url;
-    }
-    
-    segment.localPath = cacheBasePath + "/" + filename;
-    
-    // Download if not already cached
-    if (!fileExists(segment.localPath)) {
-      if (!downloadFile(segment.url, segment.localPath)) {
-        fprintf(stderr, "Failed to download segment: %s\n", segment.url.c_str());
-        return false;
-      }
-    } else {
-      printf("Using cached segment: %s\n", segment.localPath.c_str());
-    }
+  if (session.lowPlaylistManager && !session.lowPlaylistManager->initialize(options.lowStream.videoFile)) {
+    AG_LOG(ERROR, "Failed to initialize playlist manager for %s", options.lowStream.videoFile.c_str());
+    return false;
   }
-  
+  session.metrics->startup.mark(session.metrics->startup.mediaUs);
   return true;
 }
 
-/* ====== MPEG-TS H264 Parser ================================= */
-
-#define TS_PKT_SIZE      188
-#define TS_SYNC_BYTE     0x47
-#define ADAPT_FIELD_FLAG 0x20
-#define PAYLOAD_FLAG     0x10
-#define PES_START_CODE   0x000001
-
-static inline uint16_t pid(const uint8_t* p) { return ((p[1] & 0x1F) << 8) | p[2]; }
-static inline bool     payloadUnitStart(const uint8_t* p) { return p[1] & 0x40; }
-static inline int      adaptFieldLen(const uint8_t* p) {
-  if (!(p[3] & ADAPT_FIELD_FLAG)) return 0;
-  int len = p[4] + 1;                    // +1 = length byte itself
-  return len > 183 ? -1 /*invalid*/ : len;
-}
+// Connects the session to its channel and publishes a custom encoded video track on it,
+// with --audio an encoded audio track next to it
+static bool openStreamSession(agora::base::IAgoraService* service,
+                              agora::agora_refptr<agora::rtc::IMediaNodeFactory> factory,
+                              const SampleOptions& options, StreamSession& session,
+                              CommandQueue& sendCommands) {
 
-/* ===== utility logging ================================================== */
-namespace {
-  std::function<void(const char*)>& logger() {
-    static std::function<void(const char*)> cb = nullptr;
-    return cb;
+  // Create Agora connection
+  agora::rtc::RtcConnectionConfiguration ccfg;
+  ccfg.autoSubscribeAudio = false;
+  ccfg.autoSubscribeVideo = false;
+  ccfg.clientRoleType = agora::rtc::CLIENT_ROLE_BROADCASTER;
+  session.connection = service->createRtcConnection(ccfg);
+  if (!session.connection) {
+    AG_LOG(ERROR, "Failed to creating Agora connection!");
+    return false;
   }
-}
 
-void setLogger(std::function<void(const char*)> fn) {
-  logger() = std::move(fn);
-}
-
-#define LOGF(fmt, ...)                                    \
-  do {                                                    \
-    char _buf[256];                                       \
-    std::snprintf(_buf, sizeof(_buf), fmt, ##__VA_ARGS__); \
-    if (logger())                                         \
-      logger()(_buf);                                     \
-    else                                                  \
-      std::fprintf(stderr, "%s\n", _buf);                \
-  } while (0)
-
-/* ===== TS H264 File Parser Class ============================================ */
-
-class HelperTsH264FileParser {
-public:
-  explicit HelperTsH264FileParser(const char* filepath);
-  ~HelperTsH264FileParser();
-  
-  bool initialize();
-  void setFileParseRestart();
-  std::unique_ptr<HelperH264Frame> getH264Frame();
-  static void setLogger(std::function<void(const char*)> fn);
-
-private:
-  bool _probeProgramPids();
-  size_t _readOnePes(uint8_t*& out, bool& key, size_t& pts_off);
-  
-  std::string file_path_;
-  int fd_ = -1;
-  uint8_t* data_ = nullptr;
-  size_t size_ = 0;
-  size_t offset_ = 0;
-  uint16_t video_pid_ = 0;
-};
+  if (!options.localIP.empty()) {
+    if (setLocalIP(session.connection, options.localIP)){
+      AG_LOG(ERROR, "set local IP to %s error!", options.localIP.c_str());
+      return false;
+    }
+  }
 
-HelperTsH264FileParser::HelperTsH264FileParser(const char* filepath)
-    : file_path_(filepath) {}
+  // Register connection observer to monitor connection event
+  session.connObserver = std::make_shared<SampleConnectionObserver>();
+  std::shared_ptr<StreamMetrics> metrics = session.metrics;
+  session.connObserver->setConnectedCallback([metrics]() { metrics->startup.mark(metrics->startup.connectUs); });
+  session.connection->registerObserver(session.connObserver.get());
+
+  // Register network observer to monitor bandwidth estimation result, it also drives the
+  // rendition choice of master playlists. --bwe prints the estimates.
+  session.connObserver->setLogUplinkEstimates(options.video.showBandwidthEstimation);
+  session.connObserver->setUplinkEstimateCallback([&sendCommands](int bps) {
+    sendCommands.push(Command(Command::BANDWIDTH_ESTIMATE, std::to_string(bps)));
+  });
+  session.connection->registerNetworkObserver(session.connObserver.get());
 
-HelperTsH264FileParser::~HelperTsH264FileParser() {
-  if (data_) munmap(data_, size_);
-  if (fd_ >= 0) close(fd_);
-}
+  // Create local user observer to monitor intra frame request
+  session.localUserObserver = std::make_shared<SampleLocalUserObserver>(session.connection->getLocalUser());
+  if (options.intraRefreshMs > 0) {
+    std::weak_ptr<PlaylistManager> playlistManager = session.playlistManager;
+    std::weak_ptr<PlaylistManager> lowPlaylistManager = session.lowPlaylistManager;
+    session.playlistManager->setIntraRefreshInterval(options.intraRefreshMs);
+    if (session.lowPlaylistManager) {
+      session.lowPlaylistManager->setIntraRefreshInterval(options.intraRefreshMs);
+    }
+    session.localUserObserver->setIntraRequestCallback([playlistManager, lowPlaylistManager]() {
+      if (auto manager = playlistManager.lock()) {
+        manager->requestKeyFrame();
+      }
+      if (auto manager = lowPlaylistManager.lock()) {
+        manager->requestKeyFrame();
+      }
+    });
+  }
 
-bool HelperTsH264FileParser::initialize() {
-  struct stat st;
-  fd_ = open(file_path_.c_str(), O_RDONLY);
-  if (fd_ < 0 || fstat(fd_, &st) != 0) {
-    LOGF("Failed to open %s", file_path_.c_str());
+  // Connect to Agora channel (using string UID)
+  const char* userIdForConnect = session.userId.empty() ? "0" : session.userId.c_str();
+  if (session.connection->connect(session.token.c_str(), session.channelId.c_str(), userIdForConnect)) {
+    AG_LOG(ERROR, "Failed to connect to Agora channel!");
     return false;
   }
 
-  size_ = st.st_size;
-  data_ = static_cast<uint8_t*>(mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0));
-  if (data_ == MAP_FAILED) {
-    data_ = nullptr;
-    LOGF("mmap() failed on %s", file_path_.c_str());
+  // Create video frame sender
+  session.videoFrameSender = factory->createVideoEncodedImageSender();
+  if (!session.videoFrameSender) {
+    AG_LOG(ERROR, "Failed to create video frame sender!");
     return false;
   }
 
-  offset_ = 0;
-  return _probeProgramPids();
-}
-
-void HelperTsH264FileParser::setFileParseRestart() { offset_ = 0; }
-
-bool HelperTsH264FileParser::_probeProgramPids() {
-  for (size_t o = 0; o + TS_PKT_SIZE <= size_; o += TS_PKT_SIZE) {
-    const uint8_t* p = data_ + o;
-    if (p[0] != TS_SYNC_BYTE) continue;
-    if (pid(p) == 0 /* PAT */ && payloadUnitStart(p)) {
-      int adapt = adaptFieldLen(p);
-      if (adapt < 0) continue;
-      const uint8_t* pat = p + 4 + adapt;
-      
-      // Check bounds for pointer field
-      if (pat >= data_ + size_) continue;
-      uint8_t pointer = pat[0];
-      pat += 1 + pointer + 8; // skip pointer field and table hdr
-      
-      while (pat + 4 <= data_ + size_) {
-        uint16_t program = (pat[0] << 8) | pat[1];
-        uint16_t pmt_pid = ((pat[2] & 0x1F) << 8) | pat[3];
-        if (program) {
-          // Found a program, now look for its PMT
-          for (size_t o2 = 0; o2 + TS_PKT_SIZE <= size_; o2 += TS_PKT_SIZE) {
-            const uint8_t* q = data_ + o2;
-            if (q[0] != TS_SYNC_BYTE || pid(q) != pmt_pid || !payloadUnitStart(q))
-              continue;
-            int adapt2 = adaptFieldLen(q);
-            if (adapt2 < 0) continue;
-            const uint8_t* pmt = q + 4 + adapt2;
-            
-            // Check bounds for PMT
-            if (pmt >= data_ + size_) continue;
-            uint8_t ptr2 = pmt[0];
-            pmt += 1 + ptr2 + 12; // skip pointer + PMT header + program info
-            
-            while (pmt + 5 <= data_ + size_) {
-              uint8_t  stype = pmt[0];
-              uint16_t spid  = ((pmt[1] & 0x1F) << 8) | pmt[2];
-              uint16_t eslen = ((pmt[3] & 0x0F) << 8) | pmt[4];
-              if (stype == 0x1B /* AVC/H.264 */) {
-                video_pid_ = spid;
-                LOGF("Found H.264 stream on PID %u", video_pid_);
-                return true;
-              }
-              pmt += 5 + eslen;
-            }
-          }
-        }
-        pat += 4;
-      }
-      break;
-    }
+  agora::rtc::SenderOptions option;
+  option.ccMode = agora::rtc::TCcMode::CC_ENABLED;
+  // Create video track
+  session.customVideoTrack = service->createCustomVideoTrack(session.videoFrameSender, option);
+  if (!session.customVideoTrack) {
+    AG_LOG(ERROR, "Failed to create video track!");
+    return false;
   }
-  LOGF("No H.264 PID found in %s", file_path_.c_str());
-  return false;
-}
 
-size_t HelperTsH264FileParser::_readOnePes(uint8_t*& out, bool& key, size_t& pts_off) {
-  static uint8_t au_buf[1 << 20]; // 1 MiB scratch
-  size_t au_len = 0;
-  bool   started = false;
-  key = false;
-
-  const int kMaxDesync = 128; // abort after this many bad syncs
-  int desyncCnt = 0;
-
-  for (; offset_ + TS_PKT_SIZE <= size_; offset_ += TS_PKT_SIZE) {
-    const uint8_t* p = data_ + offset_;
-    if (p[0] != TS_SYNC_BYTE) {
-      if (++desyncCnt >= kMaxDesync) {
-        LOGF("Transport stream desynchronized – aborting at offset %zu", offset_);
-        offset_ = size_; // force EOF
-        break;
-      }
-      continue;
+  // Simulcast: frames sent as VIDEO_STREAM_LOW make up the track's low stream
+  if (session.lowPlaylistManager) {
+    agora::rtc::SimulcastStreamConfig lowConfig;
+    lowConfig.dimensions.width = options.lowStream.width;
+    lowConfig.dimensions.height = options.lowStream.height;
+    lowConfig.kBitrate = options.lowStream.bitrateKbps;
+    lowConfig.framerate = options.video.frameRate;
+    if (session.customVideoTrack->enableSimulcastStream(true, lowConfig)) {
+      AG_LOG(ERROR, "Failed to enable the simulcast low stream!");
+      return false;
     }
-    desyncCnt = 0;
-
-    if (pid(p) != video_pid_) continue;
-
-    int adapt = adaptFieldLen(p);
-    if (adapt < 0) continue;              // invalid adaptation field length
-
-    const uint8_t* pay = p + 4 + adapt;
-    size_t pay_len = TS_PKT_SIZE - 4 - adapt;
-    if (pay_len == 0 || pay > data_ + size_) continue;
-
-    if (payloadUnitStart(p)) {
-      if (started) break;                // previous AU complete
-      started = true;
-
-      if (pay_len < 9) continue;         // PES header must fit
-      if (pay[0] != 0x00 || pay[1] != 0x00 || pay[2] != 0x01) continue; // bad start
+  }
 
-      size_t pes_head = 9 + pay[8];
-      if (pes_head > pay_len) continue;  // declared header longer than packet
+  // Publish video track
+  session.connection->getLocalUser()->publishVideo(session.customVideoTrack);
 
-      pay     += pes_head;
-      pay_len -= pes_head;
+  if (options.publishAudio) {
+    // Create audio frame sender and track, fed the segments' AAC frames as they are
+    session.audioFrameSender = factory->createAudioEncodedFrameSender();
+    if (!session.audioFrameSender) {
+      AG_LOG(ERROR, "Failed to create audio frame sender!");
+      return false;
     }
-
-    if (au_len + pay_len > sizeof(au_buf)) {
-      LOGF("Access‑unit larger than %zu bytes – truncated", sizeof(au_buf));
-      break;   // send what we have so far
+    session.customAudioTrack = service->createCustomAudioTrack(session.audioFrameSender, agora::rtc::MIX_DISABLED);
+    if (!session.customAudioTrack) {
+      AG_LOG(ERROR, "Failed to create audio track!");
+      return false;
     }
 
-    std::memcpy(au_buf + au_len, pay, pay_len);
-    au_len += pay_len;
-
-    // IDR detection (3‑ and 4‑byte prefixes)
-    for (size_t i = 0; i + 5 < pay_len; ++i) {
-      if (pay[i] == 0x00 && pay[i+1] == 0x00) {
-        if (pay[i+2] == 0x01) {
-          uint8_t nal = pay[i+3] & 0x1F;
-          if (nal == 5) key = true;       // IDR slice
-        } else if (pay[i+2] == 0x00 && pay[i+3] == 0x01) {
-          uint8_t nal = pay[i+4] & 0x1F;
-          if (nal == 5) key = true;       // IDR slice
-          i += 3; // skip extra bytes of 4‑byte prefix (loop ++i will add one)
-        }
-      }
-    }
+    // Publish audio track
+    session.connection->getLocalUser()->publishAudio(session.customAudioTrack);
   }
-
-  out = au_len ? au_buf : nullptr;
-  pts_off = 0;
-  return au_len;
+  return true;
 }
 
-std::unique_ptr<HelperH264Frame> HelperTsH264FileParser::getH264Frame() {
-  uint8_t* ptr; 
-  bool is_key = false; 
-  size_t dummy;
-  
-  size_t len = _readOnePes(ptr, is_key, dummy);
-  if (!len) { 
-    // EOF reached, reset for looping
-    offset_ = 0; 
-    return nullptr; 
+// Stops the session's send thread, then unpublishes and disconnects whatever openStreamSession set up
+static bool closeStreamSession(StreamSession& session) {
+  session.stop = true;
+  session.commands.wake();
+  if (session.sendThread.joinable()) {
+    session.sendThread.join();
   }
 
-  // Create a copy of the data for the frame (C++11 compatible)
-  std::unique_ptr<uint8_t[]> buf(new uint8_t[len]);
-  std::memcpy(buf.get(), ptr, len);
-  
-  return std::unique_ptr<HelperH264Frame>(new HelperH264Frame(is_key, std::move(buf), static_cast<int>(len)));
-}
-
-/* ====== Thread-Safe Playlist Manager ================================= */
-
-class PlaylistManager {
-public:
-  bool initialize(const std::string& input);
-  std::unique_ptr<HelperH264Frame> getNextFrame();
-  bool preloadNewPlaylist(const std::string& input);
-  bool switchToNewPlaylist();
-  std::string getCurrentVideoFile() const;
-  
-private:
-  bool isM3U8(const std::string& path);
-  bool isURL(const std::string& path);
-  bool setupSingleFile(const std::string& path);
-  bool setupPlaylist(const std::string& path);
-  
-  // Current playlist
-  std::vector<std::string> segmentPaths_;
-  size_t currentSegmentIndex_ = 0;
-  std::unique_ptr<HelperTsH264FileParser> currentParser_;
-  bool isPlaylist_ = false;
-  std::string currentVideoFile_;
-  
-  // New playlist (for preloading)
-  std::vector<std::string> newSegmentPaths_;
-  std::string newVideoFile_;
-  bool newPlaylistReady_ = false;
-  
-  // Thread safety
-  mutable std::mutex mutex_;
-  
-  // Internal setup methods
-  bool internalSetupSingleFile(const std::string& path, std::vector<std::string>& paths, bool& isPlaylist);
-  bool internalSetupPlaylist(const std::string& path, std::vector<std::string>& paths, bool& isPlaylist);
-};
-
-bool PlaylistManager::isM3U8(const std::string& path) {
-  return path.size() >= 5 && path.substr(path.size() - 5) == ".m3u8";
-}
-
-bool PlaylistManager::isURL(const std::string& path) {
-  return path.find("http://") == 0 || path.find("https://") == 0;
-}
-
-std::string PlaylistManager::getCurrentVideoFile() const {
-  std::lock_guard<std::mutex> lock(mutex_);
-  return currentVideoFile_;
-}
+  bool success = true;
+  if (session.connection) {
+    // Unpublish video track
+    if (session.customVideoTrack) {
+      session.connection->getLocalUser()->unpublishVideo(session.customVideoTrack);
+    }
 
-bool PlaylistManager::initialize(const std::string& input) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  currentVideoFile_ = input;
-  
-  if (isM3U8(input)) {
-    return internalSetupPlaylist(input, segmentPaths_, isPlaylist_);
-  } else {
-    return internalSetupSingleFile(input, segmentPaths_, isPlaylist_);
-  }
-}
+    // Unpublish audio track
+    if (session.customAudioTrack) {
+      session.connection->getLocalUser()->unpublishAudio(session.customAudioTrack);
+    }
 
-bool PlaylistManager::internalSetupSingleFile(const std::string& path, std::vector<std::string>& paths, bool& isPlaylist) {
-  isPlaylist = false;
-  paths.clear();
-  paths.push_back(path);
-  currentSegmentIndex_ = 0;
-  
-  currentParser_.reset(new HelperTsH264FileParser(path.c_str()));
-  return currentParser_->initialize();
-}
+    if (session.connObserver) {
+      // Unregister connection observer
+      session.connection->unregisterObserver(session.connObserver.get());
 
-bool PlaylistManager::internalSetupPlaylist(const std::string& path, std::vector<std::string>& paths, bool& isPlaylist) {
-  isPlaylist = true;
-  paths.clear();
-  currentSegmentIndex_ = 0;
-  
-  std::string m3u8Path = path;
-  std::string baseUrl;
-  
-  // Handle URL download
-  if (isURL(path)) {
-    std::string cachePath = extractCachePath(path);
-    std::string fullCachePath = std::string(CACHE_BASE_PATH) + "/" + cachePath;
-    
-    // Create cache directory
-    size_t lastSlash = fullCachePath.find_last_of('/');
-    if (lastSlash != std::string::npos) {
-      std::string cacheDir = fullCachePath.substr(0, lastSlash);
-      if (!createDirectoryRecursive(cacheDir)) {
-        fprintf(stderr, "Failed to create cache directory: %s\n", cacheDir.c_str());
-        return false;
-      }
-    }
-    
-    // Download M3U8 if not cached
-    if (!fileExists(fullCachePath)) {
-      if (!downloadFile(path, fullCachePath)) {
-        fprintf(stderr, "Failed to download M3U8: %s\n", path.c_str());
-        return false;
-      }
-    }
-    
-    m3u8Path = fullCachePath;
-    baseUrl = getBaseUrl(path);
-  }
-  
-  // Parse M3U8
-  M3U8Parser parser;
-  if (!parser.parseM3U8(m3u8Path, baseUrl)) {
-    return false;
-  }
-  
-  // Download segments if needed
-  if (isURL(path)) {
-    std::string cachePath = extractCachePath(path);
-    size_t lastSlash = cachePath.find_last_of('/');
-    std::string cacheDir = std::string(CACHE_BASE_PATH) + "/" + 
-                          (lastSlash != std::string::npos ? cachePath.substr(0, lastSlash) : cachePath);
-    
-    if (!parser.downloadSegments(cacheDir)) {
-      return false;
+      // Unregister network observer
+      session.connection->unregisterNetworkObserver(session.connObserver.get());
     }
-  }
-  
-  // Set up segment paths
-  for (const auto& segment : parser.getSegments()) {
-    if (isURL(path)) {
-      paths.push_back(segment.localPath);
+
+    // Disconnect from Agora channel
+    if (session.connection->disconnect()) {
+      AG_LOG(ERROR, "Failed to disconnect from Agora channel!");
+      success = false;
     } else {
-      // Local M3U8 - segments are relative to M3U8 location
-      std::string segmentPath = segment.url;
-      if (segmentPath.find('/') != 0) { // Relative path
-        size_t lastSlash = m3u8Path.find_last_of('/');
-        if (lastSlash != std::string::npos) {
-          segmentPath = m3u8Path.substr(0, lastSlash + 1) + segmentPath;
-        }
-      }
-      paths.push_back(segmentPath);
+      AG_LOG(INFO, "Disconnected from Agora channel successfully");
     }
   }
-  
-  if (paths.empty()) {
-    return false;
-  }
-  
-  // Initialize first segment
-  currentParser_.reset(new HelperTsH264FileParser(paths[0].c_str()));
-  return currentParser_->initialize();
-}
 
-bool PlaylistManager::preloadNewPlaylist(const std::string& input) {
-  printf("Preloading new playlist: %s\n", input.c_str());
-  
-  // Setup new playlist in background (without holding the main mutex for too long)
-  std::vector<std::string> tempPaths;
-  bool tempIsPlaylist;
-  
-  bool success;
-  if (isM3U8(input)) {
-    success = internalSetupPlaylist(input, tempPaths, tempIsPlaylist);
-  } else {
-    success = internalSetupSingleFile(input, tempPaths, tempIsPlaylist);
-  }
-  
-  if (success) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    newSegmentPaths_ = std::move(tempPaths);
-    newVideoFile_ = input;
-    newPlaylistReady_ = true;
-    printf("New playlist preloaded and ready for switching\n");
-  }
-  
+  // Destroy Agora connection and related resources
+  session.connObserver.reset();
+  session.localUserObserver.reset();
+  session.videoFrameSender = nullptr;
+  session.customVideoTrack = nullptr;
+  session.audioFrameSender = nullptr;
+  session.customAudioTrack = nullptr;
+  session.connection = nullptr;
+  session.playlistManager.reset();
+  session.lowPlaylistManager.reset();
+  session.metrics.reset();
   return success;
 }
 
-bool PlaylistManager::switchToNewPlaylist() {
-  std::lock_guard<std::mutex> lock(mutex_);
-  
-  if (!newPlaylistReady_) {
-    return false;
-  }
-  
-  printf("Switching to new playlist: %s\n", newVideoFile_.c_str());
-  
-  // Switch to new playlist
-  segmentPaths_ = std::move(newSegmentPaths_);
-  currentVideoFile_ = newVideoFile_;
-  currentSegmentIndex_ = 0;
-  newPlaylistReady_ = false;
-  
-  // Initialize first segment of new playlist
-  if (!segmentPaths_.empty()) {
-    currentParser_.reset(new HelperTsH264FileParser(segmentPaths_[0].c_str()));
-    bool success = currentParser_->initialize();
-    if (success) {
-      printf("Successfully switched to: %s\n", currentVideoFile_.c_str());
-    }
-    return success;
+/* ====== Multi-Stream Mode ================================= */
+
+// Runs on the session's own thread so a slow playlist download or connect never stalls the dispatcher
+static void RunStreamSessionTask(const SampleOptions* options, agora::base::IAgoraService* service,
+                                 agora::agora_refptr<agora::rtc::IMediaNodeFactory> factory,
+                                 StreamSession* session) {
+  session->metrics = MetricsRegistry::instance().addStream(session->streamId);
+  session->playlistManager = std::make_shared<PlaylistManager>(options->lookahead);
+  session->playlistManager->setLive(options->live, options->liveLatencyMs);
+  session->playlistManager->setSyncEpoch(options->syncEpochMs);
+  std::future<bool> media = std::async(std::launch::async, loadStreamMedia, std::cref(*options), std::ref(*session));
+  if (!openStreamSession(service, factory, *options, *session, session->commands)) {
+    AG_LOG(ERROR, "Stream %s: failed to join channel %s", session->streamId.c_str(), session->channelId.c_str());
+  } else if (!media.get()) {
+    AG_LOG(ERROR, "Stream %s: failed to load %s", session->streamId.c_str(), session->videoFile.c_str());
+  } else {
+    // Wait until connected before sending media stream
+    session->connObserver->waitUntilConnected(DEFAULT_CONNECT_TIMEOUT_MS);
+    printf("Stream %s ready on channel %s. Current video: %s\n", session->streamId.c_str(),
+           session->channelId.c_str(), session->playlistManager->getCurrentVideoFile().c_str());
+    ControlChannel::instance().reply(session->addId, "done");
+    session->addId = 0;
+    SampleSendVideoH264Task(*options, session->videoFrameSender, session->audioFrameSender, session->playlistManager,
+                            session->lowPlaylistManager, session->renditions, session->metrics,
+                            session->commands, session->stop);
   }
-  
-  return false;
+  ControlChannel::instance().error(session->addId, "stream setup failed");
+  session->finished = true;
 }
 
-std::unique_ptr<HelperH264Frame> PlaylistManager::getNextFrame() {
-  std::lock_guard<std::mutex> lock(mutex_);
-  
-  if (!currentParser_) {
+// ADD_STREAM:<streamId> <channelId> <userId> <videoFile> [token]
+static std::unique_ptr<StreamSession> parseAddStream(const std::string& data, const SampleOptions& options) {
+  std::unique_ptr<StreamSession> session(new StreamSession());
+  std::istringstream fields(data);
+  if (!(fields >> session->streamId >> session->channelId >> session->userId >> session->videoFile)) {
     return nullptr;
   }
-  
-  auto frame = currentParser_->getH264Frame();
-  if (frame) {
-    return frame;
+  if (!(fields >> session->token)) {
+    session->token = options.appId;
   }
-  
-  // Current segment ended
-  if (isPlaylist_ && segmentPaths_.size() > 1) {
-    // Move to next segment
-    currentSegmentIndex_ = (currentSegmentIndex_ + 1) % segmentPaths_.size();
-    printf("Switching to segment %zu: %s\n", currentSegmentIndex_, segmentPaths_[currentSegmentIndex_].c_str());
-    
-    currentParser_.reset(new HelperTsH264FileParser(segmentPaths_[currentSegmentIndex_].c_str()));
-    if (currentParser_->initialize()) {
-      return currentParser_->getH264Frame();
-    }
-  } else {
-    // Single file - restart
-    currentParser_->setFileParseRestart();
-    return currentParser_->getH264Frame();
-  }
-  
-  return nullptr;
+  return session;
 }
 
-/* ====== Command Processing ================================= */
-
-void processStdinCommands() {
-  std::string line;
-  while (!exitFlag && std::getline(std::cin, line)) {
-    if (line.empty()) continue;
-    
-    // Parse command
-    if (line == "EXIT") {
-      commandQueue.push(Command(Command::EXIT, ""));
-      break;
-    } else if (line.find("SWITCH_VIDEO:") == 0) {
-      std::string videoFile = line.substr(13); // Length of "SWITCH_VIDEO:"
-      if (!videoFile.empty()) {
-        commandQueue.push(Command(Command::SWITCH_VIDEO, videoFile));
-        printf("Received switch video command: %s\n", videoFile.c_str());
-      }
-    } else {
-      printf("Unknown command: %s\n", line.c_str());
-    }
+// Starts reading stdin and, with --controlFd, the control channel. With a control channel the
+// stdin thread is returned detached, since an exit sent there leaves getline blocked.
+static std::thread startCommandThreads(const SampleOptions& options) {
+  std::thread stdinThread(processStdinCommands);
+  if (options.controlFd >= 0) {
+    std::thread(processControlCommands, options.controlFd, options.multiStream, options.standby).detach();
+    stdinThread.detach();
   }
+  return stdinThread;
 }
 
-/* ====== Main Application Code ================================= */
+static int runMultiStream(const SampleOptions& options) {
+  printf("Starting Agora Streaming in multi-stream mode\n");
+  printf("Commands: ADD_STREAM:<id> <channel> <uid> <url> [token], SWITCH_VIDEO:<id> <url>, SEEK:<id> <ms>, "
+         "REMOVE_STREAM:<id> or EXIT\n");
 
-struct SampleOptions {
-  std::string appId;
-  std::string channelId;
-  std::string userId;
-  std::string videoFile = DEFAULT_VIDEO_FILE;
-  std::string localIP;
-  struct {
-    int frameRate = DEFAULT_FRAME_RATE;
-    bool showBandwidthEstimation = false;
-  } video;
-};
+  // One service and media node factory for every stream in the process
+  auto service = createAndInitAgoraService(false, true, true, options.stringUid);
+  if (!service) {
+    AG_LOG(ERROR, "Failed to creating Agora service!");
+    return -1;
+  }
 
-static void sendOneH264Frame(
-    int frameRate, std::unique_ptr<HelperH264Frame> h264Frame,
-    agora::agora_refptr<agora::rtc::IVideoEncodedImageSender> videoH264FrameSender) {
-  agora::rtc::EncodedVideoFrameInfo videoEncodedFrameInfo;
-  videoEncodedFrameInfo.rotation = agora::rtc::VIDEO_ORIENTATION_0;
-  videoEncodedFrameInfo.codecType = agora::rtc::VIDEO_CODEC_H264;
-  videoEncodedFrameInfo.framesPerSecond = frameRate;
-  videoEncodedFrameInfo.frameType =
-      (h264Frame.get()->isKeyFrame ? agora::rtc::VIDEO_FRAME_TYPE::VIDEO_FRAME_TYPE_KEY_FRAME
-                                   : agora::rtc::VIDEO_FRAME_TYPE::VIDEO_FRAME_TYPE_DELTA_FRAME);
-
-  videoH264FrameSender->sendEncodedVideoImage(
-      reinterpret_cast<uint8_t*>(h264Frame.get()->buffer.get()), h264Frame.get()->bufferLen,
-      videoEncodedFrameInfo);
-}
+  agora::agora_refptr<agora::rtc::IMediaNodeFactory> factory = service->createMediaNodeFactory();
+  if (!factory) {
+    AG_LOG(ERROR, "Failed to create media node factory!");
+    service->release();
+    return -1;
+  }
 
-static void SampleSendVideoH264Task(
-    const SampleOptions& options,
-    agora::agora_refptr<agora::rtc::IVideoEncodedImageSender> videoH264FrameSender,
-    PlaylistManager& playlistManager) {
-  
-  // Calculate send interval based on frame rate
-  PacerInfo pacer = {0, 1000 / options.video.frameRate, 0, std::chrono::steady_clock::now()};
-  
-  std::string pendingVideoSwitch;
-  bool switchRequested = false;
+  // Start command processing thread
+  std::thread commandThread = startCommandThreads(options);
+  printf("Process ready for commands\n");
 
+  std::map<std::string, std::unique_ptr<StreamSession>> sessions;
   while (!exitFlag) {
-    // Check for commands
     Command cmd(Command::EXIT, "");
-    if (commandQueue.pop(cmd, 1)) { // 1ms timeout
+    if (commandQueue.pop(cmd)) {
       switch (cmd.type) {
         case Command::EXIT:
           printf("Received exit command\n");
           exitFlag = true;
           break;
-          
+
+        case Command::ADD_STREAM: {
+          std::unique_ptr<StreamSession> session = parseAddStream(cmd.data, options);
+          if (!session) {
+            printf("Invalid add stream command: %s\n", cmd.data.c_str());
+            ControlChannel::instance().error(cmd.id, "invalid add stream command");
+          } else if (sessions.count(session->streamId)) {
+            printf("Stream %s already exists\n", session->streamId.c_str());
+            ControlChannel::instance().error(cmd.id, "stream already exists");
+          } else {
+            StreamSession* raw = session.get();
+            raw->addId = cmd.id;
+            raw->sendThread = std::thread(RunStreamSessionTask, &options, service, factory, raw);
+            sessions[raw->streamId] = std::move(session);
+          }
+        } break;
+
         case Command::SWITCH_VIDEO:
-          printf("Processing video switch to: %s\n", cmd.data.c_str());
-          pendingVideoSwitch = cmd.data;
-          switchRequested = true;
-          
-          // Start preloading in background thread
-          std::thread([&playlistManager, cmd]() {
-            playlistManager.preloadNewPlaylist(cmd.data);
-          }).detach();
+        case Command::PRELOAD_VIDEO:
+        case Command::QUEUE_VIDEO:
+        case Command::CLEAR_QUEUE:
+        case Command::SEEK: {
+          // SWITCH_VIDEO:<streamId> <videoFile>, SEEK:<streamId> <ms>, CLEAR_QUEUE:<streamId>; the
+          // stream's own command keeps the request id
+          if (cmd.type == Command::CLEAR_QUEUE) {
+            cmd.data += " ";
+          }
+          size_t space = cmd.data.find(' ');
+          auto it = sessions.find(cmd.data.substr(0, space));
+          if (space == std::string::npos || it == sessions.end()) {
+            printf("No stream for switch video command: %s\n", cmd.data.c_str());
+            ControlChannel::instance().error(cmd.id, "no such stream");
+          } else {
+            cmd.data = cmd.data.substr(space + 1);
+            it->second->commands.push(cmd);
+          }
+        } break;
+
+        case Command::WARM_VIDEO:
+          warmVideos(cmd.data, cmd.id, options.lookahead); // the segment store is shared by all streams
+          break;
+
+        case Command::REMOVE_STREAM: {
+          auto it = sessions.find(cmd.data);
+          if (it == sessions.end()) {
+            printf("No stream to remove: %s\n", cmd.data.c_str());
+            ControlChannel::instance().error(cmd.id, "no such stream");
+          } else {
+            closeStreamSession(*it->second);
+            sessions.erase(it);
+            printf("Stream %s removed\n", cmd.data.c_str());
+            ControlChannel::instance().reply(cmd.id, "done");
+          }
+        } break;
+
+        default:
           break;
       }
     }
-    
-    // Check if we can switch to preloaded playlist
-    if (switchRequested) {
-      if (playlistManager.switchToNewPlaylist()) {
-        printf("Successfully switched video to: %s\n", pendingVideoSwitch.c_str());
-        switchRequested = false;
-        pendingVideoSwitch.clear();
+
+    // Reap streams whose setup failed
+    for (auto it = sessions.begin(); it != sessions.end();) {
+      if (it->second->finished && !exitFlag) {
+        printf("Stream %s stopped\n", it->first.c_str());
+        closeStreamSession(*it->second);
+        it = sessions.erase(it);
+      } else {
+        ++it;
       }
     }
-    
-    // Get and send next frame
-    if (auto h264Frame = playlistManager.getNextFrame()) {
-      sendOneH264Frame(options.video.frameRate, std::move(h264Frame), videoH264FrameSender);
-      waitBeforeNextSend(pacer);
-    } else {
-      // No frame available, short sleep to prevent busy loop
-      std::this_thread::sleep_for(std::chrono::milliseconds(10));
-    }
   }
+
+  for (auto& entry : sessions) {
+    closeStreamSession(*entry.second);
+  }
+  sessions.clear();
+
+  // Signal command thread to exit and wait
+  if (commandThread.joinable()) {
+    commandThread.join();
+  }
+
+  factory = nullptr;
+  service->release();
+  service = nullptr;
+
+  printf("Shutdown complete\n");
+  return 0;
+}
+
+/* ====== Standby Mode ================================= */
+
+// Makes the service and media node factory of a --standby process, everything in joining that
+// doesn't depend on the channel, so an assignment only has to connect
+static bool startStandby(const SampleOptions& options, agora::base::IAgoraService*& service,
+                         agora::agora_refptr<agora::rtc::IMediaNodeFactory>& factory) {
+  service = createAndInitAgoraService(false, true, true, options.stringUid);
+  if (!service) {
+    AG_LOG(ERROR, "Failed to creating Agora service!");
+    return false;
+  }
+  factory = service->createMediaNodeFactory();
+  if (!factory) {
+    AG_LOG(ERROR, "Failed to create media node factory!");
+    service->release();
+    service = nullptr;
+    return false;
+  }
+  return true;
 }
 
+// Waits for the ASSIGN:<channel>,<uid>,<video> that names the stream and fills it into options,
+// with the request id to answer once it plays. WARM_VIDEO is served meanwhile. False on EXIT.
+static bool waitForAssignment(SampleOptions& options, uint64_t& assignId) {
+  while (!exitFlag) {
+    Command cmd(Command::EXIT, "");
+    if (!commandQueue.pop(cmd)) {
+      continue;
+    }
+    switch (cmd.type) {
+      case Command::EXIT:
+        printf("Received exit command\n");
+        exitFlag = true;
+        break;
+
+      case Command::WARM_VIDEO:
+        warmVideos(cmd.data, cmd.id, options.lookahead);
+        break;
+
+      case Command::ASSIGN: {
+        size_t uid = cmd.data.find(',');
+        size_t video = uid == std::string::npos ? uid : cmd.data.find(',', uid + 1);
+        if (video == std::string::npos || uid == 0 || video == uid + 1 || video + 1 == cmd.data.size()) {
+          printf("Invalid assign command: %s\n", cmd.data.c_str());
+          ControlChannel::instance().error(cmd.id, "invalid assign command");
+          break;
+        }
+        options.channelId = cmd.data.substr(0, uid);
+        options.userId = cmd.data.substr(uid + 1, video - uid - 1);
+        options.videoFile = cmd.data.substr(video + 1);
+        assignId = cmd.id;
+        return true;
+      }
+
+      default:
+        printf("No stream assigned yet, ignoring command\n");
+        ControlChannel::instance().error(cmd.id, "no stream assigned yet");
+        break;
+    }
+  }
+  return false;
+}
 static void SignalHandler(int sigNo) { 
   printf("Received signal %d, shutting down...\n", sigNo);
   exitFlag = true; 
@@ -901,16 +714,70 @@ int main(int argc, char* argv[]) {
   opt_parser optParser;
 
   optParser.add_long_opt("token", &options.appId, "The token for authentication / must");
-  optParser.add_long_opt("channelId", &options.channelId, "Channel Id / must");
+  optParser.add_long_opt("channelId", &options.channelId, "Channel Id / must unless --multi");
   optParser.add_long_opt("userId", &options.userId, "User Id / default is 0");
   optParser.add_long_opt("videoFile", &options.videoFile,
                          "The video file (.ts) or playlist (.m3u8) to be sent - supports URLs");
   optParser.add_long_opt("fps", &options.video.frameRate,
                          "Target frame rate for sending the video stream");
+  optParser.add_long_opt("pacing", &options.video.pacing,
+                         "Frame pacing: fps (fixed --fps ticks) or pts (follow stream timestamps) / default is fps");
   optParser.add_long_opt("bwe", &options.video.showBandwidthEstimation,
                          "show or hide bandwidth estimation info");
+  optParser.add_long_opt("audio", &options.publishAudio,
+                         "Publish the segments' AAC audio, paced with the video by PTS / default is 0");
   optParser.add_long_opt("localIP", &options.localIP,
                          "Local IP");
+  optParser.add_long_opt("multi", &options.multiStream,
+                         "Host many streams in one process, added and removed by stdin commands / default is 0");
+  optParser.add_long_opt("standby", &options.standby,
+                         "Start the service and wait for ASSIGN:<channel>,<uid>,<url> to join and play / default is 0");
+  optParser.add_long_opt("warm", &options.warmVideos,
+                         "Videos to index into the segment store at startup, separated by spaces / default is none");
+  optParser.add_long_opt("stringUid", &options.stringUid,
+                         "Multi-stream and standby modes: join with string user ids / default is 1");
+  optParser.add_long_opt("segmentStoreMb", &options.segmentStoreMb,
+                         "Memory budget in MB for parsed segments kept for reuse / default is 512");
+  optParser.add_long_opt("cacheMb", &options.cacheMb,
+                         "Disk budget in MB for " CACHE_BASE_PATH ", shared by all processes, 0 = unbounded / default is 4096");
+  optParser.add_long_opt("fetchWorkers", &options.fetchWorkers,
+                         "Parallel HLS segment downloads / default is 8");
+  optParser.add_long_opt("preloadWorkers", &options.preloadWorkers,
+                         "Threads preparing switch and warm-up videos, shared by all streams / default is 2");
+  optParser.add_long_opt("lookahead", &options.lookahead,
+                         "Start HLS playlists after segment 0 and keep N segments downloading ahead, 0 waits for all / default is 0");
+  optParser.add_long_opt("live", &options.live,
+                         "Play HLS playlists without #EXT-X-ENDLIST live: refresh them and follow their end / default is 0");
+  optParser.add_long_opt("liveLatencyMs", &options.liveLatencyMs,
+                         "Live mode: how far behind the playlist's end to play, 0 = three target durations / default is 0");
+  optParser.add_long_opt("metadata", &options.video.metadata,
+                         "Per-frame metadata: none, trailer (AgoraWrc trailer) or sei (user data SEI NAL) / default is none");
+  optParser.add_long_opt("metadataPayload", &options.video.metadataPayload,
+                         "Metadata content: timestamp (Unix ms), frame (frame index) or text:<data> / default is timestamp");
+  optParser.add_long_opt("syncEpochMs", &options.syncEpochMs,
+                         "Play in step with other processes given the same Unix time in ms, needs --pacing pts, 0 = off / default is 0");
+  optParser.add_long_opt("switchMode", &options.switchMode,
+                         "Video switch cut: immediate (once preloaded) or gop (at the current GOP's end) / default is immediate");
+  optParser.add_long_opt("intraRefreshMs", &options.intraRefreshMs,
+                         "Answer keyframe requests by skipping ahead to the next IDR, at most once per N ms, 0 ignores them / default is 0");
+  optParser.add_long_opt("lowVideoFile", &options.lowStream.videoFile,
+                         "Simulcast: lower rendition of --videoFile published as the low stream / default is off");
+  optParser.add_long_opt("lowWidth", &options.lowStream.width, "Simulcast low stream width / default is 640");
+  optParser.add_long_opt("lowHeight", &options.lowStream.height, "Simulcast low stream height / default is 360");
+  optParser.add_long_opt("lowBitrate", &options.lowStream.bitrateKbps,
+                         "Simulcast low stream bitrate in kbps / default is 500");
+  optParser.add_long_opt("metricsFd", &options.metricsFd,
+                         "Write a JSON metrics line to this inherited file descriptor periodically / default is off");
+  optParser.add_long_opt("metricsIntervalMs", &options.metricsIntervalMs,
+                         "Interval between metrics lines / default is 1000");
+  optParser.add_long_opt("controlFd", &options.controlFd,
+                         "Inherited socket for length-prefixed JSON commands and replies / default is off");
+  optParser.add_long_opt("prefetchDepth", &options.prefetch.depth,
+                         "Frames parsed ahead of the send thread / default is 16");
+  optParser.add_long_opt("prefetchHighWater", &options.prefetch.highWater,
+                         "Prefetch stops reading at this many queued frames / default is the depth");
+  optParser.add_long_opt("prefetchLowWater", &options.prefetch.lowWater,
+                         "Prefetch resumes reading once the queue drained to this many frames / default is half the high water mark");
 
   if ((argc <= 1) || !optParser.parse_opts(argc, argv)) {
     std::ostringstream strStream;
@@ -924,125 +791,251 @@ int main(int argc, char* argv[]) {
     return -1;
   }
 
-  if (options.channelId.empty()) {
+  if (options.channelId.empty() && !options.multiStream && !options.standby) {
     AG_LOG(ERROR, "Must provide channelId!");
     return -1;
   }
 
-  setLogger(quietLogger);
+  if (options.standby && options.multiStream) {
+    AG_LOG(ERROR, "--standby and --multi can't be combined!");
+    return -1;
+  }
 
-  printf("Starting Agora Streaming with dynamic video switching support\n");
-  printf("Commands: SWITCH_VIDEO:<url> or EXIT\n");
-  printf("Initial video: %s\n", options.videoFile.c_str());
+  if (options.video.frameRate <= 0) {
+    AG_LOG(ERROR, "Invalid fps %d!", options.video.frameRate);
+    return -1;
+  }
 
-  std::signal(SIGQUIT, SignalHandler);
-  std::signal(SIGABRT, SignalHandler);
-  std::signal(SIGINT, SignalHandler);
+  if (options.video.pacing != "fps" && options.video.pacing != "pts") {
+    AG_LOG(ERROR, "Unknown pacing mode %s!", options.video.pacing.c_str());
+    return -1;
+  }
 
-  // Initialize playlist manager
-  PlaylistManager playlistManager;
-  if (!playlistManager.initialize(options.videoFile)) {
-    AG_LOG(ERROR, "Failed to initialize playlist manager for %s", options.videoFile.c_str());
+  if (options.segmentStoreMb < 0) {
+    AG_LOG(ERROR, "Invalid segment store budget %d MB!", options.segmentStoreMb);
     return -1;
   }
+  SegmentStore::instance().setBudget((size_t)options.segmentStoreMb << 20);
+  if (options.cacheMb < 0) {
+    AG_LOG(ERROR, "Invalid cache budget %d MB!", options.cacheMb);
+    return -1;
+  }
+  DiskCache::instance().setBudget((uint64_t)options.cacheMb << 20);
 
-  // Start command processing thread
-  std::thread commandThread(processStdinCommands);
+  if (options.fetchWorkers <= 0) {
+    AG_LOG(ERROR, "Invalid fetch worker count %d!", options.fetchWorkers);
+    return -1;
+  }
+  SegmentFetcher::instance().setWorkerCount(options.fetchWorkers);
+  if (options.preloadWorkers <= 0) {
+    AG_LOG(ERROR, "Invalid preload worker count %d!", options.preloadWorkers);
+    return -1;
+  }
+  PreloadExecutor::instance().setWorkerCount(options.preloadWorkers);
 
-  // Determine if we need string UID support
-  bool useStringUid = false;
-  if (!options.userId.empty() && !isInteger(options.userId)) {
-    useStringUid = true;
+  if (options.lookahead < 0) {
+    AG_LOG(ERROR, "Invalid lookahead %d!", options.lookahead);
+    return -1;
   }
 
-  // Create Agora service
-  auto service = createAndInitAgoraService(false, true, true, useStringUid);
-  if (!service) {
-    AG_LOG(ERROR, "Failed to creating Agora service!");
+  if (options.liveLatencyMs < 0) {
+    AG_LOG(ERROR, "Invalid live latency %d ms!", options.liveLatencyMs);
     return -1;
   }
 
-  // Create Agora connection
-  agora::rtc::RtcConnectionConfiguration ccfg;
-  ccfg.autoSubscribeAudio = false;
-  ccfg.autoSubscribeVideo = false;
-  ccfg.clientRoleType = agora::rtc::CLIENT_ROLE_BROADCASTER;
-  agora::agora_refptr<agora::rtc::IRtcConnection> connection = service->createRtcConnection(ccfg);
-  if (!connection) {
-    AG_LOG(ERROR, "Failed to creating Agora connection!");
+  if (!FrameMetadata().configure(options.video.metadata, options.video.metadataPayload)) {
+    AG_LOG(ERROR, "Unknown metadata %s with payload %s!", options.video.metadata.c_str(),
+           options.video.metadataPayload.c_str());
     return -1;
   }
 
-  if (!options.localIP.empty()) {
-    if (setLocalIP(connection, options.localIP)){
-      AG_LOG(ERROR, "set local IP to %s error!", options.localIP.c_str());
-      return -1;
-    }
+  if (options.syncEpochMs < 0 || (options.syncEpochMs > 0 && options.video.pacing != "pts")) {
+    AG_LOG(ERROR, "--syncEpochMs needs a Unix time in ms and --pacing pts!");
+    return -1;
   }
 
-  // Register connection observer to monitor connection event
-  auto connObserver = std::make_shared<SampleConnectionObserver>();
-  connection->registerObserver(connObserver.get());
+  if (options.switchMode != "immediate" && options.switchMode != "gop") {
+    AG_LOG(ERROR, "Unknown switch mode %s!", options.switchMode.c_str());
+    return -1;
+  }
 
-  // Register network observer to monitor bandwidth estimation result
-  if (options.video.showBandwidthEstimation) {
-    connection->registerNetworkObserver(connObserver.get());
+  if (options.intraRefreshMs < 0) {
+    AG_LOG(ERROR, "Invalid intra refresh interval %d ms!", options.intraRefreshMs);
+    return -1;
   }
 
-  // Create local user observer to monitor intra frame request
-  auto localUserObserver = std::make_shared<SampleLocalUserObserver>(connection->getLocalUser());
+  if (!options.lowStream.videoFile.empty() &&
+      (options.multiStream || options.lowStream.width <= 0 || options.lowStream.height <= 0 ||
+       options.lowStream.bitrateKbps <= 0)) {
+    AG_LOG(ERROR, "Invalid simulcast low stream %dx%d at %d kbps%s!", options.lowStream.width,
+           options.lowStream.height, options.lowStream.bitrateKbps,
+           options.multiStream ? ", not available with --multi" : "");
+    return -1;
+  }
 
-  // Connect to Agora channel (using string UID)
-  const char* userIdForConnect = options.userId.empty() ? "0" : options.userId.c_str();
-  if (connection->connect(options.appId.c_str(), options.channelId.c_str(), userIdForConnect)) {
-    AG_LOG(ERROR, "Failed to connect to Agora channel!");
+  if (options.prefetch.highWater == 0) {
+    options.prefetch.highWater = options.prefetch.depth;
+  }
+  if (options.prefetch.lowWater == 0) {
+    options.prefetch.lowWater = options.prefetch.highWater / 2;
+  }
+  if (options.prefetch.depth <= 0 || options.prefetch.highWater < 0 ||
+      options.prefetch.highWater > options.prefetch.depth || options.prefetch.lowWater < 0 ||
+      options.prefetch.lowWater >= options.prefetch.highWater) {
+    AG_LOG(ERROR, "Invalid prefetch depth %d / high water %d / low water %d!", options.prefetch.depth,
+           options.prefetch.highWater, options.prefetch.lowWater);
     return -1;
   }
 
-  // Create media node factory
-  agora::agora_refptr<agora::rtc::IMediaNodeFactory> factory = service->createMediaNodeFactory();
-  if (!factory) {
-    AG_LOG(ERROR, "Failed to create media node factory!");
+  if (options.metricsFd >= 0) {
+    if (fcntl(options.metricsFd, F_GETFD) < 0 || options.metricsIntervalMs <= 0) {
+      AG_LOG(ERROR, "Invalid metrics fd %d / interval %d ms!", options.metricsFd, options.metricsIntervalMs);
+      return -1;
+    }
+    // a supervisor closing its end must not kill the stream
+    std::signal(SIGPIPE, SIG_IGN);
+    MetricsRegistry::instance().startReporter(options.metricsFd, options.metricsIntervalMs);
+  }
+  if (options.controlFd >= 0) {
+    if (fcntl(options.controlFd, F_GETFD) < 0) {
+      AG_LOG(ERROR, "Invalid control fd %d!", options.controlFd);
+      return -1;
+    }
+    std::signal(SIGPIPE, SIG_IGN);
+    ControlChannel::instance().open(options.controlFd);
   }
 
-  // Create video frame sender
-  agora::agora_refptr<agora::rtc::IVideoEncodedImageSender> videoFrameSender =
-      factory->createVideoEncodedImageSender();
-  if (!videoFrameSender) {
-    AG_LOG(ERROR, "Failed to create video frame sender!");
-    return -1;
+  setLogger(quietLogger);
+
+  std::signal(SIGQUIT, SignalHandler);
+  std::signal(SIGABRT, SignalHandler);
+  std::signal(SIGINT, SignalHandler);
+
+  if (!options.warmVideos.empty()) {
+    warmVideos(options.warmVideos, 0, options.lookahead);
   }
 
-  agora::rtc::SenderOptions option;
-  option.ccMode = agora::rtc::TCcMode::CC_ENABLED;
-  // Create video track
-  agora::agora_refptr<agora::rtc::ILocalVideoTrack> customVideoTrack =
-      service->createCustomVideoTrack(videoFrameSender, option);
-  if (!customVideoTrack) {
-    AG_LOG(ERROR, "Failed to create video track!");
+  if (options.multiStream) {
+    return runMultiStream(options);
+  }
+
+  agora::base::IAgoraService* service = nullptr;
+  agora::agora_refptr<agora::rtc::IMediaNodeFactory> factory;
+  std::thread commandThread;
+  uint64_t assignId = 0;
+  if (options.standby) {
+    printf("Starting Agora Streaming in standby mode\n");
+    printf("Commands: ASSIGN:<channel>,<uid>,<url>[@<ms>], WARM_VIDEO:<url> ... or EXIT\n");
+    if (!startStandby(options, service, factory)) {
+      return -1;
+    }
+    commandThread = startCommandThreads(options);
+    printf("Standing by for an assignment\n");
+    if (!waitForAssignment(options, assignId)) {
+      if (commandThread.joinable()) {
+        commandThread.join();
+      }
+      factory = nullptr;
+      service->release();
+      printf("Shutdown complete\n");
+      return 0;
+    }
+    printf("Assigned channel %s, user %s\n", options.channelId.c_str(), options.userId.c_str());
+  }
+  // A failed setup after the assignment still answers it; the stdin thread can't be joined then
+  auto setupFailed = [&]() {
+    ControlChannel::instance().error(assignId, "stream setup failed");
+    if (commandThread.joinable()) {
+      commandThread.detach();
+    }
     return -1;
+  };
+
+  printf("Starting Agora Streaming with dynamic video switching support\n");
+  printf("Commands: SWITCH_VIDEO:<url>[@<ms>] [<low rendition url>], SEEK:<ms> or EXIT\n");
+  printf("Initial video: %s\n", options.videoFile.c_str());
+
+  StreamSession session;
+  session.streamId = options.channelId;
+  session.channelId = options.channelId;
+  session.userId = options.userId;
+  session.token = options.appId;
+  session.videoFile = options.videoFile;
+
+  session.metrics = MetricsRegistry::instance().addStream(session.streamId);
+
+  // Initialize playlist manager
+  session.playlistManager = std::make_shared<PlaylistManager>(options.lookahead);
+  session.playlistManager->setLive(options.live, options.liveLatencyMs);
+  session.playlistManager->setSyncEpoch(options.syncEpochMs);
+  if (!options.lowStream.videoFile.empty()) {
+    session.lowPlaylistManager = std::make_shared<PlaylistManager>(options.lookahead);
+    session.lowPlaylistManager->setLive(options.live, options.liveLatencyMs);
+    session.lowPlaylistManager->setSyncEpoch(options.syncEpochMs);
+    printf("Simulcast low stream: %s\n", options.lowStream.videoFile.c_str());
   }
+  // Load the media while the service comes up and joins the channel, instead of before
+  std::future<bool> media = std::async(std::launch::async, loadStreamMedia, std::cref(options), std::ref(session));
 
-  // Publish video track
-  connection->getLocalUser()->publishVideo(customVideoTrack);
+  // A standby process made its service before the assignment
+  if (!service) {
+    // Determine if we need string UID support
+    bool useStringUid = false;
+    if (!options.userId.empty() && !isInteger(options.userId)) {
+      useStringUid = true;
+    }
+
+    // Create Agora service
+    service = createAndInitAgoraService(false, true, true, useStringUid);
+    if (!service) {
+      AG_LOG(ERROR, "Failed to creating Agora service!");
+      return -1;
+    }
+
+    // Create media node factory
+    factory = service->createMediaNodeFactory();
+    if (!factory) {
+      AG_LOG(ERROR, "Failed to create media node factory!");
+      return -1;
+    }
+    session.metrics->startup.mark(session.metrics->startup.serviceUs);
+  }
 
-  // Wait until connected before sending media stream
-  connObserver->waitUntilConnected(DEFAULT_CONNECT_TIMEOUT_MS);
+  if (!openStreamSession(service, factory, options, session, commandQueue)) {
+    return setupFailed();
+  }
+  if (!media.get()) {
+    return setupFailed();
+  }
+
+  // Start command processing thread, commands sent meanwhile wait in stdin and the control fd
+  if (!commandThread.joinable() && !options.standby) {
+    commandThread = startCommandThreads(options);
+  }
+
+  // Wait until connected before sending media stream, at once if loading the media took longer
+  session.connObserver->waitUntilConnected(DEFAULT_CONNECT_TIMEOUT_MS);
 
   if (!options.localIP.empty()) {
     std::string ip;
-    getLocalIP(connection, ip);
+    getLocalIP(session.connection, ip);
     AG_LOG(INFO, "Local IP:%s", ip.c_str());
   }
 
   // Start sending video data
   AG_LOG(INFO, "Start sending video data from %s...", options.videoFile.c_str());
-  printf("Process ready for commands. Current video: %s\n", playlistManager.getCurrentVideoFile().c_str());
-  
-  std::thread sendVideoThread(SampleSendVideoH264Task, options, videoFrameSender, std::ref(playlistManager));
+  printf("Process ready for commands. Current video: %s\n", session.playlistManager->getCurrentVideoFile().c_str());
+  const StartupMetrics& startup = session.metrics->startup;
+  ControlChannel::instance().reply(assignId, "done",
+      ",\"media_ms\":" + jsonMs(startup.start, startup.start + std::chrono::microseconds(startup.mediaUs)) +
+      ",\"connect_ms\":" + jsonMs(startup.start, startup.start + std::chrono::microseconds(startup.connectUs)));
+
+  session.sendThread = std::thread(SampleSendVideoH264Task, options, session.videoFrameSender,
+                                   session.audioFrameSender, session.playlistManager, session.lowPlaylistManager, session.renditions,
+                                   session.metrics, std::ref(commandQueue), std::cref(exitFlag));
 
   // Wait for threads to complete
-  sendVideoThread.join();
+  session.sendThread.join();
   
   // Signal command thread to exit and wait
   exitFlag = true;
@@ -1050,29 +1043,10 @@ int main(int argc, char* argv[]) {
     commandThread.join();
   }
 
-  // Unpublish video track
-  connection->getLocalUser()->unpublishVideo(customVideoTrack);
-
-  // Unregister connection observer
-  connection->unregisterObserver(connObserver.get());
-
-  // Unregister network observer
-  connection->unregisterNetworkObserver(connObserver.get());
-
-  // Disconnect from Agora channel
-  if (connection->disconnect()) {
-    AG_LOG(ERROR, "Failed to disconnect from Agora channel!");
+  if (!closeStreamSession(session)) {
     return -1;
   }
-  AG_LOG(INFO, "Disconnected from Agora channel successfully");
-
-  // Destroy Agora connection and related resources
-  connObserver.reset();
-  localUserObserver.reset();
-  videoFrameSender = nullptr;
-  customVideoTrack = nullptr;
   factory = nullptr;
-  connection = nullptr;
 
   // Destroy Agora Service
   service->release();
@@ -1080,4 +1054,4 @@ int main(int argc, char* argv[]) {
 
   printf("Shutdown complete\n");
   return 0;
-}
\ No newline at end of file
+}
@@ -7,6 +7,7 @@
 #include <unistd.h>
 
 #include "common/log.h"
+#include "helper_nal_scanner.h"
 
 void print_frame(uint8_t *buffer, int size)
 {
@@ -32,49 +33,27 @@ void print_frame(uint8_t *buffer, int size)
 // different API
 int find_nal_unit(uint8_t *buf, int size, uint8_t &nal_type, int &nal_start, int &nal_end)
 {
-	if (size < 4) {
-		return 0;
-	}
-	int i = 0;
-	// find start
 	nal_start = 0;
 	nal_end = 0;
-
-	while (buf[i] != 0 || buf[i + 1] != 0 ||
-		   !(buf[i + 2] == 1 || (buf[i + 2] == 0 && buf[i + 3] == 1))) {
-		i++;
-		if (size < i + 4) {
-			return 0;
-		} // did not find nal start
+	if (size < 4) {
+		return 0;
 	}
 
-	nal_start = i;
-
-	if (buf[i + 2] == 1) {
-		nal_type = buf[i + 3] & 0x1f;
-		i += 4;
-	} else if (size > i + 4) {
-		nal_type = buf[i + 4] & 0x1f;
-		i += 5;
-	} else {
+	// find start, on the leading zero of a 4-byte start code
+	size_t i = findStartCode(buf, size, 0);
+	if (i + 3 >= (size_t)size) {
 		return 0;
-	}
+	} // did not find nal start
+	nal_start = (i > 0 && buf[i - 1] == 0) ? i - 1 : i;
+	nal_type = nalType(NAL_CODEC_H264, buf[i + 3]);
 
-	if (size < i + 4) {
+	// find end
+	size_t next = findStartCode(buf, size, i + 4);
+	if (next == (size_t)size) {
 		nal_end = size - 1;
 		return -1;
-	}
-
-	while (buf[i] != 0 || buf[i + 1] != 0 ||
-		   !(buf[i + 2] == 1 || (buf[i + 2] == 0 && buf[i + 3] == 1))) {
-		i++;
-		if (size < i + 4) {
-			nal_end = size - 1;
-			return -1;
-		} // did not find nal end, stream ended first
-	}
-
-	nal_end = i - 1;
+	} // did not find nal end, stream ended first
+	nal_end = ((next > i + 4 && buf[next - 1] == 0) ? next - 1 : next) - 1;
 	return (nal_end - nal_start);
 }
 
@@ -0,0 +1,555 @@
+#include "helper_mp4_parser.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common/log.h"
+
+static const int kAdtsSampleRates[16] = {96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050,
+                                         16000, 12000, 11025, 8000,  7350,  0,     0,     0};
+
+static inline uint16_t be16(const uint8_t* p) { return (uint16_t)(p[0] << 8 | p[1]); }
+static inline uint32_t be32(const uint8_t* p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+static inline uint64_t be64(const uint8_t* p) { return (uint64_t)be32(p) << 32 | be32(p + 4); }
+
+static constexpr uint32_t fourcc(const char s[5]) {
+  return (uint32_t)s[0] << 24 | (uint32_t)s[1] << 16 | (uint32_t)s[2] << 8 | (uint32_t)s[3];
+}
+
+// Calls fn(type, payload, payloadSize, boxOffset) for each box in [data, data + size); a box
+// running past the end is cut short, as in a file still being written
+template <typename Fn>
+static void forEachBox(const uint8_t* data, size_t size, Fn fn) {
+  size_t o = 0;
+  while (o + 8 <= size) {
+    uint64_t boxSize = be32(data + o);
+    uint32_t type = be32(data + o + 4);
+    size_t header = 8;
+    if (boxSize == 1) {
+      if (o + 16 > size) return;
+      boxSize = be64(data + o + 8);
+      header = 16;
+    } else if (boxSize == 0) {
+      boxSize = size - o; // to the end
+    }
+    if (boxSize < header) return;
+    size_t payload = (size_t)std::min<uint64_t>(boxSize, size - o) - header;
+    fn(type, data + o + header, payload, o);
+    o += (size_t)std::min<uint64_t>(boxSize, size - o);
+  }
+}
+
+// The payload of the first `type` child box, false when there is none
+static bool findBox(const uint8_t* data, size_t size, uint32_t type, const uint8_t*& box, size_t& boxSize) {
+  bool found = false;
+  forEachBox(data, size, [&](uint32_t t, const uint8_t* payload, size_t payloadSize, size_t) {
+    if (!found && t == type) {
+      box = payload;
+      boxSize = payloadSize;
+      found = true;
+    }
+  });
+  return found;
+}
+
+// Length of an MPEG-4 descriptor (esds), up to four 7-bit groups
+static size_t descriptorLength(const uint8_t*& p, const uint8_t* end) {
+  size_t len = 0;
+  for (int i = 0; i < 4 && p < end; ++i) {
+    uint8_t b = *p++;
+    len = len << 7 | (b & 0x7F);
+    if (!(b & 0x80)) break;
+  }
+  return len;
+}
+
+HelperMp4FileParser::HelperMp4FileParser(const char* filepath) : file_path_(filepath) {}
+
+HelperMp4FileParser::~HelperMp4FileParser() {
+  if (data_) munmap(data_, size_);
+  if (fd_ >= 0) close(fd_);
+}
+
+bool HelperMp4FileParser::isMp4Path(const std::string& path) {
+  size_t dot = path.find_last_of('.');
+  if (dot == std::string::npos || path.find('/', dot) != std::string::npos) return false;
+  std::string ext = path.substr(dot + 1);
+  return ext == "mp4" || ext == "m4v" || ext == "m4s" || ext == "mov";
+}
+
+bool HelperMp4FileParser::initialize() {
+  struct stat st;
+  fd_ = open(file_path_.c_str(), O_RDONLY);
+  if (fd_ < 0 || fstat(fd_, &st) != 0) {
+    AG_LOG(ERROR, "Failed to open %s", file_path_.c_str());
+    return false;
+  }
+
+  size_ = st.st_size;
+  // Samples are read in decode order, interleaved with the others: fault the file in at once
+  data_ = static_cast<uint8_t*>(mmap(nullptr, size_, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd_, 0));
+  if (data_ == MAP_FAILED) {
+    data_ = nullptr;
+    AG_LOG(ERROR, "mmap() failed on %s", file_path_.c_str());
+    return false;
+  }
+
+  bool haveMoov = false;
+  forEachBox(data_, size_, [&](uint32_t type, const uint8_t* payload, size_t payloadSize, size_t offset) {
+    if (type == fourcc("moov")) {
+      parseMoov(payload, payloadSize);
+      haveMoov = true;
+    } else if (type == fourcc("moof") && haveMoov) {
+      parseMoof(payload, payloadSize, offset);
+    }
+  });
+  if (!haveMoov) {
+    AG_LOG(ERROR, "No moov box in %s", file_path_.c_str());
+    return false;
+  }
+  dropTruncatedSamples(video_);
+  dropTruncatedSamples(audio_);
+  if (!hasVideo() || video_.samples.empty()) {
+    AG_LOG(ERROR, "No H.264 / H.265 samples in %s", file_path_.c_str());
+    return false;
+  }
+  return true;
+}
+
+void HelperMp4FileParser::parseMoov(const uint8_t* data, size_t size) {
+  forEachBox(data, size, [&](uint32_t type, const uint8_t* payload, size_t payloadSize, size_t) {
+    if (type == fourcc("trak")) {
+      parseTrak(payload, payloadSize);
+    }
+  });
+
+  // Fragment defaults, once the tracks they name are known
+  const uint8_t* mvex;
+  size_t mvexSize;
+  if (!findBox(data, size, fourcc("mvex"), mvex, mvexSize)) return;
+  forEachBox(mvex, mvexSize, [&](uint32_t type, const uint8_t* p, size_t n, size_t) {
+    if (type != fourcc("trex") || n < 24) return;
+    if (Mp4Track* track = trackById(be32(p + 4))) {
+      track->defaultDuration = be32(p + 12);
+      track->defaultSize = be32(p + 16);
+      track->defaultFlags = be32(p + 20);
+    }
+  });
+}
+
+void HelperMp4FileParser::parseTrak(const uint8_t* data, size_t size) {
+  const uint8_t *tkhd, *mdia, *mdhd, *hdlr, *minf, *stbl, *stsd;
+  size_t tkhdSize, mdiaSize, mdhdSize, hdlrSize, minfSize, stblSize, stsdSize;
+  if (!findBox(data, size, fourcc("tkhd"), tkhd, tkhdSize) ||
+      !findBox(data, size, fourcc("mdia"), mdia, mdiaSize) ||
+      !findBox(mdia, mdiaSize, fourcc("mdhd"), mdhd, mdhdSize) ||
+      !findBox(mdia, mdiaSize, fourcc("hdlr"), hdlr, hdlrSize) ||
+      !findBox(mdia, mdiaSize, fourcc("minf"), minf, minfSize) ||
+      !findBox(minf, minfSize, fourcc("stbl"), stbl, stblSize) ||
+      !findBox(stbl, stblSize, fourcc("stsd"), stsd, stsdSize) || hdlrSize < 12) {
+    return;
+  }
+  bool video = be32(hdlr + 8) == fourcc("vide");
+  if ((video && hasVideo()) || (!video && (be32(hdlr + 8) != fourcc("soun") || hasAudio()))) {
+    return; // only the first track of each kind plays
+  }
+
+  Mp4VideoTrack videoTrack;
+  Mp4AudioTrack audioTrack;
+  Mp4Track& track = video ? static_cast<Mp4Track&>(videoTrack) : audioTrack;
+  bool v1 = tkhdSize > 0 && tkhd[0] == 1;
+  bool mdhdV1 = mdhdSize > 0 && mdhd[0] == 1;
+  if (tkhdSize < (v1 ? 24u : 16u) || mdhdSize < (mdhdV1 ? 24u : 16u)) return;
+  track.id = be32(tkhd + (v1 ? 20 : 12));
+  track.timescale = be32(mdhd + (mdhdV1 ? 20 : 12));
+  if (track.timescale == 0) return;
+
+  // The first edit that isn't an empty one says where presentation starts
+  const uint8_t *edts, *elst;
+  size_t edtsSize, elstSize;
+  if (findBox(data, size, fourcc("edts"), edts, edtsSize) && findBox(edts, edtsSize, fourcc("elst"), elst, elstSize) &&
+      elstSize >= 8) {
+    bool e1 = elst[0] == 1;
+    size_t entry = e1 ? 20 : 12;
+    uint32_t count = be32(elst + 4);
+    for (uint32_t i = 0; i < count && 8 + (i + 1) * entry <= elstSize; ++i) {
+      const uint8_t* e = elst + 8 + i * entry;
+      int64_t mediaTime = e1 ? (int64_t)be64(e + 8) : (int32_t)be32(e + 4);
+      if (mediaTime >= 0) {
+        track.mediaStart = mediaTime;
+        break;
+      }
+    }
+  }
+
+  bool supported = video ? parseVideoEntry(stsd, stsdSize, videoTrack) : parseAudioEntry(stsd, stsdSize, audioTrack);
+  if (!supported || !parseStbl(stbl, stblSize, track)) {
+    return;
+  }
+  if (video) {
+    video_ = std::move(videoTrack);
+  } else {
+    audio_ = std::move(audioTrack);
+  }
+}
+
+bool HelperMp4FileParser::parseVideoEntry(const uint8_t* stsd, size_t size, Mp4VideoTrack& track) {
+  if (size < 8 + 8) return false;
+  const uint8_t* entry = stsd + 8; // version / flags, entry count
+  size_t entrySize = be32(entry);
+  uint32_t type = be32(entry + 4);
+  if (entrySize < 8 + 78 || entrySize > size - 8) return false;
+  bool h264 = type == fourcc("avc1") || type == fourcc("avc3");
+  bool h265 = type == fourcc("hvc1") || type == fourcc("hev1");
+  if (!h264 && !h265) {
+    AG_LOG(ERROR, "Unsupported video sample entry %.4s in %s", reinterpret_cast<const char*>(entry + 4),
+           file_path_.c_str());
+    return false;
+  }
+  track.codec = h264 ? NAL_CODEC_H264 : NAL_CODEC_H265;
+
+  // Visual sample entry fields, then its boxes
+  const uint8_t* config;
+  size_t configSize;
+  if (!findBox(entry + 8 + 78, entrySize - 8 - 78, fourcc(h264 ? "avcC" : "hvcC"), config, configSize)) {
+    return false;
+  }
+  static const uint8_t startCode[4] = {0, 0, 0, 1};
+  auto addParamSet = [&](const uint8_t*& p, const uint8_t* end) {
+    if (p + 2 > end || p + 2 + be16(p) > end) return false;
+    track.paramSets.insert(track.paramSets.end(), startCode, startCode + 4);
+    track.paramSets.insert(track.paramSets.end(), p + 2, p + 2 + be16(p));
+    p += 2 + be16(p);
+    return true;
+  };
+  const uint8_t* end = config + configSize;
+  if (h264) {
+    if (configSize < 7) return false;
+    track.nalLengthSize = (config[4] & 0x03) + 1;
+    const uint8_t* p = config + 6;
+    for (int n = config[5] & 0x1F; n > 0; --n) {
+      if (!addParamSet(p, end)) return false;
+    }
+    if (p >= end) return false;
+    for (int n = *p++; n > 0; --n) {
+      if (!addParamSet(p, end)) return false;
+    }
+  } else {
+    if (configSize < 23) return false;
+    track.nalLengthSize = (config[21] & 0x03) + 1;
+    const uint8_t* p = config + 23;
+    for (int arrays = config[22]; arrays > 0; --arrays) {
+      if (p + 3 > end) return false;
+      uint8_t type = p[0] & 0x3F;
+      int count = be16(p + 1);
+      p += 3;
+      for (; count > 0; --count) {
+        if (type >= 32 && type <= 34) {
+          if (!addParamSet(p, end)) return false;
+        } else if (p + 2 > end || p + 2 + be16(p) > end) {
+          return false;
+        } else {
+          p += 2 + be16(p); // SEI
+        }
+      }
+    }
+  }
+  return true;
+}
+
+bool HelperMp4FileParser::parseAudioEntry(const uint8_t* stsd, size_t size, Mp4AudioTrack& track) {
+  if (size < 8 + 8) return false;
+  const uint8_t* entry = stsd + 8;
+  size_t entrySize = be32(entry);
+  if (be32(entry + 4) != fourcc("mp4a") || entrySize < 8 + 28 || entrySize > size - 8) return false;
+
+  // QuickTime sound description versions 1 and 2 add fields before the boxes
+  int version = be16(entry + 8 + 8);
+  size_t fields = 28 + (version == 1 ? 16 : version == 2 ? 36 : 0);
+  const uint8_t* esds;
+  size_t esdsSize;
+  if (entrySize < 8 + fields || !findBox(entry + 8 + fields, entrySize - 8 - fields, fourcc("esds"), esds, esdsSize) ||
+      esdsSize < 4) {
+    return false;
+  }
+
+  // ES_Descriptor > DecoderConfigDescriptor > DecoderSpecificInfo (AudioSpecificConfig)
+  const uint8_t* p = esds + 4;
+  const uint8_t* end = esds + esdsSize;
+  if (p >= end || *p++ != 0x03) return false;
+  descriptorLength(p, end);
+  if (p + 3 > end) return false;
+  uint8_t esFlags = p[2];
+  p += 3;
+  if (esFlags & 0x80) p += 2;                     // dependsOn_ES_ID
+  if (esFlags & 0x40) p += p < end ? 1 + *p : 0; // URL
+  if (esFlags & 0x20) p += 2;                     // OCR_ES_Id
+  if (p >= end || *p++ != 0x04) return false;
+  descriptorLength(p, end);
+  if (p + 13 > end || p[0] != 0x40) return false; // objectTypeIndication: MPEG-4 audio
+  p += 13;
+  if (p >= end || *p++ != 0x05) return false;
+  size_t ascLength = descriptorLength(p, end);
+  if (ascLength < 2 || p + 2 > end) return false;
+
+  track.objectType = p[0] >> 3;
+  track.sampleRateIndex = (p[0] & 0x07) << 1 | p[1] >> 7;
+  track.channels = (p[1] >> 3) & 0x0F;
+  track.sampleRateHz = kAdtsSampleRates[track.sampleRateIndex];
+  if (track.objectType < 1 || track.objectType > 4 || !track.sampleRateHz) {
+    AG_LOG(ERROR, "Unsupported AAC configuration (object type %d) in %s, audio skipped", track.objectType,
+           file_path_.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool HelperMp4FileParser::parseStbl(const uint8_t* data, size_t size, Mp4Track& track) {
+  const uint8_t *stts, *stsc, *stsz = nullptr, *stco = nullptr, *ctts = nullptr, *stss = nullptr;
+  size_t sttsSize, stscSize, stszSize = 0, stcoSize = 0, cttsSize = 0, stssSize = 0;
+  bool compactSizes = false, largeOffsets = false;
+  if (!findBox(data, size, fourcc("stts"), stts, sttsSize) || !findBox(data, size, fourcc("stsc"), stsc, stscSize)) {
+    return false;
+  }
+  if (!findBox(data, size, fourcc("stsz"), stsz, stszSize)) {
+    compactSizes = findBox(data, size, fourcc("stz2"), stsz, stszSize);
+  }
+  if (!findBox(data, size, fourcc("stco"), stco, stcoSize)) {
+    largeOffsets = findBox(data, size, fourcc("co64"), stco, stcoSize);
+  }
+  findBox(data, size, fourcc("ctts"), ctts, cttsSize);
+  bool allSync = !findBox(data, size, fourcc("stss"), stss, stssSize);
+  if (!stsz || !stco || sttsSize < 8 || stscSize < 8 || stszSize < 12 || stcoSize < 8) {
+    return false;
+  }
+
+  uint32_t chunks = be32(stco + 4);
+  if (8 + (uint64_t)chunks * (largeOffsets ? 8 : 4) > stcoSize) return false;
+  uint32_t runs = std::min<uint32_t>(be32(stsc + 4), (stscSize - 8) / 12);
+
+  // Sizes. count comes from the file: no more samples than the chunks hold, or than fit in it
+  uint32_t count = be32(stsz + 8);
+  uint64_t held = 0;
+  for (uint32_t r = 0; r < runs; ++r) {
+    uint32_t firstChunk = be32(stsc + 8 + r * 12);
+    uint32_t lastChunk = std::min(r + 1 < runs ? be32(stsc + 8 + (r + 1) * 12) - 1 : chunks, chunks);
+    if (firstChunk >= 1 && firstChunk <= lastChunk) {
+      held += (uint64_t)(lastChunk - firstChunk + 1) * be32(stsc + 12 + r * 12);
+    }
+  }
+  count = std::min<uint64_t>(count, held);
+  uint32_t fixedSize = compactSizes ? 0 : be32(stsz + 4);
+  int fieldBits = compactSizes ? stsz[7] : 32;
+  if (fixedSize == 0 && (fieldBits != 4 && fieldBits != 8 && fieldBits != 16 && fieldBits != 32)) return false;
+  if (fixedSize == 0 && 12 + ((uint64_t)count * fieldBits + 7) / 8 > stszSize) return false;
+  if (fixedSize != 0) count = std::min<uint64_t>(count, size_ / fixedSize);
+  track.samples.resize(count);
+  for (uint32_t i = 0; i < count; ++i) {
+    uint32_t sampleSize = fixedSize;
+    if (!fixedSize) {
+      const uint8_t* f = stsz + 12;
+      switch (fieldBits) {
+        case 4: sampleSize = (i & 1) ? f[i / 2] & 0x0F : f[i / 2] >> 4; break;
+        case 8: sampleSize = f[i]; break;
+        case 16: sampleSize = be16(f + 2 * i); break;
+        default: sampleSize = be32(f + 4 * i); break;
+      }
+    }
+    track.samples[i] = Mp4Sample{0, sampleSize, 0, 0, allSync};
+  }
+
+  // Decode times, composition offsets
+  int64_t dts = 0;
+  size_t s = 0;
+  for (uint32_t e = 0, entries = be32(stts + 4); e < entries && 8 + (e + 1) * 8 <= sttsSize; ++e) {
+    uint32_t run = be32(stts + 8 + e * 8);
+    uint32_t delta = be32(stts + 12 + e * 8);
+    for (; run > 0 && s < count; --run, ++s) {
+      track.samples[s].dts = track.samples[s].pts = dts;
+      dts += delta;
+    }
+  }
+  track.nextDts = dts;
+  s = 0;
+  for (uint32_t e = 0, entries = cttsSize >= 8 ? be32(ctts + 4) : 0; e < entries && 8 + (e + 1) * 8 <= cttsSize; ++e) {
+    uint32_t run = be32(ctts + 8 + e * 8);
+    int32_t offset = (int32_t)be32(ctts + 12 + e * 8); // signed in version 1, small in practice in 0
+    for (; run > 0 && s < count; --run, ++s) {
+      track.samples[s].pts = track.samples[s].dts + offset;
+    }
+  }
+  for (uint32_t e = 0, entries = stssSize >= 8 ? be32(stss + 4) : 0; e < entries && 8 + (e + 1) * 4 <= stssSize; ++e) {
+    uint32_t number = be32(stss + 8 + e * 4); // 1-based
+    if (number >= 1 && number <= count) track.samples[number - 1].isSync = true;
+  }
+
+  // Chunk offsets: each stsc run gives its chunks a sample count, the samples follow one another
+  s = 0;
+  for (uint32_t r = 0; r < runs && s < count; ++r) {
+    uint32_t firstChunk = be32(stsc + 8 + r * 12);
+    uint32_t perChunk = be32(stsc + 12 + r * 12);
+    uint32_t lastChunk = r + 1 < runs ? be32(stsc + 8 + (r + 1) * 12) - 1 : chunks;
+    for (uint32_t c = firstChunk; c >= 1 && c <= lastChunk && c <= chunks && s < count; ++c) {
+      uint64_t offset = largeOffsets ? be64(stco + 8 + (c - 1) * 8) : be32(stco + 8 + (c - 1) * 4);
+      for (uint32_t k = 0; k < perChunk && s < count; ++k, ++s) {
+        track.samples[s].offset = offset;
+        offset += track.samples[s].size;
+      }
+    }
+  }
+  track.samples.resize(s); // samples no chunk holds
+  return true;
+}
+
+Mp4Track* HelperMp4FileParser::trackById(uint32_t id) {
+  if (hasVideo() && video_.id == id) return &video_;
+  if (hasAudio() && audio_.id == id) return &audio_;
+  return nullptr;
+}
+
+void HelperMp4FileParser::parseMoof(const uint8_t* data, size_t size, uint64_t moofOffset) {
+  uint64_t dataEnd = moofOffset; // where the previous traf's data ended
+  forEachBox(data, size, [&](uint32_t type, const uint8_t* payload, size_t payloadSize, size_t) {
+    if (type == fourcc("traf")) {
+      parseTraf(payload, payloadSize, moofOffset, dataEnd);
+    }
+  });
+}
+
+void HelperMp4FileParser::parseTraf(const uint8_t* data, size_t size, uint64_t moofOffset, uint64_t& dataEnd) {
+  const uint8_t* tfhd;
+  size_t tfhdSize;
+  if (!findBox(data, size, fourcc("tfhd"), tfhd, tfhdSize) || tfhdSize < 8) return;
+  Mp4Track* track = trackById(be32(tfhd + 4));
+  if (!track) return;
+
+  // Track fragment header: optional fields in flag order
+  uint32_t flags = be32(tfhd) & 0xFFFFFF;
+  const uint8_t* p = tfhd + 8;
+  const uint8_t* end = tfhd + tfhdSize;
+  uint64_t base = (flags & 0x020000) ? moofOffset : dataEnd; // default-base-is-moof
+  uint32_t duration = track->defaultDuration, sampleSize = track->defaultSize, sampleFlags = track->defaultFlags;
+  if ((flags & 0x01) && p + 8 <= end) { base = be64(p); p += 8; }
+  if ((flags & 0x02) && p + 4 <= end) p += 4; // sample description index
+  if ((flags & 0x08) && p + 4 <= end) { duration = be32(p); p += 4; }
+  if ((flags & 0x10) && p + 4 <= end) { sampleSize = be32(p); p += 4; }
+  if ((flags & 0x20) && p + 4 <= end) { sampleFlags = be32(p); p += 4; }
+
+  const uint8_t* tfdt;
+  size_t tfdtSize;
+  if (findBox(data, size, fourcc("tfdt"), tfdt, tfdtSize) && tfdtSize >= 8) {
+    track->nextDts = tfdt[0] == 1 && tfdtSize >= 12 ? (int64_t)be64(tfdt + 4) : be32(tfdt + 4);
+  }
+
+  forEachBox(data, size, [&](uint32_t type, const uint8_t* trun, size_t trunSize, size_t) {
+    if (type != fourcc("trun") || trunSize < 8) return;
+    uint32_t runFlags = be32(trun) & 0xFFFFFF;
+    bool signedOffsets = trun[0] == 1;
+    uint32_t count = be32(trun + 4);
+    const uint8_t* q = trun + 8;
+    const uint8_t* qEnd = trun + trunSize;
+    uint64_t offset = base;
+    if (runFlags & 0x01) {
+      if (q + 4 > qEnd) return;
+      offset = base + (int32_t)be32(q); // relative: may point before the moof a muxer wrote last
+      q += 4;
+    }
+    uint32_t firstFlags = sampleFlags;
+    bool haveFirstFlags = false;
+    if (runFlags & 0x04) {
+      if (q + 4 > qEnd) return;
+      firstFlags = be32(q);
+      haveFirstFlags = true;
+      q += 4;
+    }
+    size_t fieldBytes = 4 * (!!(runFlags & 0x100) + !!(runFlags & 0x200) + !!(runFlags & 0x400) + !!(runFlags & 0x800));
+    for (uint32_t i = 0; i < count && q + fieldBytes <= qEnd; ++i) {
+      uint32_t d = duration, n = sampleSize, f = (i == 0 && haveFirstFlags) ? firstFlags : sampleFlags;
+      int64_t cto = 0;
+      if (runFlags & 0x100) { d = be32(q); q += 4; }
+      if (runFlags & 0x200) { n = be32(q); q += 4; }
+      if (runFlags & 0x400) { f = be32(q); q += 4; }
+      if (runFlags & 0x800) { cto = signedOffsets ? (int32_t)be32(q) : (int64_t)be32(q); q += 4; }
+      // sample_is_non_sync_sample; audio samples are all sync
+      bool sync = track == &audio_ || !(f & 0x10000);
+      track->samples.push_back(Mp4Sample{offset, n, track->nextDts, track->nextDts + cto, sync});
+      track->nextDts += d;
+      offset += n;
+    }
+    dataEnd = offset;
+    base = offset; // a following trun without data_offset continues here
+  });
+}
+
+// A file cut short (a download in progress, a crash while recording) keeps what it holds
+void HelperMp4FileParser::dropTruncatedSamples(Mp4Track& track) {
+  size_t kept = 0;
+  while (kept < track.samples.size() && track.samples[kept].offset + track.samples[kept].size <= size_ &&
+         track.samples[kept].size > 0) {
+    ++kept;
+  }
+  if (kept < track.samples.size()) {
+    AG_LOG(WARNING, "%zu of %zu samples of track %u lie outside %s, dropped", track.samples.size() - kept,
+           track.samples.size(), track.id, file_path_.c_str());
+    track.samples.resize(kept);
+  }
+}
+
+bool HelperMp4FileParser::appendAnnexB(const Mp4Sample& sample, std::vector<uint8_t>& out) const {
+  const uint8_t* p = data_ + sample.offset;
+  const uint8_t* end = p + sample.size;
+  const int lengthSize = video_.nalLengthSize;
+
+  // Walk the length prefixes once to check them and see which NAL types are in-band
+  unsigned flags = 0;
+  size_t annexBSize = 0;
+  for (const uint8_t* q = p; q < end;) {
+    if (q + lengthSize > end) return false;
+    size_t len = 0;
+    for (int i = 0; i < lengthSize; ++i) len = len << 8 | q[i];
+    q += lengthSize;
+    if (len == 0 || len > (size_t)(end - q)) return false;
+    flags |= nalTypeFlags(video_.codec, nalType(video_.codec, q[0]));
+    annexBSize += 4 + len;
+    q += len;
+  }
+
+  bool addParamSets = sample.isSync && !(flags & NAL_FLAG_SPS);
+  out.reserve(out.size() + annexBSize + (addParamSets ? video_.paramSets.size() : 0));
+  if (addParamSets) {
+    out.insert(out.end(), video_.paramSets.begin(), video_.paramSets.end());
+  }
+  static const uint8_t startCode[4] = {0, 0, 0, 1};
+  for (const uint8_t* q = p; q < end;) {
+    size_t len = 0;
+    for (int i = 0; i < lengthSize; ++i) len = len << 8 | q[i];
+    q += lengthSize;
+    out.insert(out.end(), startCode, startCode + 4);
+    out.insert(out.end(), q, q + len);
+    q += len;
+  }
+  return true;
+}
+
+bool HelperMp4FileParser::appendAdts(const Mp4Sample& sample, std::vector<uint8_t>& out) const {
+  size_t frameLen = 7 + sample.size;
+  if (frameLen > 0x1FFF) return false; // 13-bit frame length
+  int profile = audio_.objectType - 1;
+  uint8_t header[7] = {
+      0xFF, 0xF1, // MPEG-4, no CRC
+      (uint8_t)(profile << 6 | audio_.sampleRateIndex << 2 | (audio_.channels >> 2 & 0x01)),
+      (uint8_t)((audio_.channels & 0x03) << 6 | frameLen >> 11),
+      (uint8_t)(frameLen >> 3),
+      (uint8_t)((frameLen & 0x07) << 5 | 0x1F), // buffer fullness 0x7FF: variable rate
+      0xFC,                                      // one raw data block
+  };
+  out.insert(out.end(), header, header + 7);
+  out.insert(out.end(), data_ + sample.offset, data_ + sample.offset + sample.size);
+  return true;
+}
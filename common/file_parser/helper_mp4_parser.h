@@ -0,0 +1,95 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "helper_nal_scanner.h"
+
+// MP4 demuxer: indexes the first H.264 / H.265 track and the first AAC track of a progressive
+// file (moov sample tables) or a fragmented one (moov followed by moof / mdat pairs). The file
+// is mmap'd and samples stay offsets into it; appendAnnexB() and appendAdts() turn one into
+// what a TS segment would have carried.
+
+struct Mp4Sample {
+  uint64_t offset; // into the file
+  uint32_t size;
+  int64_t dts;     // track timescale
+  int64_t pts;
+  bool isSync;
+};
+
+struct Mp4Track {
+  uint32_t id = 0;
+  uint32_t timescale = 0;
+  int64_t mediaStart = 0; // where the edit list starts presenting, subtracted from every timestamp
+  std::vector<Mp4Sample> samples;
+  // Fragmented files: trex defaults and where the next fragment's decode times continue
+  uint32_t defaultDuration = 0;
+  uint32_t defaultSize = 0;
+  uint32_t defaultFlags = 0;
+  int64_t nextDts = 0;
+
+  // A timestamp in 90 kHz units, 0 at the edit list's start
+  int64_t to90kHz(int64_t t) const {
+    t -= mediaStart;
+    return t / timescale * 90000 + t % timescale * 90000 / timescale;
+  }
+};
+
+struct Mp4VideoTrack : Mp4Track {
+  NalCodec codec = NAL_CODEC_H264;
+  int nalLengthSize = 4;
+  std::vector<uint8_t> paramSets; // (VPS,) SPS and PPS of the sample entry, with start codes
+};
+
+struct Mp4AudioTrack : Mp4Track {
+  int objectType = 0;      // AAC audio object type, 1..4 fit an ADTS header
+  int sampleRateIndex = 0;
+  int sampleRateHz = 0;
+  int channels = 0;
+};
+
+class HelperMp4FileParser {
+public:
+  explicit HelperMp4FileParser(const char* filepath);
+  ~HelperMp4FileParser();
+
+  // .mp4, .m4v, .m4s and .mov
+  static bool isMp4Path(const std::string& path);
+
+  bool initialize();
+  // The mapped file, valid after initialize()
+  const uint8_t* fileData() const { return data_; }
+  size_t fileSize() const { return size_; }
+  bool hasVideo() const { return video_.timescale != 0; }
+  bool hasAudio() const { return audio_.timescale != 0; }
+  const Mp4VideoTrack& video() const { return video_; }
+  const Mp4AudioTrack& audio() const { return audio_; }
+
+  // Appends a video sample with start codes in place of its NAL length prefixes. Sync samples
+  // without in-band parameter sets get the sample entry's in front, as a TS stream has them.
+  // False when a length runs past the sample.
+  bool appendAnnexB(const Mp4Sample& sample, std::vector<uint8_t>& out) const;
+  // Appends an audio sample behind an ADTS header; false when ADTS can't describe it
+  bool appendAdts(const Mp4Sample& sample, std::vector<uint8_t>& out) const;
+
+private:
+  void parseMoov(const uint8_t* data, size_t size);
+  void parseTrak(const uint8_t* data, size_t size);
+  bool parseVideoEntry(const uint8_t* stsd, size_t size, Mp4VideoTrack& track);
+  bool parseAudioEntry(const uint8_t* stsd, size_t size, Mp4AudioTrack& track);
+  bool parseStbl(const uint8_t* data, size_t size, Mp4Track& track);
+  void parseMoof(const uint8_t* data, size_t size, uint64_t moofOffset);
+  void parseTraf(const uint8_t* data, size_t size, uint64_t moofOffset, uint64_t& dataEnd);
+  Mp4Track* trackById(uint32_t id);
+  void dropTruncatedSamples(Mp4Track& track);
+
+  std::string file_path_;
+  int fd_ = -1;
+  uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  Mp4VideoTrack video_;
+  Mp4AudioTrack audio_;
+};
@@ -0,0 +1,144 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Annex B start code and NAL type scanning shared by the H.264 and H.265 parsers.
+// findStartCode() tests 32 (AVX2) or 16 (SSE2, NEON) positions per step for 00 00 01,
+// with a byte loop for the tail and for other targets.
+
+enum NalCodec { NAL_CODEC_H264, NAL_CODEC_H265 };
+
+// What a scan saw, combined over the NAL units it visited
+enum NalFlags {
+  NAL_FLAG_IDR = 1 << 0, // H.264 IDR slice, H.265 IRAP (BLA / IDR / CRA) slice: a random access point
+  NAL_FLAG_SPS = 1 << 1,
+  NAL_FLAG_PPS = 1 << 2,
+  NAL_FLAG_SEI = 1 << 3,
+  NAL_FLAG_VPS = 1 << 4, // H.265 only
+  NAL_FLAG_AUD = 1 << 5,
+  NAL_FLAG_VCL = 1 << 6, // a coded slice
+};
+
+// Offset of the first 00 00 01 at or after `from`, `len` when there is none
+static inline size_t findStartCode(const uint8_t* data, size_t len, size_t from) {
+  size_t i = from;
+#if defined(__AVX2__)
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i one = _mm256_set1_epi8(1);
+  for (; i + 32 + 2 <= len; i += 32) {
+    __m256i b0 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)), zero);
+    __m256i b1 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 1)), zero);
+    __m256i b2 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 2)), one);
+    unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(b0, b1), b2)));
+    if (mask) return i + __builtin_ctz(mask);
+  }
+#elif defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi8(1);
+  for (; i + 16 + 2 <= len; i += 16) {
+    __m128i b0 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)), zero);
+    __m128i b1 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 1)), zero);
+    __m128i b2 = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 2)), one);
+    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(_mm_and_si128(b0, b1), b2)));
+    if (mask) return i + __builtin_ctz(mask);
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  const uint8x16_t zero = vdupq_n_u8(0);
+  const uint8x16_t one = vdupq_n_u8(1);
+  for (; i + 16 + 2 <= len; i += 16) {
+    uint8x16_t hit = vandq_u8(vandq_u8(vceqq_u8(vld1q_u8(data + i), zero), vceqq_u8(vld1q_u8(data + i + 1), zero)),
+                              vceqq_u8(vld1q_u8(data + i + 2), one));
+    if (vmaxvq_u8(hit)) {
+      uint64_t lo = vgetq_lane_u64(vreinterpretq_u64_u8(hit), 0);
+      return lo ? i + __builtin_ctzll(lo) / 8
+                : i + 8 + __builtin_ctzll(vgetq_lane_u64(vreinterpretq_u64_u8(hit), 1)) / 8;
+    }
+  }
+#endif
+  for (; i + 3 <= len; ++i) {
+    if (data[i] == 0x00 && data[i + 1] == 0x00 && data[i + 2] == 0x01) return i;
+  }
+  return len;
+}
+
+static inline uint8_t nalType(NalCodec codec, uint8_t header) {
+  return codec == NAL_CODEC_H264 ? (header & 0x1F) : ((header >> 1) & 0x3F);
+}
+
+static inline unsigned nalTypeFlags(NalCodec codec, uint8_t type) {
+  if (codec == NAL_CODEC_H264) {
+    switch (type) {
+      case 5: return NAL_FLAG_IDR | NAL_FLAG_VCL;
+      case 6: return NAL_FLAG_SEI;
+      case 7: return NAL_FLAG_SPS;
+      case 8: return NAL_FLAG_PPS;
+      case 9: return NAL_FLAG_AUD;
+      default: return (type >= 1 && type <= 4) ? NAL_FLAG_VCL : 0;
+    }
+  }
+  switch (type) {
+    case 16: // BLA_W_LP
+    case 17: // BLA_W_RADL
+    case 18: // BLA_N_LP
+    case 19: // IDR_W_RADL
+    case 20: // IDR_N_LP
+    case 21: // CRA_NUT
+      return NAL_FLAG_IDR | NAL_FLAG_VCL;
+    case 32: return NAL_FLAG_VPS;
+    case 33: return NAL_FLAG_SPS;
+    case 34: return NAL_FLAG_PPS;
+    case 35: return NAL_FLAG_AUD;
+    case 39: // prefix SEI
+    case 40: // suffix SEI
+      return NAL_FLAG_SEI;
+    default: return type < 32 ? NAL_FLAG_VCL : 0;
+  }
+}
+
+// The parameter set flags a decoder needs before a random access point
+static inline unsigned nalParamSetFlags(NalCodec codec) {
+  return codec == NAL_CODEC_H264 ? (NAL_FLAG_SPS | NAL_FLAG_PPS)
+                                 : (NAL_FLAG_VPS | NAL_FLAG_SPS | NAL_FLAG_PPS);
+}
+
+static inline const char* nalCodecName(NalCodec codec) {
+  return codec == NAL_CODEC_H264 ? "H.264" : "H.265";
+}
+
+// Calls fn(nalType, begin, end) for each NAL unit of an Annex B buffer, [begin, end) including
+// its start code (a 4-byte one too), until fn returns false
+template <typename Fn>
+static inline void forEachNalUnit(NalCodec codec, const uint8_t* data, size_t len, Fn fn) {
+  size_t code = findStartCode(data, len, 0);
+  if (code == len) return;
+  size_t begin = (code > 0 && data[code - 1] == 0x00) ? code - 1 : code;
+  while (true) {
+    size_t header = code + 3;
+    if (header >= len) return;
+    size_t next = findStartCode(data, len, header + 1);
+    size_t end = (next < len && next - 1 > header && data[next - 1] == 0x00) ? next - 1 : next;
+    if (!fn(nalType(codec, data[header]), begin, end) || next == len) return;
+    code = next;
+    begin = end;
+  }
+}
+
+// NAL_FLAG_* of an access unit's leading non-VCL units and its first slice. Parameter sets,
+// SEI and the slice type all precede or are the first VCL unit, so the scan stops there
+// instead of walking the slice data.
+static inline unsigned scanAccessUnit(NalCodec codec, const uint8_t* data, size_t len) {
+  unsigned flags = 0;
+  size_t code = findStartCode(data, len, 0);
+  while (code + 3 < len) {
+    flags |= nalTypeFlags(codec, nalType(codec, data[code + 3]));
+    if (flags & NAL_FLAG_VCL) break;
+    code = findStartCode(data, len, code + 4);
+  }
+  return flags;
+}
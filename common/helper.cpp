@@ -1,8 +1,18 @@
 #include "helper.h"
 
+#include <cerrno>
+#include <ctime>
 #include <thread>
+#include <poll.h>
 #include <unistd.h>
 
+// a frame woken up later than this counts as late
+static const int64_t kLateFrameThresholdNs = 5 * 1000 * 1000;
+// timestamp steps outside (0, kMaxTimestampStep] are discontinuities (loop, switch, wrap)
+static const int64_t kMaxTimestampStep = 90000;
+// give up catching up and re-anchor the schedule after falling this far behind
+static const int64_t kMaxBacklogNs = 1000 * 1000 * 1000;
+
 void waitBeforeNextSend(PacerInfo& pacer) {
   auto sendFrameEndTime = std::chrono::steady_clock::now();
   ++pacer.sendTimes;
@@ -15,6 +25,124 @@ void waitBeforeNextSend(PacerInfo& pacer) {
   }
 }
 
+static int64_t monotonicNowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+void initPtsPacer(PtsPacerInfo& pacer, int frameRate) {
+  pacer.frameIntervalNs = 1000000000LL / (frameRate > 0 ? frameRate : 30);
+  pacer.nextDeadlineNs = 0;
+  pacer.lastTimestamp = -1;
+  pacer.windowStartNs = 0;
+  pacer.sendTimes = 0;
+  pacer.lateFrames = 0;
+  pacer.windowFrames = 0;
+  pacer.sumLatenessNs = 0;
+  pacer.maxLatenessNs = 0;
+}
+
+int64_t scheduleFrameDeadline(PtsPacerInfo& pacer, int64_t timestamp) {
+  int64_t now = monotonicNowNs();
+  if (pacer.nextDeadlineNs == 0) {
+    pacer.nextDeadlineNs = now;
+    pacer.windowStartNs = now;
+  } else {
+    int64_t step = -1;
+    if (timestamp >= 0 && pacer.lastTimestamp >= 0) {
+      step = (timestamp - pacer.lastTimestamp) & ((1LL << 33) - 1);  // 33-bit wrap
+    }
+    if (step > 0 && step <= kMaxTimestampStep) {
+      pacer.nextDeadlineNs += step * 100000 / 9;  // 90 kHz ticks -> ns
+    } else {
+      pacer.nextDeadlineNs += pacer.frameIntervalNs;
+    }
+  }
+  pacer.lastTimestamp = timestamp;
+
+  if (now - pacer.nextDeadlineNs > kMaxBacklogNs) {
+    pacer.nextDeadlineNs = now;
+  }
+  return pacer.nextDeadlineNs;
+}
+
+int64_t anchorFrameDeadline(PtsPacerInfo& pacer, int64_t timestamp, int64_t deadlineNs) {
+  if (pacer.nextDeadlineNs == 0) {
+    pacer.windowStartNs = monotonicNowNs();
+  }
+  pacer.nextDeadlineNs = deadlineNs;
+  pacer.lastTimestamp = timestamp;
+  return deadlineNs;
+}
+
+int64_t recordFrameLateness(PtsPacerInfo& pacer) {
+  int64_t lateness = monotonicNowNs() - pacer.nextDeadlineNs;
+  ++pacer.sendTimes;
+  ++pacer.windowFrames;
+  pacer.sumLatenessNs += lateness;
+  if (lateness > pacer.maxLatenessNs) pacer.maxLatenessNs = lateness;
+  if (lateness > kLateFrameThresholdNs) ++pacer.lateFrames;
+  return lateness;
+}
+
+int64_t waitForFrameDeadline(PtsPacerInfo& pacer, int64_t timestamp) {
+  sleepUntilDeadline(scheduleFrameDeadline(pacer, timestamp), -1);
+  return recordFrameLateness(pacer);
+}
+
+int64_t nextSendDeadline(PacerInfo& pacer) {
+  ++pacer.sendTimes;
+  pacer.nextDurationInMs += pacer.sendIntervalInMs;
+  // steady_clock is CLOCK_MONOTONIC on Linux
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(pacer.startTime.time_since_epoch()).count() +
+         static_cast<int64_t>(pacer.nextDurationInMs) * 1000000LL;
+}
+
+bool sleepUntilDeadline(int64_t deadlineNs, int wakeFd) {
+  if (wakeFd < 0) {
+    struct timespec deadline;
+    deadline.tv_sec = deadlineNs / 1000000000LL;
+    deadline.tv_nsec = deadlineNs % 1000000000LL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR) {
+    }
+    return true;
+  }
+
+  struct pollfd pfd = {wakeFd, POLLIN, 0};
+  while (true) {
+    // poll at least once so a pending wakeup is seen even when the deadline already passed
+    int64_t remaining = deadlineNs - monotonicNowNs();
+    if (remaining < 0) remaining = 0;
+    struct timespec timeout;
+    timeout.tv_sec = remaining / 1000000000LL;
+    timeout.tv_nsec = remaining % 1000000000LL;
+    int ret = ppoll(&pfd, 1, &timeout, nullptr);
+    if (ret > 0) {
+      return false;
+    }
+    if (ret < 0 && errno != EINTR) {
+      return sleepUntilDeadline(deadlineNs, -1);
+    }
+    if (monotonicNowNs() >= deadlineNs) {
+      return true;
+    }
+  }
+}
+
+void reportPtsPacerStats(PtsPacerInfo& pacer, int intervalSec) {
+  int64_t now = monotonicNowNs();
+  if (pacer.windowFrames == 0 || now - pacer.windowStartNs < intervalSec * 1000000000LL) return;
+  printf("Pacing stats: frames %llu, late %llu, jitter avg %.3f ms, max %.3f ms\n",
+         static_cast<unsigned long long>(pacer.windowFrames),
+         static_cast<unsigned long long>(pacer.lateFrames),
+         pacer.sumLatenessNs / 1e6 / pacer.windowFrames, pacer.maxLatenessNs / 1e6);
+  pacer.windowStartNs = now;
+  pacer.windowFrames = 0;
+  pacer.lateFrames = 0;
+  pacer.sumLatenessNs = 0;
+  pacer.maxLatenessNs = 0;
+}
 
 std::string getCurrentSystemTimeChrono() {
   auto now = std::chrono::system_clock::now();
@@ -1,4 +1,6 @@
+#pragma once
 #include <chrono>
+#include <cstdint>
 #include <string>
 #include <cstdio>
 
@@ -9,6 +11,21 @@ struct PacerInfo {
   std::chrono::steady_clock::time_point startTime;
 };
 
+// Paces frames from their 90 kHz timestamps against absolute CLOCK_MONOTONIC deadlines,
+// so non-integer-ms frame intervals (29.97, 25 fps ...) don't accumulate rounding drift.
+struct PtsPacerInfo {
+  int64_t frameIntervalNs;  // spacing used when a frame has no usable timestamp
+  int64_t nextDeadlineNs;   // CLOCK_MONOTONIC time the next frame is due, 0 before the first frame
+  int64_t lastTimestamp;    // timestamp of the previous frame, -1 if unknown
+  // send loop statistics since the last report
+  int64_t windowStartNs;
+  uint64_t sendTimes;
+  uint64_t lateFrames;
+  uint64_t windowFrames;
+  int64_t sumLatenessNs;
+  int64_t maxLatenessNs;
+};
+
 struct DataStreamResult {
   bool check_result = true;
   int received_msg_count = 0;
@@ -19,6 +36,31 @@ uint64_t now_ms_t();
 
 void waitBeforeNextSend(PacerInfo& pacer);
 
+void initPtsPacer(PtsPacerInfo& pacer, int frameRate);
+
+// Sleeps until the frame stamped `timestamp` (90 kHz, -1 if unknown) is due.
+// Returns how late the wakeup was, in nanoseconds.
+int64_t waitForFrameDeadline(PtsPacerInfo& pacer, int64_t timestamp);
+
+// The steps of waitForFrameDeadline() for send loops that also wait on a wakeup fd:
+// advance the schedule and return the frame's CLOCK_MONOTONIC deadline in ns ...
+int64_t scheduleFrameDeadline(PtsPacerInfo& pacer, int64_t timestamp);
+// ... then, once the deadline was reached, account the wakeup lateness.
+int64_t recordFrameLateness(PtsPacerInfo& pacer);
+// scheduleFrameDeadline() for a frame due at a given CLOCK_MONOTONIC time: the frames after it
+// are scheduled from there by their timestamps.
+int64_t anchorFrameDeadline(PtsPacerInfo& pacer, int64_t timestamp, int64_t deadlineNs);
+
+// CLOCK_MONOTONIC deadline in ns of the next fixed-interval send, the waitBeforeNextSend() schedule.
+int64_t nextSendDeadline(PacerInfo& pacer);
+
+// Sleeps until `deadlineNs` (CLOCK_MONOTONIC) unless `wakeFd` becomes readable first.
+// Returns true at the deadline, false when woken early. wakeFd < 0 sleeps unconditionally.
+bool sleepUntilDeadline(int64_t deadlineNs, int wakeFd);
+
+// Prints and resets the jitter / late frame statistics once every `intervalSec` seconds.
+void reportPtsPacerStats(PtsPacerInfo& pacer, int intervalSec);
+
 std::string getCurrentSystemTimeChrono();
 
 void spendTimeInfoStatistics(uint64_t T1, uint64_t T2, int statistics_count);
@@ -10,6 +10,9 @@ void SampleConnectionObserver::onConnected(const agora::rtc::TConnectionInfo &co
 		   connectionInfo.channelId.get()->c_str(), connectionInfo.localUserId.get()->c_str(),
 		   reason);
 
+	if (connected_callback_) {
+		connected_callback_();
+	}
 	// notify the thread which is waiting for the SDK to be connected
 	connect_ready_.Set();
 }
@@ -57,8 +60,13 @@ void SampleConnectionObserver::onConnectionLost(const agora::rtc::TConnectionInf
 
 void SampleConnectionObserver::onUplinkNetworkInfoUpdated(const agora::rtc::UplinkNetworkInfo &info)
 {
-	AG_LOG(INFO, "onBandwidthEstimationUpdated: video_encoder_target_bitrate_bps %d\n",
-		   info.video_encoder_target_bitrate_bps);
+	if (log_uplink_estimates_) {
+		AG_LOG(INFO, "onBandwidthEstimationUpdated: video_encoder_target_bitrate_bps %d\n",
+			   info.video_encoder_target_bitrate_bps);
+	}
+	if (uplink_estimate_callback_) {
+		uplink_estimate_callback_(info.video_encoder_target_bitrate_bps);
+	}
 }
 
 void SampleConnectionObserver::onUserJoined(agora::user_id_t userId)
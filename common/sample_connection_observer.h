@@ -1,3 +1,5 @@
+#include <functional>
+
 #include "NGIAgoraRtcConnection.h"
 #include "NGIAgoraRtmpConnection.h"
 #include "sample_event.h"
@@ -13,6 +15,21 @@ public:
 		return connect_ready_.Wait(waitMs);
 	}
 
+	// Invoked from the SDK thread when the connection is up, before waitUntilConnected returns
+	void setConnectedCallback(std::function<void()> callback)
+	{
+		connected_callback_ = std::move(callback);
+	}
+	// Invoked from the SDK thread with each uplink bandwidth estimate, in bits per second
+	void setUplinkEstimateCallback(std::function<void(int)> callback)
+	{
+		uplink_estimate_callback_ = std::move(callback);
+	}
+	void setLogUplinkEstimates(bool enabled)
+	{
+		log_uplink_estimates_ = enabled;
+	}
+
 public: // IRtcConnectionObserver
 	void onConnected(const agora::rtc::TConnectionInfo &connectionInfo,
 					 agora::rtc::CONNECTION_CHANGED_REASON_TYPE reason) override;
@@ -56,6 +73,9 @@ public: // INetworkObserver
 private:
 	SampleEvent connect_ready_;
 	SampleEvent disconnect_ready_;
+	std::function<void()> connected_callback_;
+	std::function<void(int)> uplink_estimate_callback_;
+	bool log_uplink_estimates_ = true;
 };
 
 class RtmpConnectionObserver : public agora::rtc::IRtmpConnectionObserver {
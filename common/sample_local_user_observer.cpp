@@ -190,4 +190,7 @@ void SampleLocalUserObserver::onUserAudioTrackStateChanged(
 void SampleLocalUserObserver::onIntraRequestReceived()
 {
 	AG_LOG(INFO, "onIntraRequestReceived");
+	if (intra_request_callback_) {
+		intra_request_callback_();
+	}
 }
@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <functional>
 #include <map>
 #include <mutex>
 #include <string>
@@ -82,6 +83,11 @@ class SampleLocalUserObserver : public agora::rtc::ILocalUserObserver {
        enable_video_mix_ = enable;
   }
 
+  // Invoked from the SDK thread whenever a subscriber asks for a keyframe
+  void setIntraRequestCallback(std::function<void()> callback) {
+    intra_request_callback_ = std::move(callback);
+  }
+
 void onStreamMessage(agora::user_id_t userId, int streamId, const char* data, size_t length) {
         printf("the message is %s \n",data);
     }
@@ -198,6 +204,7 @@ void onStreamMessage(agora::user_id_t userId, int streamId, const char* data, si
   agora::media::IVideoEncodedFrameObserver* video_encoded_receiver_{nullptr};
   agora::media::IAudioFrameObserverBase* audio_frame_observer_{nullptr};
   agora::rtc::IVideoFrameObserver2* video_frame_observer_{nullptr};
+  std::function<void()> intra_request_callback_;
 
   std::map<std::string ,agora::agora_refptr<agora::rtc::IRemoteVideoTrack>> remote_video_track_map_;
   std::map<std::string ,videoInfo> remote_source_map_;
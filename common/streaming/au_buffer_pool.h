@@ -0,0 +1,91 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#define AU_BUFFER_SIZE  (1 << 20) // smallest pooled buffer, fits typical access units
+#define AU_TAIL_ROOM    (64)      // spare bytes behind the AU for per-frame trailers
+
+struct AuBuffer {
+  std::unique_ptr<uint8_t[]> data;
+  size_t capacity = 0;
+};
+
+// Process-wide free list of access-unit buffers of at least AU_BUFFER_SIZE + AU_TAIL_ROOM
+// bytes. An AU that doesn't fit any free buffer gets a new one of the next power of two, which
+// joins the list when released, so in steady state the same few buffers cycle between the
+// parsers and the send threads without allocating, however large the stream's IDRs are.
+class AuBufferPool {
+public:
+  static AuBufferPool& instance() {
+    static AuBufferPool* pool = new AuBufferPool(); // never destroyed: frames may outlive main()
+    return *pool;
+  }
+
+  // A buffer for `size` bytes plus AU_TAIL_ROOM
+  AuBuffer acquire(size_t size) {
+    size_t need = std::max(size, (size_t)AU_BUFFER_SIZE) + AU_TAIL_ROOM;
+    {
+      // Smallest free buffer that fits, so a rare huge one stays available for the next huge AU
+      std::lock_guard<std::mutex> lock(mutex_);
+      size_t best = free_.size();
+      for (size_t i = 0; i < free_.size(); ++i) {
+        if (free_[i].capacity >= need && (best == free_.size() || free_[i].capacity < free_[best].capacity)) {
+          best = i;
+        }
+      }
+      if (best < free_.size()) {
+        AuBuffer buf = std::move(free_[best]);
+        free_[best] = std::move(free_.back());
+        free_.pop_back();
+        return buf;
+      }
+    }
+    size_t capacity = AU_BUFFER_SIZE + AU_TAIL_ROOM;
+    while (capacity < need) {
+      capacity = (capacity - AU_TAIL_ROOM) * 2 + AU_TAIL_ROOM;
+    }
+    AuBuffer buf;
+    buf.data.reset(new uint8_t[capacity]);
+    buf.capacity = capacity;
+    return buf;
+  }
+
+  void release(AuBuffer buf) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(std::move(buf));
+  }
+
+private:
+  std::mutex mutex_;
+  std::vector<AuBuffer> free_;
+};
+
+// Move-only handle that hands its buffer back to the pool when dropped
+class PooledAuBuffer {
+public:
+  PooledAuBuffer() {}
+  explicit PooledAuBuffer(AuBuffer buf) : buf_(std::move(buf)) {}
+  PooledAuBuffer(PooledAuBuffer&& other) : buf_(std::move(other.buf_)) {}
+  PooledAuBuffer& operator=(PooledAuBuffer&& other) {
+    if (this != &other) {
+      reset();
+      buf_ = std::move(other.buf_);
+    }
+    return *this;
+  }
+  ~PooledAuBuffer() { reset(); }
+
+  uint8_t* get() const { return buf_.data.get(); }
+  size_t capacity() const { return buf_.capacity; }
+  explicit operator bool() const { return buf_.data != nullptr; }
+  void reset() {
+    if (buf_.data) AuBufferPool::instance().release(std::move(buf_));
+  }
+
+private:
+  AuBuffer buf_;
+};
@@ -0,0 +1,3 @@
+#include "command_queue.h"
+
+std::atomic<bool> exitFlag{false};
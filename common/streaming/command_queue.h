@@ -0,0 +1,98 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+struct Command {
+  enum Type {
+    SWITCH_VIDEO,
+    PRELOAD_VIDEO,      // load a video for a later SWITCH_VIDEO without cutting to it
+    WARM_VIDEO,         // index videos likely to come next into the segment store, for any stream
+    QUEUE_VIDEO,        // play a video after the current one ends, see PlaylistManager::enqueue()
+    CLEAR_QUEUE,
+    SEEK,               // restart the current video at a position, in ms
+    ADD_STREAM,
+    REMOVE_STREAM,
+    ASSIGN,             // --standby: join "<channel>,<uid>,<video>" and start the stream
+    BANDWIDTH_ESTIMATE, // uplink estimate in bps, from the connection's network observer
+    EXIT
+  };
+  
+  Type type;
+  std::string data;
+  uint64_t id = 0;     // control channel request answered when the command completes, 0 for stdin
+  int64_t atMs = 0;    // SWITCH_VIDEO: cut no earlier than this wall-clock time (ms since the epoch)
+  
+  Command(Type t, const std::string& d) : type(t), data(d) {}
+};
+
+// Commands for one send thread. push() also signals wakeFd(), so the send thread can
+// sleep on its frame deadline and the eventfd together instead of polling the queue.
+class CommandQueue {
+private:
+  std::queue<Command> commands_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  int wakeFd_;
+
+public:
+  CommandQueue() : wakeFd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+  ~CommandQueue() {
+    if (wakeFd_ >= 0) close(wakeFd_);
+  }
+
+  void push(const Command& cmd) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      commands_.push(cmd);
+      cv_.notify_one();
+    }
+    wake();
+  }
+  
+  bool pop(Command& cmd, int timeoutMs = 100) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (cv_.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this] { return !commands_.empty(); })) {
+      cmd = commands_.front();
+      commands_.pop();
+      return true;
+    }
+    return false;
+  }
+
+  // Clears the wakeup and takes every queued command at once.
+  bool drain(std::queue<Command>& out) {
+    uint64_t count;
+    if (wakeFd_ >= 0) {
+      ssize_t ret = read(wakeFd_, &count, sizeof(count));
+      (void)ret;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::swap(out, commands_);
+    return !out.empty();
+  }
+
+  // Wakes the send thread without a command, e.g. to notice a stop flag.
+  void wake() {
+    if (wakeFd_ < 0) return;
+    uint64_t one = 1;
+    ssize_t ret = write(wakeFd_, &one, sizeof(one));
+    (void)ret;
+  }
+
+  int wakeFd() const { return wakeFd_; }
+  
+  bool empty() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return commands_.empty();
+  }
+};
+
+// Set once the process is exiting: every send thread and command reader stops on it
+extern std::atomic<bool> exitFlag;
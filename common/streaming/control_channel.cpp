@@ -0,0 +1,87 @@
+#include "control_channel.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+
+bool parseJsonObject(const std::string& text, std::map<std::string, std::string>& out) {
+  size_t i = 0;
+  auto skipSpace = [&]() {
+    while (i < text.size() && std::isspace(static_cast<unsigned char>(text[i]))) ++i;
+  };
+  auto parseString = [&](std::string& value) {
+    if (i >= text.size() || text[i] != '"') return false;
+    for (++i; i < text.size(); ++i) {
+      char c = text[i];
+      if (c == '"') {
+        ++i;
+        return true;
+      }
+      if (c != '\\') {
+        value += c;
+        continue;
+      }
+      if (++i >= text.size()) return false;
+      switch (text[i]) {
+        case 'n': value += '\n'; break;
+        case 't': value += '\t'; break;
+        case 'r': value += '\r'; break;
+        case 'b': value += '\b'; break;
+        case 'f': value += '\f'; break;
+        case 'u': {
+          if (i + 4 >= text.size()) return false;
+          unsigned code = std::strtoul(text.substr(i + 1, 4).c_str(), nullptr, 16);
+          i += 4;
+          // UTF-8 encode; surrogate pairs are not needed for paths and URLs
+          if (code < 0x80) {
+            value += static_cast<char>(code);
+          } else if (code < 0x800) {
+            value += static_cast<char>(0xC0 | (code >> 6));
+            value += static_cast<char>(0x80 | (code & 0x3F));
+          } else {
+            value += static_cast<char>(0xE0 | (code >> 12));
+            value += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            value += static_cast<char>(0x80 | (code & 0x3F));
+          }
+        } break;
+        default: value += text[i]; break; // \" \\ \/
+      }
+    }
+    return false;
+  };
+
+  skipSpace();
+  if (i >= text.size() || text[i++] != '{') return false;
+  skipSpace();
+  if (i < text.size() && text[i] == '}') return true;
+  while (true) {
+    std::string key, value;
+    skipSpace();
+    if (!parseString(key)) return false;
+    skipSpace();
+    if (i >= text.size() || text[i++] != ':') return false;
+    skipSpace();
+    if (i < text.size() && text[i] == '"') {
+      if (!parseString(value)) return false;
+    } else {
+      size_t start = i;
+      while (i < text.size() && text[i] != ',' && text[i] != '}' &&
+             !std::isspace(static_cast<unsigned char>(text[i]))) {
+        ++i;
+      }
+      value = text.substr(start, i - start);
+      if (value.empty() || value[0] == '{' || value[0] == '[') return false;
+    }
+    out[key] = value;
+    skipSpace();
+    if (i >= text.size()) return false;
+    if (text[i] == '}') return true;
+    if (text[i++] != ',') return false;
+  }
+}
+
+std::string jsonMs(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%.1f", std::chrono::duration<double, std::milli>(to - from).count());
+  return buf;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+#include "metrics_registry.h"
+
+#define CONTROL_MAX_MESSAGE (64 * 1024)
+
+// Parses one flat JSON object into key -> value. String values are unescaped; numbers, true,
+// false and null are kept as written. Nested objects and arrays are rejected.
+bool parseJsonObject(const std::string& text, std::map<std::string, std::string>& out);
+
+// Request/response commands on an inherited socket (--controlFd). Every message both ways is
+// a 4-byte big-endian length followed by a JSON object. Requests carry a client-chosen "id"
+// and a "cmd"; each gets an "accepted" reply once queued, then one "done" or "error" reply
+// when it completed, with timings where there are any. Replies may come from any thread.
+class ControlChannel {
+public:
+  static ControlChannel& instance() {
+    static ControlChannel* channel = new ControlChannel(); // leaked, send threads may reply after main()
+    return *channel;
+  }
+
+  void open(int fd) { fd_ = fd; }
+  int fd() const { return fd_; }
+
+  // {"id":<id>,"status":<status><fields>}, where fields is empty or a list of members starting
+  // with a comma. Commands from stdin have id 0 and get no reply.
+  void reply(uint64_t id, const char* status, const std::string& fields = std::string()) {
+    if (id == 0) return;
+    std::ostringstream out;
+    out << "{\"id\":" << id << ",\"status\":\"" << status << "\"" << fields << "}";
+    send(out.str());
+  }
+
+  void error(uint64_t id, const std::string& message) {
+    reply(id, "error", ",\"error\":\"" + jsonEscape(message) + "\"");
+  }
+
+  void send(const std::string& message) {
+    if (fd_ < 0) return;
+    uint32_t len = static_cast<uint32_t>(message.size());
+    uint8_t header[4] = {static_cast<uint8_t>(len >> 24), static_cast<uint8_t>(len >> 16),
+                         static_cast<uint8_t>(len >> 8), static_cast<uint8_t>(len)};
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (writeAll(header, sizeof(header))) {
+      writeAll(reinterpret_cast<const uint8_t*>(message.data()), message.size());
+    }
+  }
+
+private:
+  bool writeAll(const uint8_t* data, size_t len) {
+    while (len > 0) {
+      ssize_t n = write(fd_, data, len);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return false; // the supervisor went away, replies are dropped
+      data += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  std::mutex mutex_;
+  int fd_ = -1;
+};
+
+// Milliseconds between two steady_clock points, for reply timings
+std::string jsonMs(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to);
@@ -0,0 +1,234 @@
+#include "disk_cache.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <thread>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "metrics_registry.h"
+#include "segment_fetcher.h"
+#include "stream_util.h"
+
+void DiskCache::setBudget(uint64_t bytes) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    budgetBytes_ = bytes;
+    if (!bytes) {
+      return;
+    }
+    passRequested_ = true; // the cache may have grown past the budget before this process ran
+    if (!started_) {
+      started_ = true;
+      std::thread(&DiskCache::evictLoop, this).detach();
+    }
+  }
+  wake_.notify_one();
+}
+
+bool DiskCache::readManifest(const std::string& path, uint64_t& size, uint64_t& checksum) {
+  FILE* file = fopen((path + ".meta").c_str(), "r");
+  if (!file) {
+    return false;
+  }
+  unsigned long long s = 0, c = 0;
+  bool ok = fscanf(file, "%llu %llx", &s, &c) == 2;
+  fclose(file);
+  size = s;
+  checksum = c;
+  return ok;
+}
+
+bool DiskCache::lookup(const std::string& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+  if (!inCache(path)) {
+    return true;
+  }
+  uint64_t size = 0, checksum = 0;
+  if (!readManifest(path, size, checksum) || size != (uint64_t)st.st_size) {
+    LOGF("Ignoring incomplete cached file: %s", path.c_str());
+    return false;
+  }
+  touch(path);
+  return true;
+}
+
+void DiskCache::touch(const std::string& path) {
+  if (inCache(path)) {
+    utimensat(AT_FDCWD, (path + ".meta").c_str(), nullptr, 0);
+  }
+}
+
+void DiskCache::commit(const std::string& path, uint64_t size, uint64_t checksum) {
+  // Same scheme as the downloads: other processes may be writing the same manifest
+  std::string tmpPath = path + ".meta.part." + std::to_string(getpid()) + "." + std::to_string(manifestSeq_++);
+  FILE* file = fopen(tmpPath.c_str(), "w");
+  bool ok = file && fprintf(file, "%llu %016llx\n", (unsigned long long)size, (unsigned long long)checksum) > 0;
+  ok = file && fclose(file) == 0 && ok;
+  if (!ok || rename(tmpPath.c_str(), (path + ".meta").c_str()) != 0) {
+    LOGF("Failed to write the manifest of %s: %s", path.c_str(), strerror(errno));
+    unlink(tmpPath.c_str());
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    addedBytes_ += size;
+    if (!budgetBytes_ || addedBytes_ < budgetBytes_ / 16) {
+      return;
+    }
+    passRequested_ = true;
+  }
+  wake_.notify_one();
+}
+
+bool DiskCache::verify(const std::string& path, const uint8_t* data, size_t size) {
+  uint64_t expectedSize = 0, expected = 0;
+  if (!inCache(path) || !readManifest(path, expectedSize, expected)) {
+    return true; // nothing recorded to check against
+  }
+  struct stat st;
+  VerifiedFile version = {0, 0, size, -1, expected};
+  if (stat(path.c_str(), &st) == 0) {
+    version.device = st.st_dev;
+    version.inode = st.st_ino;
+    version.mtimeNs = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  }
+  {
+    std::lock_guard<std::mutex> lock(verifiedMutex_);
+    auto it = verified_.find(path);
+    if (version.mtimeNs >= 0 && it != verified_.end() && it->second == version) {
+      return true;
+    }
+  }
+  Checksum checksum;
+  checksum.update(data, size);
+  if (expectedSize == size && checksum.value() == expected) {
+    if (version.mtimeNs >= 0) {
+      std::lock_guard<std::mutex> lock(verifiedMutex_);
+      verified_[path] = version;
+    }
+    return true;
+  }
+  LOGF("Cached file does not match its manifest, removing it: %s", path.c_str());
+  {
+    std::lock_guard<std::mutex> lock(verifiedMutex_);
+    verified_.erase(path);
+  }
+  unlink((path + ".meta").c_str());
+  unlink(path.c_str());
+  MetricsRegistry::instance().segments().cacheInvalid.add();
+  return false;
+}
+
+void DiskCache::prewarm(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd >= 0) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+  }
+}
+
+void DiskCache::evictLoop() {
+  while (true) {
+    uint64_t budget;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_.wait(lock, [this] { return passRequested_; });
+      passRequested_ = false;
+      addedBytes_ = 0;
+      budget = budgetBytes_;
+    }
+    if (budget) {
+      evict(budget);
+    }
+  }
+}
+
+void DiskCache::evict(uint64_t budget) {
+  int lockFd = open(CACHE_BASE_PATH "/.lock", O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (lockFd < 0) {
+    return; // no cache directory yet
+  }
+  if (flock(lockFd, LOCK_EX | LOCK_NB) != 0) {
+    close(lockFd); // another process is evicting
+    return;
+  }
+
+  std::vector<CachedFile> files;
+  uint64_t total = 0;
+  scan(CACHE_BASE_PATH, time(nullptr), files, total);
+  if (total > budget) {
+    // Down to 7/8 of the budget, so the next pass isn't due after a single download
+    uint64_t target = budget - budget / 8;
+    std::sort(files.begin(), files.end(),
+              [](const CachedFile& a, const CachedFile& b) { return a.lastUse < b.lastUse; });
+    size_t evicted = 0;
+    uint64_t evictedBytes = 0;
+    for (size_t i = 0; i < files.size() && total > target; ++i) {
+      // Manifest first: a reader racing the removal sees a miss, not a file about to vanish
+      unlink((files[i].path + ".meta").c_str());
+      {
+        std::lock_guard<std::mutex> lock(verifiedMutex_);
+        verified_.erase(files[i].path);
+      }
+      if (unlink(files[i].path.c_str()) == 0) {
+        total -= files[i].size;
+        evictedBytes += files[i].size;
+        ++evicted;
+      }
+    }
+    MetricsRegistry::instance().segments().cacheEvicted.add(evicted);
+    LOGF("Evicted %zu cached file(s), %.1f MB; cache at %.1f of %.1f MB", evicted, evictedBytes / (1024.0 * 1024.0),
+         total / (1024.0 * 1024.0), budget / (1024.0 * 1024.0));
+  }
+
+  flock(lockFd, LOCK_UN);
+  close(lockFd);
+}
+
+// Lists the cached files under `dir` with the time of their last use, and removes what crashed
+// downloads left behind: stale temp files and manifests whose file is gone
+void DiskCache::scan(const std::string& dir, time_t now, std::vector<CachedFile>& files, uint64_t& total) {
+  DIR* handle = opendir(dir.c_str());
+  if (!handle) {
+    return;
+  }
+  while (struct dirent* entry = readdir(handle)) {
+    std::string name = entry->d_name;
+    if (name == "." || name == ".." || name == ".lock") {
+      continue;
+    }
+    std::string path = dir + "/" + name;
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) {
+      continue;
+    }
+    if (S_ISDIR(st.st_mode)) {
+      scan(path, now, files, total);
+    } else if (!S_ISREG(st.st_mode)) {
+      continue;
+    } else if (name.find(".part.") != std::string::npos) {
+      if (now - st.st_mtime > 2 * FETCH_TIMEOUT_S) { // no live download runs that long
+        unlink(path.c_str());
+      }
+    } else if (name.size() > 5 && name.compare(name.size() - 5, 5, ".meta") == 0) {
+      if (!fileExists(path.substr(0, path.size() - 5))) {
+        unlink(path.c_str());
+      }
+    } else {
+      struct stat manifest;
+      time_t lastUse = stat((path + ".meta").c_str(), &manifest) == 0 ? manifest.st_mtime : st.st_mtime;
+      files.push_back(CachedFile{path, (uint64_t)st.st_size, lastUse});
+      total += st.st_size;
+    }
+  }
+  closedir(handle);
+}
@@ -0,0 +1,133 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
+
+// Shared by every controller process on the host
+#define CACHE_BASE_PATH "/home/ubuntu/tscache"
+
+// 64-bit hash of a byte stream fed in any chunking, FNV-1a style over 8-byte words. It catches
+// truncated and damaged files, it is no defence against tampering.
+class Checksum {
+public:
+  void update(const uint8_t* data, size_t len) {
+    length_ += len;
+    if (pendingLen_) {
+      size_t take = std::min(len, sizeof(pending_) - pendingLen_);
+      std::memcpy(pending_ + pendingLen_, data, take);
+      pendingLen_ += take;
+      data += take;
+      len -= take;
+      if (pendingLen_ < sizeof(pending_)) return;
+      hash_ = mix(hash_, load(pending_));
+      pendingLen_ = 0;
+    }
+    for (; len >= 8; data += 8, len -= 8) {
+      hash_ = mix(hash_, load(data));
+    }
+    std::memcpy(pending_, data, len);
+    pendingLen_ = len;
+  }
+
+  uint64_t value() const {
+    uint64_t hash = hash_;
+    if (pendingLen_) {
+      uint8_t last[8] = {0};
+      std::memcpy(last, pending_, pendingLen_);
+      hash = mix(hash, load(last));
+    }
+    return mix(hash, length_);
+  }
+
+private:
+  static uint64_t load(const uint8_t* p) {
+    uint64_t word;
+    std::memcpy(&word, p, sizeof(word));
+    return word;
+  }
+  static uint64_t mix(uint64_t hash, uint64_t word) {
+    hash = (hash ^ word) * 0x100000001b3ULL;
+    return (hash << 31) | (hash >> 33); // bring the well-mixed high bits down
+  }
+
+  uint64_t hash_ = 0xcbf29ce484222325ULL;
+  uint64_t length_ = 0;
+  uint8_t pending_[8];
+  size_t pendingLen_ = 0;
+};
+
+// Keeps CACHE_BASE_PATH, which every controller process on the host shares, complete and
+// within budget. The fetcher renames each download into place and then records its size and
+// checksum in a manifest next to it, `<file>.meta`. A file counts as cached only when its
+// manifest matches, so a download that died half way is fetched again rather than played, and
+// the checksum is checked the first time this process indexes each version of the file, not again
+// when the SegmentStore re-indexes it after an eviction. Every use touches the
+// manifest, and over the budget a background thread deletes the least recently used files of
+// all processes, holding an flock on CACHE_BASE_PATH/.lock so only one process evicts at a time.
+class DiskCache {
+public:
+  static DiskCache& instance() {
+    static DiskCache* cache = new DiskCache(); // leaked, the eviction thread may outlive main
+    return *cache;
+  }
+
+  // 0 leaves the cache unbounded
+  void setBudget(uint64_t bytes);
+  // True when `path` is complete: for files in CACHE_BASE_PATH, when its manifest matches
+  bool lookup(const std::string& path);
+  // Marks a cached file as just used
+  void touch(const std::string& path);
+  // Writes the manifest of a file the fetcher just moved into place
+  void commit(const std::string& path, uint64_t size, uint64_t checksum);
+  // Checks the bytes of a cached file against its manifest and removes the file on a mismatch;
+  // a file already verified in this process, unchanged since, is not read again
+  bool verify(const std::string& path, const uint8_t* data, size_t size);
+  // Starts reading a file that is about to be indexed into the page cache
+  static void prewarm(const std::string& path);
+
+private:
+  struct CachedFile {
+    std::string path;
+    uint64_t size;
+    time_t lastUse;
+  };
+  // The version of a file that passed verify(): a new download renamed into place, or a
+  // changed manifest, no longer matches it
+  struct VerifiedFile {
+    dev_t device;
+    ino_t inode;
+    uint64_t size;
+    int64_t mtimeNs;
+    uint64_t checksum;
+    bool operator==(const VerifiedFile& other) const {
+      return device == other.device && inode == other.inode && size == other.size &&
+             mtimeNs == other.mtimeNs && checksum == other.checksum;
+    }
+  };
+
+  static bool inCache(const std::string& path) {
+    return path.compare(0, sizeof(CACHE_BASE_PATH), CACHE_BASE_PATH "/") == 0;
+  }
+  static bool readManifest(const std::string& path, uint64_t& size, uint64_t& checksum);
+  void evictLoop();
+  void evict(uint64_t budget);
+  void scan(const std::string& dir, time_t now, std::vector<CachedFile>& files, uint64_t& total);
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  uint64_t budgetBytes_ = 0;
+  uint64_t addedBytes_ = 0; // committed since the last eviction pass
+  bool passRequested_ = false;
+  bool started_ = false;
+  std::atomic<unsigned> manifestSeq_{0};
+  std::mutex verifiedMutex_;
+  std::unordered_map<std::string, VerifiedFile> verified_;
+};
@@ -0,0 +1,144 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "au_buffer_pool.h"
+#include "stream_frame.h"
+#include "common/helper.h"
+#include "common/file_parser/helper_nal_scanner.h"
+
+#define METADATA_MAX_TEXT (256)
+
+// Identifies this controller's user_data_unregistered SEI messages
+static const uint8_t kMetadataSeiUuid[16] = {'A', 'g', 'o', 'r', 'a', 'W', 'r', 'c',
+                                             'm', 'e', 't', 'a', 'd', 'a', 't', 'a'};
+
+// Per-frame data written into the video frames as they are sent, chosen with --metadata:
+// - "trailer" appends the payload, its length as 4 big-endian bytes and "AgoraWrc", the layout
+//   receivers of the old timestamp build parse.
+// - "sei" puts the payload in a user_data_unregistered SEI NAL (kMetadataSeiUuid) in front of the
+//   first slice, which decoders that don't know it skip.
+// The payload is the Unix time in ms, the stream's frame index, or fixed text. A frame already
+// in a pooled buffer gets it in place in the tail room; a frame still pointing into its segment
+// is copied once into a pooled buffer with the metadata. One instance per send thread.
+class FrameMetadata {
+public:
+  enum Placement { NONE, TRAILER, SEI };
+  enum Payload { TIMESTAMP, FRAME_INDEX, TEXT };
+
+  // placement none / trailer / sei, payload timestamp / frame / text:<data>; false when unknown
+  bool configure(const std::string& placement, const std::string& payload) {
+    placement_ = placement == "trailer" ? TRAILER : placement == "sei" ? SEI : NONE;
+    if (placement_ == NONE && placement != "none") return false;
+    if (payload == "timestamp") {
+      payload_ = TIMESTAMP;
+    } else if (payload == "frame") {
+      payload_ = FRAME_INDEX;
+    } else if (payload.compare(0, 5, "text:") == 0 && payload.size() - 5 <= METADATA_MAX_TEXT) {
+      payload_ = TEXT;
+      text_ = payload.substr(5);
+    } else {
+      return false;
+    }
+    return true;
+  }
+  bool enabled() const { return placement_ != NONE; }
+
+  // Writes the metadata of the frame numbered `frameIndex` into it
+  void apply(HelperH264Frame& frame, uint64_t frameIndex) {
+    char number[24];
+    const uint8_t* payload;
+    size_t payloadLen;
+    if (payload_ == TEXT) {
+      payload = reinterpret_cast<const uint8_t*>(text_.data());
+      payloadLen = text_.size();
+    } else {
+      unsigned long long value = payload_ == FRAME_INDEX ? frameIndex : now_ms_t();
+      payloadLen = std::snprintf(number, sizeof(number), "%llu", value);
+      payload = reinterpret_cast<const uint8_t*>(number);
+    }
+
+    // The bytes that go in, and where: the end, or before the first slice's start code
+    size_t len = frame.bufferLen;
+    size_t at = len;
+    if (placement_ == TRAILER) {
+      buildTrailer(payload, payloadLen);
+    } else {
+      buildSei(frame.codec, payload, payloadLen);
+      for (size_t code = findStartCode(frame.buffer, len, 0); code + 3 < len;
+           code = findStartCode(frame.buffer, len, code + 4)) {
+        if (nalTypeFlags(frame.codec, nalType(frame.codec, frame.buffer[code + 3])) & NAL_FLAG_VCL) {
+          at = (code > 0 && frame.buffer[code - 1] == 0x00) ? code - 1 : code;
+          break;
+        }
+      }
+    }
+
+    size_t extra = scratch_.size();
+    if (frame.pooled && frame.buffer == frame.pooled.get() && len + extra <= frame.pooled.capacity()) {
+      uint8_t* data = frame.pooled.get();
+      std::memmove(data + at + extra, data + at, len - at);
+      std::memcpy(data + at, scratch_.data(), extra);
+    } else {
+      PooledAuBuffer pooled(AuBufferPool::instance().acquire(len + extra));
+      std::memcpy(pooled.get(), frame.buffer, at);
+      std::memcpy(pooled.get() + at, scratch_.data(), extra);
+      std::memcpy(pooled.get() + at + extra, frame.buffer + at, len - at);
+      frame.pooled = std::move(pooled); // `owner` stays, the audio frames live in it
+      frame.buffer = frame.pooled.get();
+    }
+    frame.bufferLen = static_cast<int>(len + extra);
+  }
+
+private:
+  void buildTrailer(const uint8_t* payload, size_t len) {
+    scratch_.assign(payload, payload + len);
+    for (int shift = 24; shift >= 0; shift -= 8) {
+      scratch_.push_back(static_cast<uint8_t>(len >> shift));
+    }
+    static const char kEnding[] = "AgoraWrc";
+    scratch_.insert(scratch_.end(), kEnding, kEnding + 8);
+  }
+
+  void buildSei(NalCodec codec, const uint8_t* payload, size_t len) {
+    rbsp_.clear();
+    rbsp_.push_back(5); // user_data_unregistered
+    for (size_t size = sizeof(kMetadataSeiUuid) + len;; size -= 255) {
+      rbsp_.push_back(static_cast<uint8_t>(std::min<size_t>(size, 255)));
+      if (size < 255) break;
+    }
+    rbsp_.insert(rbsp_.end(), kMetadataSeiUuid, kMetadataSeiUuid + sizeof(kMetadataSeiUuid));
+    rbsp_.insert(rbsp_.end(), payload, payload + len);
+    rbsp_.push_back(0x80); // rbsp_trailing_bits
+
+    static const uint8_t kStartCode[] = {0, 0, 0, 1};
+    scratch_.assign(kStartCode, kStartCode + 4);
+    if (codec == NAL_CODEC_H264) {
+      scratch_.push_back(0x06);
+    } else {
+      scratch_.push_back(39 << 1); // PREFIX_SEI_NUT
+      scratch_.push_back(0x01);
+    }
+    // Emulation prevention: no 00 00 0x with x <= 3 inside the NAL
+    int zeros = 0;
+    for (uint8_t byte : rbsp_) {
+      if (zeros >= 2 && byte <= 3) {
+        scratch_.push_back(0x03);
+        zeros = 0;
+      }
+      scratch_.push_back(byte);
+      zeros = byte == 0 ? zeros + 1 : 0;
+    }
+  }
+
+  Placement placement_ = NONE;
+  Payload payload_ = TIMESTAMP;
+  std::string text_;
+  std::vector<uint8_t> rbsp_;    // reused, so a frame allocates nothing once they have grown
+  std::vector<uint8_t> scratch_; // what apply() writes into the frame
+};
@@ -0,0 +1,150 @@
+#include "frame_prefetcher.h"
+
+#include <cstdio>
+
+void FramePrefetcher::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  if (reader_.joinable()) {
+    reader_.join();
+  }
+}
+
+bool FramePrefetcher::pop(std::unique_ptr<HelperH264Frame>& frame, unsigned& generation) {
+  size_t head = head_.load(std::memory_order_relaxed);
+  if (head == tail_.load(std::memory_order_acquire)) {
+    // Announce the wait, then look again so a frame pushed in between isn't missed
+    consumerWaiting_ = true;
+    if (head == tail_.load()) {
+      if (!dry_) {
+        ++underruns_;
+        dry_ = true;
+      }
+      return false;
+    }
+    consumerWaiting_ = false;
+  }
+  Slot& slot = slots_[head % slots_.size()];
+  frame = std::move(slot.frame);
+  generation = slot.generation;
+  head_.store(head + 1);
+  dry_ = false;
+
+  size_t left = tail_.load() - (head + 1);
+  ++windowPops_;
+  depthSum_ += left;
+  depthMin_ = std::min(depthMin_, left);
+
+  if (readerWaiting_.load() && left <= lowWater_) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cv_.notify_one();
+  }
+  return true;
+}
+
+const HelperH264Frame* FramePrefetcher::peek(unsigned& generation) const {
+  size_t head = head_.load(std::memory_order_relaxed);
+  if (head == tail_.load(std::memory_order_acquire)) {
+    return nullptr;
+  }
+  const Slot& slot = slots_[head % slots_.size()];
+  generation = slot.generation;
+  return slot.frame.get();
+}
+
+void FramePrefetcher::requestSwitch(SwitchCut cut) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    switchCut_ = cut;
+    switchRequested_ = true;
+  }
+  cv_.notify_one();
+}
+
+void FramePrefetcher::lastSwitchTimes(std::chrono::steady_clock::time_point& ready,
+                                      std::chrono::steady_clock::time_point& cut) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ready = switchReadyTime_;
+  cut = switchCutTime_;
+}
+
+// Reader thread: cuts over to a preloaded playlist, returns true when it did
+bool FramePrefetcher::trySwitch() {
+  SwitchCut cut;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cut = switchCut_;
+  }
+  std::chrono::steady_clock::time_point ready;
+  if (!manager_->switchToNewPlaylist(cut, &ready)) {
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    switchReadyTime_ = ready;
+    switchCutTime_ = std::chrono::steady_clock::now();
+    switchRequested_ = false;
+  }
+  generation_.fetch_add(1, std::memory_order_release);
+  return true;
+}
+
+void FramePrefetcher::readerLoop() {
+  while (!stop_) {
+    if (switchRequested_.load(std::memory_order_relaxed)) {
+      trySwitch();
+    }
+
+    if (level() >= highWater_) {
+      // Full: park until the send side drained to the low water mark, or an immediate switch
+      std::unique_lock<std::mutex> lock(mutex_);
+      readerWaiting_ = true;
+      cv_.wait(lock, [this] {
+        return stop_ || level() <= lowWater_ || (switchRequested_ && switchCut_ == CUT_NOW);
+      });
+      readerWaiting_ = false;
+      ++refills_;
+      continue;
+    }
+
+    std::unique_ptr<HelperH264Frame> frame = manager_->getNextFrame();
+    if (!frame) {
+      // Next segment still downloading
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait_for(lock, std::chrono::milliseconds(10), [this] { return stop_.load(); });
+      continue;
+    }
+
+    // Fault the AU's pages in here rather than inside sendEncodedVideoImage()
+    const volatile uint8_t* bytes = frame->buffer;
+    for (int i = 0; i < frame->bufferLen; i += 4096) {
+      (void)bytes[i];
+    }
+
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    Slot& slot = slots_[tail % slots_.size()];
+    slot.frame = std::move(frame);
+    slot.generation = generation_.load(std::memory_order_relaxed);
+    tail_.store(tail + 1);
+
+    if (consumerWaiting_.load() && consumerWaiting_.exchange(false)) {
+      consumerQueue_.wake();
+    }
+  }
+}
+
+void FramePrefetcher::reportStats(int intervalSec) {
+  auto now = std::chrono::steady_clock::now();
+  if (windowPops_ == 0 || now - windowStart_ < std::chrono::seconds(intervalSec)) return;
+  printf("Prefetch stats: depth avg %.1f, min %zu of %zu (high %zu, low %zu), underruns %llu, refills %llu\n",
+         (double)depthSum_ / windowPops_, depthMin_, slots_.size(), highWater_, lowWater_,
+         underruns_, refills_.exchange(0));
+  windowStart_ = now;
+  windowPops_ = 0;
+  depthSum_ = 0;
+  depthMin_ = SIZE_MAX;
+  underruns_ = 0;
+}
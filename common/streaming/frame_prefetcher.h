@@ -0,0 +1,96 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "command_queue.h"
+#include "playlist_manager.h"
+#include "stream_frame.h"
+
+// Reader stage of the send pipeline. A prefetch thread pulls frames from the PlaylistManager
+// (AU parsing, segment transitions, playlist switches and the first touch of fresh mmap pages)
+// into a fixed ring of frame slots, so the send thread only dequeues and sends. The reader
+// fills the ring up to the high water mark, then sleeps until the send side drains it to the
+// low water mark.
+class FramePrefetcher {
+public:
+  FramePrefetcher(std::shared_ptr<PlaylistManager> manager, size_t depth, size_t highWater,
+                  size_t lowWater, CommandQueue& consumerQueue)
+    : manager_(std::move(manager)), slots_(depth), highWater_(highWater), lowWater_(lowWater),
+      consumerQueue_(consumerQueue) {}
+  ~FramePrefetcher() { stop(); }
+
+  void start() { reader_ = std::thread(&FramePrefetcher::readerLoop, this); }
+  void stop();
+
+  // Send side. Takes the oldest prefetched frame and the switch generation it was read in;
+  // false when the ring ran dry, the consumer queue is woken once the next frame is in.
+  bool pop(std::unique_ptr<HelperH264Frame>& frame, unsigned& generation);
+  // Send side. The frame pop() would return next, left in the ring; nullptr when dry
+  const HelperH264Frame* peek(unsigned& generation) const;
+  // Bumped by the reader each time it cuts over to a preloaded playlist
+  unsigned generation() const { return generation_.load(std::memory_order_acquire); }
+  // Frames currently queued
+  size_t size() const { return level(); }
+
+  // Asks the reader to cut over to the manager's preloaded playlist at `cut`, waking it if it is
+  // parked on a full ring
+  void requestSwitch(SwitchCut cut);
+  // Withdraws a requested switch the reader hasn't made yet
+  void cancelSwitch() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    switchRequested_ = false;
+  }
+  // When the preload of the last switch finished and when the reader cut over
+  void lastSwitchTimes(std::chrono::steady_clock::time_point& ready,
+                       std::chrono::steady_clock::time_point& cut);
+
+  // Prints and resets ring depth / underrun / refill statistics once every `intervalSec` seconds
+  void reportStats(int intervalSec);
+
+private:
+  struct Slot {
+    std::unique_ptr<HelperH264Frame> frame;
+    unsigned generation = 0;
+  };
+
+  size_t level() const { return tail_.load() - head_.load(); }
+  void readerLoop();
+  bool trySwitch();
+
+  std::shared_ptr<PlaylistManager> manager_;
+
+  // Single-producer single-consumer ring: the reader owns tail_, the send thread head_
+  std::vector<Slot> slots_;
+  std::atomic<size_t> head_{0};
+  std::atomic<size_t> tail_{0};
+  size_t highWater_;
+  size_t lowWater_;
+
+  std::thread reader_;
+  std::mutex mutex_;            // parks the reader, guards the switch times
+  std::condition_variable cv_;
+  std::atomic<bool> stop_{false};
+  std::atomic<bool> readerWaiting_{false};
+  std::atomic<bool> consumerWaiting_{false};
+  CommandQueue& consumerQueue_;
+
+  std::atomic<bool> switchRequested_{false};
+  SwitchCut switchCut_ = CUT_NOW;
+  std::atomic<unsigned> generation_{0};
+  std::chrono::steady_clock::time_point switchReadyTime_, switchCutTime_;
+
+  // Statistics since the last report; refills_ is counted by the reader, the rest by the send thread
+  std::atomic<unsigned long long> refills_{0};
+  std::chrono::steady_clock::time_point windowStart_ = std::chrono::steady_clock::now();
+  unsigned long long windowPops_ = 0;
+  unsigned long long depthSum_ = 0;
+  size_t depthMin_ = SIZE_MAX;
+  unsigned long long underruns_ = 0;
+  bool dry_ = true;
+};
@@ -0,0 +1,188 @@
+#include "m3u8_parser.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+#include "disk_cache.h"
+#include "metrics_registry.h"
+#include "segment_fetcher.h"
+#include "stream_util.h"
+
+bool M3U8Parser::parseM3U8(const std::string& m3u8Path, const std::string& baseUrl) {
+  baseUrl_ = baseUrl;
+  segments_.clear();
+  variants_.clear();
+  mediaSequence_ = 0;
+  targetDuration_ = 0;
+  endList_ = false;
+  
+  std::ifstream file(m3u8Path);
+  if (!file.is_open()) {
+    fprintf(stderr, "Failed to open M3U8 file: %s\n", m3u8Path.c_str());
+    return false;
+  }
+  
+  std::string line;
+  double duration = 0.0;
+  long bandwidth = -1; // set by #EXT-X-STREAM-INF, the next URI is a variant playlist
+  
+  while (std::getline(file, line)) {
+    // Remove carriage return if present
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    
+    if (line.empty() || line[0] == '#') {
+      // Parse duration from #EXTINF lines
+      if (line.find("#EXTINF:") == 0) {
+        size_t colonPos = line.find(':');
+        size_t commaPos = line.find(',');
+        if (colonPos != std::string::npos && commaPos != std::string::npos) {
+          std::string durationStr = line.substr(colonPos + 1, commaPos - colonPos - 1);
+          duration = std::stod(durationStr);
+        }
+      } else if (line.find("#EXT-X-MEDIA-SEQUENCE:") == 0) {
+        mediaSequence_ = std::strtoull(line.c_str() + 22, nullptr, 10);
+      } else if (line.find("#EXT-X-TARGETDURATION:") == 0) {
+        targetDuration_ = std::strtod(line.c_str() + 22, nullptr);
+      } else if (line == "#EXT-X-ENDLIST") {
+        endList_ = true;
+      } else if (line.find("#EXT-X-STREAM-INF:") == 0) {
+        size_t pos = line.find("BANDWIDTH=");
+        // AVERAGE-BANDWIDTH= also contains the key, skip past it
+        while (pos != std::string::npos && pos > 0 && line[pos - 1] != ':' && line[pos - 1] != ',') {
+          pos = line.find("BANDWIDTH=", pos + 1);
+        }
+        bandwidth = pos != std::string::npos ? std::strtol(line.c_str() + pos + 10, nullptr, 10) : 0;
+      }
+      continue;
+    }
+    
+    // Absolute URL, or relative to the playlist's base URL
+    std::string url = line;
+    if (url.find("http://") != 0 && url.find("https://") != 0) {
+      url = baseUrl_ + url;
+    }
+    if (bandwidth >= 0) {
+      variants_.push_back(M3U8Variant{url, bandwidth});
+      bandwidth = -1;
+      continue;
+    }
+    
+    // This is a segment URL
+    M3U8Segment segment;
+    segment.duration = duration;
+    segment.url = url;
+    
+    segments_.push_back(segment);
+    duration = 0.0; // Reset for next segment
+  }
+  
+  if (!variants_.empty()) {
+    printf("Parsed M3U8: found %zu variants\n", variants_.size());
+    return true;
+  }
+  printf("Parsed M3U8: found %zu segments\n", segments_.size());
+  return !segments_.empty();
+}
+
+// Resolves every segment's cache path and downloads the missing ones among `count` from `first` on
+bool M3U8Parser::downloadSegments(const std::string& cacheBasePath, size_t count, size_t first) {
+  std::vector<FetchJob> jobs;
+  for (size_t i = 0; i < segments_.size(); ++i) {
+    M3U8Segment& segment = segments_[i];
+    // Extract filename from URL
+    std::string filename;
+    size_t lastSlash = segment.url.find_last_of('/');
+    if (lastSlash != std::string::npos) {
+      filename = segment.url.substr(lastSlash + 1);
+    } else {
+      filename = segment.url;
+    }
+    
+    segment.localPath = cacheBasePath + "/" + filename;
+    
+    // Download if not already cached
+    if (i < first || i - first >= count) {
+      continue;
+    } else if (!DiskCache::instance().lookup(segment.localPath)) {
+      jobs.push_back(FetchJob{segment.url, segment.localPath});
+    } else {
+      printf("Using cached segment: %s\n", segment.localPath.c_str());
+      MetricsRegistry::instance().segments().cacheHits.add();
+    }
+  }
+  
+  if (!SegmentFetcher::instance().fetchAll(jobs)) {
+    fprintf(stderr, "Failed to download segments into: %s\n", cacheBasePath.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool fetchPlaylistFile(const std::string& input, std::string& m3u8Path, std::string& baseUrl, bool refresh,
+                       bool* downloaded) {
+  if (downloaded) {
+    *downloaded = false;
+  }
+  m3u8Path = input;
+  baseUrl.clear();
+  if (input.find("http://") != 0 && input.find("https://") != 0) {
+    return true;
+  }
+  
+  std::string cachePath = extractCachePath(input);
+  std::string fullCachePath = std::string(CACHE_BASE_PATH) + "/" + cachePath;
+  
+  // Create cache directory
+  size_t lastSlash = fullCachePath.find_last_of('/');
+  if (lastSlash != std::string::npos) {
+    std::string cacheDir = fullCachePath.substr(0, lastSlash);
+    if (!createDirectoryRecursive(cacheDir)) {
+      fprintf(stderr, "Failed to create cache directory: %s\n", cacheDir.c_str());
+      return false;
+    }
+  }
+  
+  // Download M3U8 if not cached
+  if (refresh || !DiskCache::instance().lookup(fullCachePath)) {
+    if (!downloadFile(input, fullCachePath)) {
+      fprintf(stderr, "Failed to download M3U8: %s\n", input.c_str());
+      return false;
+    }
+    if (downloaded) {
+      *downloaded = true;
+    }
+  }
+  
+  m3u8Path = fullCachePath;
+  baseUrl = getBaseUrl(input);
+  return true;
+}
+
+bool loadMasterPlaylist(const std::string& input, std::vector<M3U8Variant>& variants) {
+  variants.clear();
+  if (input.size() < 5 || input.substr(input.size() - 5) != ".m3u8") {
+    return false;
+  }
+  std::string m3u8Path, baseUrl;
+  M3U8Parser parser;
+  if (!fetchPlaylistFile(input, m3u8Path, baseUrl) || !parser.parseM3U8(m3u8Path, baseUrl)) {
+    return false;
+  }
+  variants = parser.getVariants();
+  for (auto& variant : variants) {
+    // Local master playlist - variants are relative to its location
+    if (baseUrl.empty() && variant.url.find("://") == std::string::npos && variant.url.find('/') != 0) {
+      size_t lastSlash = m3u8Path.find_last_of('/');
+      if (lastSlash != std::string::npos) {
+        variant.url = m3u8Path.substr(0, lastSlash + 1) + variant.url;
+      }
+    }
+  }
+  std::stable_sort(variants.begin(), variants.end(),
+                   [](const M3U8Variant& a, const M3U8Variant& b) { return a.bandwidth < b.bandwidth; });
+  return !variants.empty();
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct M3U8Segment {
+  std::string url;
+  std::string localPath;
+  double duration;
+};
+
+// One rendition listed by a master playlist's #EXT-X-STREAM-INF
+struct M3U8Variant {
+  std::string url;
+  long bandwidth; // bits per second
+};
+
+class M3U8Parser {
+public:
+  // Accepts media playlists (segments) and master playlists (variants)
+  bool parseM3U8(const std::string& m3u8Path, const std::string& baseUrl = "");
+  bool downloadSegments(const std::string& cacheBasePath, size_t count = SIZE_MAX, size_t first = 0);
+  const std::vector<M3U8Segment>& getSegments() const { return segments_; }
+  const std::vector<M3U8Variant>& getVariants() const { return variants_; }
+  // #EXT-X-MEDIA-SEQUENCE: the sequence number of the first segment
+  uint64_t mediaSequence() const { return mediaSequence_; }
+  // #EXT-X-TARGETDURATION in seconds, 0 when absent
+  double targetDuration() const { return targetDuration_; }
+  // A media playlist without #EXT-X-ENDLIST, which the server keeps appending to
+  bool isLive() const { return !endList_ && variants_.empty(); }
+  
+private:
+  std::vector<M3U8Segment> segments_;
+  std::vector<M3U8Variant> variants_;
+  std::string baseUrl_;
+  uint64_t mediaSequence_ = 0;
+  double targetDuration_ = 0;
+  bool endList_ = false;
+};
+
+// Local path of the playlist `input`, downloading it into the cache first when it is a URL.
+// baseUrl receives what relative URIs in a remote playlist resolve against. `refresh` downloads
+// it even when cached; `downloaded` tells whether a download happened.
+bool fetchPlaylistFile(const std::string& input, std::string& m3u8Path, std::string& baseUrl,
+                       bool refresh = false, bool* downloaded = nullptr);
+// Fills `variants`, lowest bandwidth first, when `input` is an HLS master playlist.
+// False for media playlists, single files and playlists that can't be read.
+bool loadMasterPlaylist(const std::string& input, std::vector<M3U8Variant>& variants);
@@ -0,0 +1,99 @@
+#include "metrics_registry.h"
+
+#include <cstdio>
+#include <sstream>
+#include <unistd.h>
+
+#include "common/helper.h"
+
+static void appendHistogram(std::ostringstream& out, const char* name, const MetricHistogram& h) {
+  out << ",\"" << name << "\":{\"count\":" << h.count.get() << ",\"sum_us\":" << h.sumUs.get()
+      << ",\"buckets\":[";
+  for (size_t i = 0; i < METRIC_BUCKETS; ++i) {
+    out << (i ? "," : "") << h.buckets[i].get();
+  }
+  out << "]}";
+}
+
+std::string jsonEscape(const std::string& s) {
+  std::string out;
+  for (char c : s) {
+    switch (c) {
+      case '"':  out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      case '\b': out += "\\b"; break;
+      case '\f': out += "\\f"; break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char buf[8];
+          std::snprintf(buf, sizeof(buf), "\\u%04x", static_cast<unsigned char>(c));
+          out += buf;
+        } else {
+          out += c;
+        }
+    }
+  }
+  return out;
+}
+
+std::string MetricsRegistry::report() {
+  long rssPages = 0;
+  FILE* statm = fopen("/proc/self/statm", "r");
+  if (statm) {
+    if (fscanf(statm, "%*s %ld", &rssPages) != 1) rssPages = 0;
+    fclose(statm);
+  }
+
+  std::ostringstream out;
+  out << "{\"time_ms\":" << now_ms_t() << ",\"rss_kb\":" << rssPages * (sysconf(_SC_PAGESIZE) / 1024)
+      << ",\"bounds_us\":[";
+  for (size_t i = 0; i + 1 < METRIC_BUCKETS; ++i) {
+    out << (i ? "," : "") << kMetricBoundsUs[i];
+  }
+  out << "],\"segments\":{\"store_hits\":" << segments_.storeHits.get()
+      << ",\"store_misses\":" << segments_.storeMisses.get()
+      << ",\"cache_hits\":" << segments_.cacheHits.get()
+      << ",\"cache_invalid\":" << segments_.cacheInvalid.get()
+      << ",\"cache_evicted\":" << segments_.cacheEvicted.get()
+      << ",\"downloads\":" << segments_.downloads.get()
+      << ",\"download_failures\":" << segments_.downloadFailures.get()
+      << ",\"download_bytes\":" << segments_.downloadBytes.get()
+      << ",\"preloads_cancelled\":" << segments_.preloadsCancelled.get()
+      << ",\"live_reloads\":" << segments_.liveReloads.get()
+      << ",\"live_skips\":" << segments_.liveSkips.get()
+      << ",\"sync_skips\":" << segments_.syncSkips.get()
+      << ",\"peak_au_bytes\":" << segments_.peakAuBytes.get();
+  appendHistogram(out, "load_us", segments_.loadUs);
+  appendHistogram(out, "download_us", segments_.downloadUs);
+  out << "},\"streams\":[";
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  bool first = true;
+  for (auto it = streams_.begin(); it != streams_.end();) {
+    std::shared_ptr<StreamMetrics> stream = it->lock();
+    if (!stream) {
+      it = streams_.erase(it);
+      continue;
+    }
+    ++it;
+    out << (first ? "" : ",") << "{\"id\":\"" << jsonEscape(stream->streamId) << "\""
+        << ",\"frames\":" << stream->framesSent.get() << ",\"bytes\":" << stream->bytesSent.get()
+        << ",\"key_frames\":" << stream->keyFrames.get() << ",\"audio_frames\":" << stream->audioFramesSent.get()
+        << ",\"underruns\":" << stream->underruns.get()
+        << ",\"prefetch_depth\":" << stream->prefetchDepth.load(std::memory_order_relaxed);
+    out << ",\"startup_us\":{\"media\":" << stream->startup.mediaUs.load()
+        << ",\"service\":" << stream->startup.serviceUs.load()
+        << ",\"connect\":" << stream->startup.connectUs.load()
+        << ",\"first_frame\":" << stream->startup.firstFrameUs.load() << "}";
+    appendHistogram(out, "send_call_us", stream->sendCallUs);
+    appendHistogram(out, "lateness_us", stream->latenessUs);
+    appendHistogram(out, "switch_us", stream->switchUs);
+    out << "}";
+    first = false;
+  }
+  out << "]}\n";
+  return out.str();
+}
@@ -0,0 +1,145 @@
+#pragma once
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+// Log-spaced histogram buckets shared by every latency metric, upper bounds in microseconds;
+// the last bucket takes everything above.
+static const int64_t kMetricBoundsUs[] = {25, 50, 100, 250, 500, 1000, 2500, 5000, 10000,
+                                          25000, 50000, 100000, 250000, 1000000, 10000000};
+#define METRIC_BUCKETS (sizeof(kMetricBoundsUs) / sizeof(kMetricBoundsUs[0]) + 1)
+
+// Counters are relaxed atomics: no locks on the recording paths, and a reader sees each value
+// whole, which is all a periodic report needs.
+struct MetricCounter {
+  std::atomic<unsigned long long> value{0};
+  void add(unsigned long long n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+  unsigned long long get() const { return value.load(std::memory_order_relaxed); }
+};
+
+struct MetricHistogram {
+  MetricCounter buckets[METRIC_BUCKETS];
+  MetricCounter count;
+  MetricCounter sumUs;
+
+  void record(int64_t us) {
+    if (us < 0) us = 0;
+    size_t i = 0;
+    while (i + 1 < METRIC_BUCKETS && us > kMetricBoundsUs[i]) ++i;
+    buckets[i].add();
+    count.add();
+    sumUs.add(us);
+  }
+};
+
+// Largest value recorded
+struct MetricPeak {
+  std::atomic<unsigned long long> value{0};
+  void record(unsigned long long n) {
+    unsigned long long seen = value.load(std::memory_order_relaxed);
+    while (n > seen && !value.compare_exchange_weak(seen, n, std::memory_order_relaxed)) {
+    }
+  }
+  unsigned long long get() const { return value.load(std::memory_order_relaxed); }
+};
+
+// Written by one stream's send thread
+// Startup of a stream, whose phases overlap and end in any order: each one is the time from the
+// start to its end, 0 until it has ended
+struct StartupMetrics {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::atomic<int64_t> mediaUs{0};      // playlists loaded and their first segments indexed
+  std::atomic<int64_t> serviceUs{0};    // SDK service and media node factory created, 0 when shared
+  std::atomic<int64_t> connectUs{0};    // connection callback
+  std::atomic<int64_t> firstFrameUs{0}; // first video frame handed to the SDK
+
+  // Ends the phase, true the first time only
+  bool mark(std::atomic<int64_t>& phaseUs) {
+    int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    int64_t unset = 0;
+    return phaseUs.compare_exchange_strong(unset, std::max<int64_t>(us, 1));
+  }
+};
+
+struct StreamMetrics {
+  std::string streamId;
+  StartupMetrics startup;
+  MetricCounter framesSent;
+  MetricCounter bytesSent;
+  MetricCounter keyFrames;
+  MetricCounter audioFramesSent;
+  MetricHistogram sendCallUs;  // time spent inside sendEncodedVideoImage()
+  MetricHistogram latenessUs;  // how late frames left against their deadline
+  MetricHistogram switchUs;    // SWITCH_VIDEO / rendition switch to first frame sent
+  MetricCounter underruns;     // prefetch ring ran dry
+  std::atomic<size_t> prefetchDepth{0};
+};
+
+// Process-wide segment pipeline counters, bumped from fetch workers and prefetch readers
+struct SegmentMetrics {
+  MetricCounter storeHits;       // index served from the SegmentStore
+  MetricCounter storeMisses;     // segment parsed
+  MetricHistogram loadUs;        // mmap + index build time of a miss
+  MetricPeak peakAuBytes;        // largest access unit parsed
+  MetricCounter cacheHits;       // segment already in CACHE_BASE_PATH
+  MetricCounter cacheInvalid;    // cached file that failed its manifest check
+  MetricCounter cacheEvicted;    // files this process removed from CACHE_BASE_PATH over the budget
+  MetricCounter downloads;
+  MetricCounter downloadFailures;
+  MetricCounter downloadBytes;
+  MetricHistogram downloadUs;
+  MetricCounter preloadsCancelled; // superseded before it ran or before its result was published
+  MetricCounter liveReloads;     // live playlist refreshes that added segments
+  MetricCounter liveSkips;       // catch-ups to the live edge after falling behind
+  MetricCounter syncSkips;       // synchronized playback skipping ahead to a keyframe to stay on time
+};
+
+// Collects the metrics and, with --metricsFd, writes them as one JSON object per line
+// every interval so a supervisor can read them from a pipe instead of scraping stdout.
+class MetricsRegistry {
+public:
+  static MetricsRegistry& instance() {
+    static MetricsRegistry* registry = new MetricsRegistry(); // leaked, reporter thread may outlive main
+    return *registry;
+  }
+
+  SegmentMetrics& segments() { return segments_; }
+
+  // The stream stays in the report while the returned pointer is held
+  std::shared_ptr<StreamMetrics> addStream(const std::string& streamId) {
+    auto metrics = std::make_shared<StreamMetrics>();
+    metrics->streamId = streamId;
+    std::lock_guard<std::mutex> lock(mutex_);
+    streams_.push_back(metrics);
+    return metrics;
+  }
+
+  void startReporter(int fd, int intervalMs) {
+    std::thread([this, fd, intervalMs]() {
+      while (true) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(intervalMs));
+        std::string line = report();
+        if (write(fd, line.data(), line.size()) < 0 && errno == EPIPE) {
+          return;
+        }
+      }
+    }).detach();
+  }
+
+  // One JSON line with every metric
+  std::string report();
+
+private:
+  SegmentMetrics segments_;
+  std::mutex mutex_;
+  std::vector<std::weak_ptr<StreamMetrics>> streams_;
+};
+
+// Control characters are escaped too, so every value round-trips through a JSON parser
+std::string jsonEscape(const std::string& s);
@@ -0,0 +1,894 @@
+#include "playlist_manager.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <sys/stat.h>
+
+#include "common/helper.h"
+#include "disk_cache.h"
+#include "metrics_registry.h"
+#include "segment_store.h"
+#include "stream_util.h"
+
+// synchronized playback: a sync point read later than this skips ahead to the next keyframe
+#define SYNC_MAX_LATE_MS (200)
+
+bool PlaylistManager::isM3U8(const std::string& path) {
+  return path.size() >= 5 && path.substr(path.size() - 5) == ".m3u8";
+}
+
+bool PlaylistManager::isURL(const std::string& path) {
+  return path.find("http://") == 0 || path.find("https://") == 0;
+}
+
+std::string PlaylistManager::getCurrentVideoFile() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return current_.videoFile;
+}
+
+bool PlaylistManager::initialize(const std::string& input) {
+  PlaylistSource source;
+  if (!internalSetup(input, source)) {
+    return false;
+  }
+  
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    current_ = std::move(source);
+  }
+  currentSegmentIndex_ = current_.firstSegment;
+  playheadSegment_ = currentSegmentIndex_;
+  currentIndex_ = std::move(current_.firstIndex);
+  currentAu_ = current_.firstAu;
+  syncPending_ = current_.synced;
+  return true;
+}
+
+// Resolves `input` to local segment paths and indexes the first segment. "<video>@<ms>" starts
+// at the keyframe at or before that position, modulo the video's length.
+bool PlaylistManager::internalSetup(const std::string& input, PlaylistSource& source) {
+  source.videoFile = input;
+  source.startMs = source.keepPosition ? -1 : splitStartPosition(source.videoFile);
+  // A synchronized video starts where the epoch's timeline is now, unless told where to start
+  source.synced = syncEpochMs_ > 0 && source.startMs < 0 && !source.keepPosition && !source.queued;
+  if (source.synced) {
+    source.startMs = std::max<int64_t>(0, (int64_t)now_ms_t() - syncEpochMs_);
+  }
+  const std::string& video = source.videoFile;
+  bool success;
+  if (isM3U8(video)) {
+    success = internalSetupPlaylist(video, source);
+  } else {
+    success = internalSetupSingleFile(video, source);
+  }
+  if (!success) {
+    return false;
+  }
+  
+  // The lookahead segments download while the first one is being indexed
+  if (!source.isPlaylist) {
+    source.firstSegment = 0;
+  }
+  requestLookahead(source, source.firstSegment);
+  const std::string& firstPath = source.paths[source.firstSegment];
+  source.firstIndex = SegmentStore::instance().acquire(firstPath);
+  if (!source.firstIndex && !source.urls[source.firstSegment].empty() && !fileExists(firstPath) &&
+      downloadFile(source.urls[source.firstSegment], firstPath)) {
+    source.firstIndex = SegmentStore::instance().acquire(firstPath); // removed by its manifest check
+  }
+  if (!source.firstIndex) {
+    return false;
+  }
+  if (source.startMs >= 0) {
+    int64_t offset = source.startMs * 90;
+    if (!source.isPlaylist && source.firstIndex->duration() > 0) {
+      offset %= source.firstIndex->duration();
+    }
+    source.firstAu = source.firstIndex->keyFrameAt(offset);
+    printf("Starting %s at segment %zu, AU %zu\n", video.c_str(), source.firstSegment, source.firstAu);
+  }
+  
+  source.synced = source.synced && !source.live;
+  source.offsetsUs.assign(1, 0);
+  if (source.isPlaylist) {
+    for (size_t i = 0; i + 1 < source.durations.size(); ++i) {
+      source.offsetsUs.push_back(source.offsetsUs.back() + (int64_t)(source.durations[i] * 1000000));
+    }
+    source.lengthUs = source.offsetsUs.back() + (int64_t)(source.durations.back() * 1000000);
+  } else {
+    source.lengthUs = source.firstIndex->duration() * 1000 / 90;
+  }
+  source.synced = source.synced && source.lengthUs > 0;
+  return true;
+}
+
+bool PlaylistManager::internalSetupSingleFile(const std::string& path, PlaylistSource& source) {
+  source.isPlaylist = false;
+  source.paths.assign(1, path);
+  source.urls.assign(1, std::string());
+  source.fetches.assign(1, nullptr);
+  return true;
+}
+
+bool PlaylistManager::internalSetupPlaylist(const std::string& path, PlaylistSource& source) {
+  source.isPlaylist = true;
+  source.paths.clear();
+  source.urls.clear();
+  
+  std::string m3u8Path;
+  std::string baseUrl;
+  bool downloaded = false;
+  if (!fetchPlaylistFile(path, m3u8Path, baseUrl, false, &downloaded)) {
+    return false;
+  }
+  
+  // Parse M3U8
+  M3U8Parser parser;
+  if (!parser.parseM3U8(m3u8Path, baseUrl)) {
+    return false;
+  }
+  if (live_ && parser.isLive() && isURL(path) && !downloaded) {
+    // The cached copy of a live playlist is stale, its segments may be gone from the server
+    if (!fetchPlaylistFile(path, m3u8Path, baseUrl, true) || !parser.parseM3U8(m3u8Path, baseUrl)) {
+      return false;
+    }
+  }
+  if (!parser.getVariants().empty()) {
+    fprintf(stderr, "%s is a master playlist, pick one of its variants first\n", path.c_str());
+    return false;
+  }
+  if (parser.getSegments().empty()) {
+    return false;
+  }
+  
+  source.live = live_ && parser.isLive();
+  source.playlistPath = m3u8Path;
+  source.baseUrl = baseUrl;
+  source.targetDuration = parser.targetDuration() > 0 ? parser.targetDuration() : 1.0; // required when live
+  source.sequences.clear();
+  source.durations.clear();
+  source.cacheDir.clear();
+  if (isURL(path)) {
+    std::string cachePath = extractCachePath(path);
+    size_t lastSlash = cachePath.find_last_of('/');
+    source.cacheDir = std::string(CACHE_BASE_PATH) + "/" + 
+                      (lastSlash != std::string::npos ? cachePath.substr(0, lastSlash) : cachePath);
+  }
+  
+  if (source.startMs >= 0 && !source.live) {
+    // The segment the position falls in by the #EXTINF durations, the rest is the offset into it
+    double total = 0;
+    for (const auto& segment : parser.getSegments()) {
+      total += segment.duration;
+    }
+    int64_t ms = total > 0 ? source.startMs % std::max<int64_t>(1, (int64_t)(total * 1000)) : 0;
+    source.firstSegment = 0;
+    for (const auto& segment : parser.getSegments()) {
+      int64_t length = (int64_t)(segment.duration * 1000);
+      if (ms < length || source.firstSegment + 1 == parser.getSegments().size()) {
+        break;
+      }
+      ms -= length;
+      ++source.firstSegment;
+    }
+    source.startMs = ms;
+  } else if (source.live) {
+    source.startMs = -1; // a live stream starts at its live edge
+  }
+  size_t first = std::min(source.firstSegment, parser.getSegments().size() - 1);
+  if (source.live) {
+    // Join at the live edge; segments older than it are never played
+    PlaylistSource window;
+    for (const auto& segment : parser.getSegments()) {
+      window.durations.push_back(segment.duration);
+    }
+    window.targetDuration = source.targetDuration;
+    first = liveEdgeSegment(window);
+  }
+  
+  // Download segments if needed, only the first one when the rest can follow progressively
+  if (!source.cacheDir.empty()) {
+    bool progressive = lookahead_ > 0 || source.live;
+    if (!parser.downloadSegments(source.cacheDir, progressive ? 1 : SIZE_MAX, progressive ? first : 0)) {
+      return false;
+    }
+  }
+  
+  // Set up segment paths
+  const std::vector<M3U8Segment>& segments = parser.getSegments();
+  for (size_t i = source.live ? first : 0; i < segments.size(); ++i) {
+    addSegment(source, segments[i], parser.mediaSequence() + i);
+  }
+  source.fetches.assign(source.paths.size(), nullptr);
+  source.firstSegment = source.live ? 0 : source.firstSegment % source.paths.size();
+  if (source.live) {
+    source.nextReload = std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds((int64_t)(source.targetDuration * 1000));
+    printf("Live playlist %s: joining at sequence %llu, %zu segments behind its end\n", path.c_str(),
+           (unsigned long long)source.sequences.front(), source.paths.size());
+  }
+  
+  return true;
+}
+
+// Appends `segment` to the source: its cache path when the playlist is remote (localPath set by
+// downloadSegments()), its path relative to the playlist's location when local
+void PlaylistManager::addSegment(PlaylistSource& source, const M3U8Segment& segment, uint64_t sequence) {
+  if (!source.cacheDir.empty()) {
+    source.paths.push_back(segment.localPath);
+    source.urls.push_back(segment.url);
+  } else {
+    // Local M3U8 - segments are relative to M3U8 location
+    std::string segmentPath = segment.url;
+    if (segmentPath.find('/') != 0) { // Relative path
+      size_t lastSlash = source.playlistPath.find_last_of('/');
+      if (lastSlash != std::string::npos) {
+        segmentPath = source.playlistPath.substr(0, lastSlash + 1) + segmentPath;
+      }
+    }
+    source.paths.push_back(segmentPath);
+    source.urls.push_back(std::string());
+  }
+  source.sequences.push_back(sequence);
+  source.durations.push_back(segment.duration);
+}
+
+// Starts downloads for the `lookahead_` segments after `from` that are neither cached nor in flight.
+// A live source fetches every segment up to its end: those are the latency buffer.
+void PlaylistManager::requestLookahead(PlaylistSource& source, size_t from) {
+  size_t count = source.paths.size();
+  size_t ahead = source.live ? count - 1 - std::min(from, count - 1) : lookahead_;
+  for (size_t k = 1; k <= ahead && k < count; ++k) {
+    size_t i = (from + k) % count;
+    if (source.urls[i].empty() || source.fetches[i] || DiskCache::instance().lookup(source.paths[i])) {
+      continue;
+    }
+    source.fetches[i] = SegmentFetcher::instance().submit(
+        std::vector<FetchJob>(1, FetchJob{source.urls[i], source.paths[i]}));
+  }
+}
+
+// Moves the playhead to the next downloaded segment; false while that one is still in flight
+bool PlaylistManager::advanceSegment() {
+  size_t count = current_.paths.size();
+  size_t next = currentSegmentIndex_;
+  for (size_t tries = 1; tries < count; ++tries) {
+    next = (next + 1) % count;
+    std::shared_ptr<FetchBatch>& fetch = current_.fetches[next];
+    if (fetch) {
+      if (!fetch->isDone()) {
+        return false;
+      }
+      bool fetched = fetch->wait();
+      fetch.reset(); // a failed segment is requested again by a later lookahead
+      if (!fetched) {
+        fprintf(stderr, "Skipping segment %zu, download failed: %s\n", next, current_.urls[next].c_str());
+        continue;
+      }
+    }
+    
+    // Move to next segment, indexed on its first play and served from the store afterwards
+    currentSegmentIndex_ = next;
+    playheadSegment_ = next;
+    printf("Switching to segment %zu: %s\n", currentSegmentIndex_, current_.paths[currentSegmentIndex_].c_str());
+    break;
+  }
+  
+  // If every other segment failed the playhead stays put, replaying while they are retried
+  requestLookahead(current_, currentSegmentIndex_);
+  // The one after plays next: have it in the page cache by the time it is indexed
+  const std::string& after = current_.paths[(currentSegmentIndex_ + 1) % count];
+  if (count > 1 && !SegmentStore::instance().resident(after)) {
+    DiskCache::prewarm(after);
+  }
+  return true;
+}
+
+// How far behind a live playlist's end playback runs, in seconds
+double PlaylistManager::liveLatency(const PlaylistSource& source) const {
+  return liveLatencyMs_ > 0 ? liveLatencyMs_ / 1000.0 : 3 * source.targetDuration;
+}
+
+// The latest segment that starts at least liveLatency() before the live playlist's end
+size_t PlaylistManager::liveEdgeSegment(const PlaylistSource& source) const {
+  double latency = liveLatency(source);
+  double buffered = 0;
+  for (size_t i = source.durations.size(); i-- > 0;) {
+    buffered += source.durations[i];
+    if (buffered >= latency) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+// Re-parses the live playlist's local copy and appends the segments it gained; true if any.
+// One that gained #EXT-X-ENDLIST plays on as an ordinary playlist.
+bool PlaylistManager::reloadLivePlaylist() {
+  M3U8Parser parser;
+  if (!parser.parseM3U8(current_.playlistPath, current_.baseUrl)) {
+    return false;
+  }
+  if (!current_.cacheDir.empty()) {
+    parser.downloadSegments(current_.cacheDir, 0); // resolves the cache paths only
+  }
+  if (parser.targetDuration() > 0) {
+    current_.targetDuration = parser.targetDuration();
+  }
+  
+  const std::vector<M3U8Segment>& segments = parser.getSegments();
+  uint64_t last = current_.sequences.back();
+  size_t added = 0;
+  for (size_t i = 0; i < segments.size(); ++i) {
+    uint64_t sequence = parser.mediaSequence() + i;
+    if (sequence <= last) {
+      continue;
+    }
+    if (added == 0 && sequence > last + 1) {
+      LOGF("Live playlist %s: segments %llu to %llu left the window before they were seen",
+           current_.videoFile.c_str(), (unsigned long long)last + 1, (unsigned long long)sequence - 1);
+    }
+    addSegment(current_, segments[i], sequence);
+    current_.fetches.push_back(nullptr);
+    ++added;
+  }
+  if (added) {
+    MetricsRegistry::instance().segments().liveReloads.add();
+  }
+  if (!parser.isLive()) {
+    current_.live = false;
+    LOGF("Live playlist %s ended, playing on as VOD", current_.videoFile.c_str());
+  }
+  return added > 0;
+}
+
+// Reader thread, per frame of a live source: refreshes its playlist when due and starts
+// downloading the segments that appeared. A remote reload runs on the fetcher's workers and is
+// picked up by a later call, so sending never waits for it.
+void PlaylistManager::pollLive() {
+  auto now = std::chrono::steady_clock::now();
+  bool added = false;
+  if (current_.reload) {
+    if (!current_.reload->isDone()) {
+      return;
+    }
+    bool fetched = current_.reload->wait();
+    current_.reload.reset();
+    added = fetched && reloadLivePlaylist();
+  } else if (now < current_.nextReload) {
+    return;
+  } else if (!current_.cacheDir.empty()) {
+    current_.reload = SegmentFetcher::instance().submit(
+        std::vector<FetchJob>(1, FetchJob{current_.videoFile, current_.playlistPath}));
+    return;
+  } else {
+    added = reloadLivePlaylist();
+  }
+  
+  // RFC 8216 6.3.4: reload after a target duration, or half of one when nothing changed
+  current_.nextReload = now + std::chrono::milliseconds((int64_t)(current_.targetDuration * (added ? 1000 : 500)));
+  if (added) {
+    requestLookahead(current_, currentSegmentIndex_);
+  }
+}
+
+// advanceSegment() for a live source: moves to the following segment without wrapping, or to the
+// live edge when more than a target duration beyond the latency has piled up ahead, then drops
+// the played segments. False at the live edge and while the next segment is still in flight.
+bool PlaylistManager::advanceLiveSegment() {
+  size_t count = current_.paths.size();
+  size_t next = currentSegmentIndex_ + 1;
+  double buffered = 0;
+  for (size_t i = next; i < count; ++i) {
+    buffered += current_.durations[i];
+  }
+  size_t edge = liveEdgeSegment(current_);
+  if (edge > next && buffered > liveLatency(current_) + current_.targetDuration) {
+    LOGF("Live playback %.1f s behind %s, skipping %zu segments to the live edge", buffered,
+         current_.videoFile.c_str(), edge - next);
+    MetricsRegistry::instance().segments().liveSkips.add();
+    next = edge;
+    needKeyFrame_ = true;
+    rebase_ = true; // the output timeline carries on across the skipped stretch
+  }
+  
+  for (; next < count; ++next) {
+    std::shared_ptr<FetchBatch>& fetch = current_.fetches[next];
+    if (!fetch) {
+      break;
+    }
+    if (!fetch->isDone()) {
+      return false;
+    }
+    bool fetched = fetch->wait();
+    fetch.reset();
+    if (fetched) {
+      break;
+    }
+    fprintf(stderr, "Skipping live segment %llu, download failed: %s\n",
+            (unsigned long long)current_.sequences[next], current_.urls[next].c_str());
+  }
+  if (next >= count) {
+    return false; // waiting for the playlist to grow
+  }
+  
+  current_.paths.erase(current_.paths.begin(), current_.paths.begin() + next);
+  current_.urls.erase(current_.urls.begin(), current_.urls.begin() + next);
+  current_.fetches.erase(current_.fetches.begin(), current_.fetches.begin() + next);
+  current_.sequences.erase(current_.sequences.begin(), current_.sequences.begin() + next);
+  current_.durations.erase(current_.durations.begin(), current_.durations.begin() + next);
+  currentSegmentIndex_ = 0;
+  playheadSegment_ = 0;
+  printf("Switching to live segment %llu: %s\n", (unsigned long long)current_.sequences[0],
+         current_.paths[0].c_str());
+  requestLookahead(current_, 0);
+  return true;
+}
+
+void PlaylistManager::claimPreload(std::shared_ptr<const PreloadTicket> ticket) {
+  std::lock_guard<std::mutex> lock(preloadMutex_);
+  claimed_ = std::move(ticket);
+  delete ready_.exchange(nullptr, std::memory_order_acq_rel);
+}
+
+bool PlaylistManager::warmPlaylist(const std::string& input, const PreloadTicket* ticket) {
+  PlaylistSource source;
+  if (!internalSetup(input, source)) {
+    return false;
+  }
+  size_t count = lookahead_ > 0 ? std::min(source.paths.size(), lookahead_ + 1) : source.paths.size();
+  for (size_t k = 1; k < count && !(ticket && ticket->cancelled()); ++k) {
+    size_t i = (source.firstSegment + k) % source.paths.size();
+    if (source.fetches[i] && !source.fetches[i]->wait()) {
+      continue;
+    }
+    SegmentStore::instance().acquire(source.paths[i]);
+  }
+  return true;
+}
+
+bool PlaylistManager::preloadNewPlaylist(const std::string& input, bool keepPosition,
+                                         const PreloadTicket* ticket) {
+  printf("Preloading new playlist: %s\n", input.c_str());
+  
+  // Setup new playlist in background (without holding the main mutex for too long)
+  PlaylistSource source;
+  if (keepPosition) {
+    source.keepPosition = true;
+    source.firstSegment = playheadSegment_.load();
+  }
+  bool success = internalSetup(input, source);
+  
+  if (success) {
+    std::lock_guard<std::mutex> lock(preloadMutex_);
+    if (ticket && (ticket != claimed_.get() || ticket->cancelled())) {
+      printf("Dropping superseded preload: %s\n", input.c_str());
+      MetricsRegistry::instance().segments().preloadsCancelled.add();
+      return false;
+    }
+    source.readyTime = std::chrono::steady_clock::now();
+    // A newer preload replaces one that was never switched to
+    delete ready_.exchange(new PlaylistSource(std::move(source)), std::memory_order_acq_rel);
+    printf("New playlist preloaded and ready for switching\n");
+  }
+  
+  return success;
+}
+
+bool PlaylistManager::switchToNewPlaylist(SwitchCut cut, std::chrono::steady_clock::time_point* readyTime) {
+  if (!ready_.load(std::memory_order_acquire)) {
+    return false;
+  }
+  
+  // A segment end counts as a boundary: HLS segments start on an IDR
+  if (cut == CUT_AT_GOP && currentIndex_ && currentAu_ > 0 && currentAu_ < currentIndex_->size() &&
+      !currentIndex_->at(currentAu_).isKeyFrame) {
+    return false;
+  }
+  std::unique_ptr<PlaylistSource> next(ready_.exchange(nullptr, std::memory_order_acq_rel));
+  
+  // Switch to new playlist, its first segment was indexed during preload
+  size_t segment = next->firstSegment;
+  std::shared_ptr<const TsSegmentIndex> index = next->firstIndex;
+  size_t au = next->firstAu;
+  // A live rendition starts at its own live edge
+  if (next->keepPosition && !next->live && !alignToPlayhead(*next, segment, index, au)) {
+    // The rendition's segment at the playhead isn't local yet, retried at the next keyframe
+    PlaylistSource* none = nullptr;
+    if (ready_.compare_exchange_strong(none, next.get(), std::memory_order_acq_rel)) {
+      next.release();
+    }
+    return false;
+  }
+  if (readyTime) {
+    *readyTime = next->readyTime;
+  }
+  
+  printf("Switching to new playlist: %s\n", next->videoFile.c_str());
+  if (next->keepPosition) {
+    next->synced = current_.synced && next->lengthUs > 0; // another rendition stays on the same timeline
+  }
+  
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    current_ = std::move(*next);
+  }
+  current_.firstIndex.reset();
+  currentSegmentIndex_ = segment;
+  playheadSegment_ = segment;
+  currentIndex_ = std::move(index);
+  currentAu_ = au;
+  needKeyFrame_ = true;
+  timestampOffset_ = 0;
+  lastDts_ = -1;
+  lastStep_ = 0;
+  rebase_ = false;
+  syncPending_ = current_.synced;
+  requestLookahead(current_, segment);
+  
+  printf("Successfully switched to: %s\n", current_.videoFile.c_str());
+  return true;
+}
+
+// Finds where `next` continues the current playhead: the same segment number (the following
+// one at a segment end) and the keyframe closest to the same offset into it. False while that
+// segment is still downloading.
+bool PlaylistManager::alignToPlayhead(PlaylistSource& next, size_t& segment,
+                                      std::shared_ptr<const TsSegmentIndex>& index, size_t& au) {
+  size_t target = currentSegmentIndex_;
+  int64_t offset = 0;
+  if (currentIndex_ && currentAu_ < currentIndex_->size()) {
+    if (currentIndex_->at(currentAu_).pts >= 0 && currentIndex_->at(0).pts >= 0) {
+      offset = currentIndex_->at(currentAu_).pts - currentIndex_->at(0).pts;
+    }
+  } else if (!current_.paths.empty()) {
+    target = (target + 1) % current_.paths.size();
+  }
+  target %= next.paths.size();
+  
+  std::shared_ptr<const TsSegmentIndex> found;
+  if (target == next.firstSegment) {
+    found = next.firstIndex;
+  } else if (DiskCache::instance().lookup(next.paths[target])) {
+    found = SegmentStore::instance().acquire(next.paths[target]);
+  } else {
+    std::shared_ptr<FetchBatch>& fetch = next.fetches[target];
+    if (!next.urls[target].empty() && (!fetch || fetch->isDone())) {
+      fetch = SegmentFetcher::instance().submit(
+          std::vector<FetchJob>(1, FetchJob{next.urls[target], next.paths[target]}));
+    }
+    return false;
+  }
+  if (!found || found->size() == 0) {
+    return false;
+  }
+  
+  au = 0;
+  int64_t best = INT64_MAX;
+  for (size_t i = 0; i < found->size(); ++i) {
+    const TsAccessUnit& candidate = found->at(i);
+    if (!candidate.isKeyFrame || candidate.pts < 0 || found->at(0).pts < 0) {
+      continue;
+    }
+    int64_t distance = std::llabs(candidate.pts - found->at(0).pts - offset);
+    if (distance < best) {
+      best = distance;
+      au = i;
+    }
+  }
+  segment = target;
+  index = std::move(found);
+  return true;
+}
+
+std::unique_ptr<HelperH264Frame> PlaylistManager::getNextFrame() {
+  if (current_.paths.empty()) {
+    return nullptr;
+  }
+  if (current_.live) {
+    pollLive();
+  }
+  
+  if (!currentIndex_ || currentAu_ >= currentIndex_->size()) {
+    // Current segment ended; after the video's last one, a preloaded queued video follows.
+    // A live video has no last segment until its playlist ends.
+    bool videoEnded = currentIndex_ && !current_.live && currentSegmentIndex_ + 1 >= current_.paths.size();
+    if (videoEnded && startQueued()) {
+      // starts at its first segment, indexed by its preload
+    } else if (current_.live) {
+      // Without an index the current segment is still being fetched again, see below
+      if (currentIndex_ && !advanceLiveSegment()) {
+        return nullptr; // at the live edge or the next segment still downloading, retried
+      }
+    } else if (current_.isPlaylist && current_.paths.size() > 1) {
+      if (!advanceSegment()) {
+        return nullptr; // next segment still downloading, the send loop retries
+      }
+    }
+    rebase_ = rebase_ || videoEnded;
+  }
+  if (!currentIndex_ || currentAu_ >= currentIndex_->size()) {
+    // Single file - restart, re-indexing only if the file changed on disk
+    std::shared_ptr<FetchBatch>& fetch = current_.fetches[currentSegmentIndex_];
+    if (fetch && !fetch->isDone()) {
+      return nullptr; // downloading again, see below
+    }
+    fetch.reset();
+    bool hadIndex = currentIndex_ != nullptr;
+    NalCodec previousCodec = hadIndex ? currentIndex_->codec() : NAL_CODEC_H264;
+    currentIndex_ = SegmentStore::instance().acquire(current_.paths[currentSegmentIndex_]);
+    currentAu_ = 0;
+    if (!currentIndex_) {
+      // A cached file that failed its manifest check was removed, or another process evicted it
+      if (!current_.urls[currentSegmentIndex_].empty() && !fileExists(current_.paths[currentSegmentIndex_])) {
+        fetch = SegmentFetcher::instance().submit(std::vector<FetchJob>(
+            1, FetchJob{current_.urls[currentSegmentIndex_], current_.paths[currentSegmentIndex_]}));
+      }
+      return nullptr;
+    }
+    if (hadIndex && currentIndex_->codec() != previousCodec) {
+      // The receiver's decoder restarts on the new codec: begin at a keyframe with parameter sets
+      LOGF("Codec changes to %s at %s", nalCodecName(currentIndex_->codec()),
+           current_.paths[currentSegmentIndex_].c_str());
+      needKeyFrame_ = true;
+    }
+  }
+  
+  if (keyFrameRequested_.load(std::memory_order_relaxed) && keyFrameRequested_.exchange(false)) {
+    answerIntraRequest();
+  }
+  
+  if (current_.synced && (syncPending_ || currentAu_ == 0) && !syncPlayhead()) {
+    return nullptr; // too late for the rest of the segment, the next one is due next
+  }
+  
+  if (needKeyFrame_) {
+    return startAtKeyFrame();
+  }
+  
+  const TsAccessUnit& au = currentIndex_->at(currentAu_++);
+  std::unique_ptr<HelperH264Frame> frame(
+      new HelperH264Frame(au.isKeyFrame, currentIndex_->data(au), au.size, au.pts, au.dts));
+  frame->codec = currentIndex_->codec();
+  frame->owner = currentIndex_;
+  attachAudio(*frame, au);
+  stampTimestamps(*frame);
+  return frame;
+}
+
+// Sync point of a synchronized source: its start and every segment's first frame. Sets the
+// frame's due time: that of its position on the epoch's timeline, in the repetition nearest now
+// (or the first, before the epoch). A sync point read more than SYNC_MAX_LATE_MS late skips
+// ahead to the next keyframe that is still on time; false when none is left in the segment.
+bool PlaylistManager::syncPlayhead() {
+  if (currentIndex_->at(0).dts < 0) {
+    return true; // no timestamps to place it by
+  }
+  const int64_t epochUs = syncEpochMs_ * 1000;
+  const int64_t lengthUs = current_.lengthUs;
+  int64_t nowUs = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  size_t au = needKeyFrame_ ? currentIndex_->nextKeyFrame(currentAu_) : currentAu_;
+  if (au == SIZE_MAX) {
+    au = currentAu_; // no IDR, starts mid-GOP
+  }
+  bool skipped = false;
+  while (au != SIZE_MAX) {
+    int64_t position = current_.offsetsUs[std::min(currentSegmentIndex_, current_.offsetsUs.size() - 1)] +
+                       currentIndex_->decodeOffset(au) * 1000 / 90;
+    int64_t dueUs = epochUs + position;
+    if (nowUs > epochUs) {
+      int64_t delta = position - (nowUs - epochUs) % lengthUs;
+      if (delta >= lengthUs / 2) {
+        delta -= lengthUs;
+      } else if (delta < -lengthUs / 2) {
+        delta += lengthUs;
+      }
+      dueUs = nowUs + delta;
+    }
+    if (dueUs >= nowUs - SYNC_MAX_LATE_MS * 1000LL) {
+      if (skipped) {
+        MetricsRegistry::instance().segments().syncSkips.add();
+        LOGF("Synchronized start skips %zu frames of %s to stay on time", au - currentAu_,
+             current_.paths[currentSegmentIndex_].c_str());
+        currentAu_ = au;
+        needKeyFrame_ = true;
+      }
+      syncPending_ = false;
+      syncDueUs_ = dueUs;
+      return true;
+    }
+    au = currentIndex_->nextKeyFrame(au + 1);
+    skipped = true;
+  }
+  MetricsRegistry::instance().segments().syncSkips.add();
+  currentAu_ = currentIndex_->size();
+  needKeyFrame_ = true;
+  syncPending_ = true;
+  return false;
+}
+
+// Moves the output timeline's offset so the first frame after a loop or of a queued video comes
+// one frame step after the last one, then shifts the frame onto it
+void PlaylistManager::stampTimestamps(HelperH264Frame& frame) {
+  const int64_t wrap = (1LL << 33) - 1;
+  if (rebase_) {
+    rebase_ = false;
+    if (frame.dts >= 0 && lastDts_ >= 0 && lastStep_ > 0) {
+      timestampOffset_ = (lastDts_ + lastStep_ - frame.dts) & wrap;
+    }
+  }
+  if (startsQueued_) {
+    startsQueued_ = false;
+    frame.startsQueued = true;
+    frame.queuedId = queuedId_;
+  }
+  frame.dueUs = syncDueUs_;
+  syncDueUs_ = 0;
+  if (frame.dts < 0) {
+    return;
+  }
+  frame.timestampOffset = timestampOffset_;
+  frame.dts = (frame.dts + timestampOffset_) & wrap;
+  if (frame.pts >= 0) {
+    frame.pts = (frame.pts + timestampOffset_) & wrap;
+  }
+  int64_t step = lastDts_ >= 0 ? (frame.dts - lastDts_) & wrap : 0;
+  if (step > 0 && step <= 90000) {
+    lastStep_ = step;
+  }
+  lastDts_ = frame.dts;
+}
+
+std::shared_ptr<QueuedVideo> PlaylistManager::enqueue(const std::string& input, uint64_t id) {
+  std::shared_ptr<QueuedVideo> entry = std::make_shared<QueuedVideo>();
+  entry->videoFile = input;
+  entry->id = id;
+  entry->ticket = std::make_shared<PreloadTicket>();
+  std::lock_guard<std::mutex> lock(queueMutex_);
+  queue_.push_back(entry);
+  return entry;
+}
+
+std::unique_ptr<PlaylistSource> PlaylistManager::prepareQueued(const std::string& input) {
+  std::unique_ptr<PlaylistSource> source(new PlaylistSource());
+  source->queued = true;
+  if (!internalSetup(input, *source)) {
+    return nullptr;
+  }
+  source->readyTime = std::chrono::steady_clock::now();
+  return source;
+}
+
+void PlaylistManager::fillQueued(QueuedVideo& entry, std::unique_ptr<PlaylistSource> source) {
+  std::lock_guard<std::mutex> lock(queueMutex_);
+  entry.failed = !source;
+  entry.source = std::move(source);
+}
+
+std::vector<std::shared_ptr<QueuedVideo>> PlaylistManager::clearQueue() {
+  std::lock_guard<std::mutex> lock(queueMutex_);
+  std::vector<std::shared_ptr<QueuedVideo>> removed;
+  for (const auto& entry : queue_) {
+    entry->ticket->cancel();
+    if (!entry->failed) {
+      removed.push_back(entry); // failed ones were already answered
+    }
+  }
+  queue_.clear();
+  return removed;
+}
+
+// Reader thread, at the current video's end: makes the queue's front current once it is
+// preloaded. Entries whose preload failed are skipped.
+bool PlaylistManager::startQueued() {
+  std::shared_ptr<QueuedVideo> entry;
+  {
+    std::lock_guard<std::mutex> lock(queueMutex_);
+    while (!queue_.empty() && queue_.front()->failed) {
+      queue_.pop_front();
+    }
+    if (queue_.empty() || !queue_.front()->source) {
+      return false; // loops the current video once more
+    }
+    entry = queue_.front();
+    queue_.pop_front();
+  }
+  
+  printf("Playing queued video: %s\n", entry->source->videoFile.c_str());
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    current_ = std::move(*entry->source);
+  }
+  currentSegmentIndex_ = current_.firstSegment;
+  playheadSegment_ = currentSegmentIndex_;
+  currentIndex_ = std::move(current_.firstIndex);
+  currentAu_ = current_.firstAu;
+  needKeyFrame_ = true; // its first AU, with parameter sets if the IDR lacks them
+  startsQueued_ = true;
+  queuedId_ = entry->id;
+  requestLookahead(current_, currentSegmentIndex_);
+  return true;
+}
+
+// Audio rides on the video frames, so loops, switches and keyframe jumps keep both in step
+void PlaylistManager::attachAudio(HelperH264Frame& frame, const TsAccessUnit& au) {
+  if (!au.audioCount) {
+    return;
+  }
+  frame.audio = currentIndex_->audio(au);
+  frame.audioCount = au.audioCount;
+  frame.audioData = currentIndex_->audioData();
+  frame.owner = currentIndex_; // also when the video bytes are pooled
+}
+
+// Moves the playhead ahead to the next IDR in the current segment, so a joining or recovering
+// subscriber gets a decodable frame now instead of at the end of the GOP. Only ever forward, so
+// viewers already watching never see content replayed, and rebased: the IDR goes out one frame
+// step after the last frame, so the output timestamps stay monotonic across the skipped stretch.
+void PlaylistManager::answerIntraRequest() {
+  if (intraRefreshMs_ <= 0 || currentAu_ >= currentIndex_->size() ||
+      currentIndex_->at(currentAu_).isKeyFrame || needKeyFrame_) {
+    return; // ignored, or an IDR goes out next anyway
+  }
+  
+  auto now = std::chrono::steady_clock::now();
+  if (now - lastIntraRefresh_ < std::chrono::milliseconds(intraRefreshMs_)) {
+    ++suppressedIntraRequests_;
+    return;
+  }
+  
+  size_t target = currentIndex_->nextKeyFrame(currentAu_);
+  if (target == SIZE_MAX) {
+    return; // the next segment starts with one
+  }
+  
+  LOGF("Intra request: skipping %zu frames to IDR %zu of %s (%u throttled since last)",
+       target - currentAu_, target, current_.paths[currentSegmentIndex_].c_str(),
+       suppressedIntraRequests_);
+  lastIntraRefresh_ = now;
+  suppressedIntraRequests_ = 0;
+  currentAu_ = target;
+  needKeyFrame_ = true; // sent with parameter sets like the first frame of a source
+  rebase_ = true;       // the output timeline carries on across the skipped stretch
+}
+
+// First frame of a new source: skip to its first IDR so viewers never decode from mid-GOP,
+// prepending the segment's SPS/PPS when that IDR does not carry them in-band
+std::unique_ptr<HelperH264Frame> PlaylistManager::startAtKeyFrame() {
+  needKeyFrame_ = false;
+  
+  size_t key = currentIndex_->nextKeyFrame(currentAu_);
+  if (key == SIZE_MAX) {
+    LOGF("No IDR in %s, starting mid-GOP", current_.paths[currentSegmentIndex_].c_str());
+  } else {
+    currentAu_ = key;
+  }
+  
+  const TsAccessUnit& au = currentIndex_->at(currentAu_++);
+  const std::vector<uint8_t>& paramSets = currentIndex_->paramSets();
+  std::unique_ptr<HelperH264Frame> frame;
+  if (au.isKeyFrame && !au.hasParamSets && !paramSets.empty()) {
+    // Parameter sets go after a leading access unit delimiter, which must stay first
+    const uint8_t* data = currentIndex_->data(au);
+    size_t audEnd = 0;
+    forEachNalUnit(currentIndex_->codec(), data, au.size, [&](uint8_t type, size_t, size_t end) {
+      if (nalTypeFlags(currentIndex_->codec(), type) & NAL_FLAG_AUD) audEnd = end;
+      return false;
+    });
+    
+    PooledAuBuffer pooled(AuBufferPool::instance().acquire(paramSets.size() + au.size));
+    std::memcpy(pooled.get(), data, audEnd);
+    std::memcpy(pooled.get() + audEnd, paramSets.data(), paramSets.size());
+    std::memcpy(pooled.get() + audEnd + paramSets.size(), data + audEnd, au.size - audEnd);
+    frame.reset(new HelperH264Frame(true, pooled.get(), paramSets.size() + au.size, au.pts, au.dts));
+    frame->pooled = std::move(pooled);
+  } else {
+    frame.reset(new HelperH264Frame(au.isKeyFrame, currentIndex_->data(au), au.size, au.pts, au.dts));
+    frame->owner = currentIndex_;
+  }
+  frame->codec = currentIndex_->codec();
+  attachAudio(*frame, au);
+  stampTimestamps(*frame);
+  return frame;
+}
@@ -0,0 +1,191 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "m3u8_parser.h"
+#include "preload_executor.h"
+#include "segment_fetcher.h"
+#include "segment_index.h"
+#include "stream_frame.h"
+
+#define DEFAULT_LIVE_LATENCY_MS (0)
+
+// A resolved video: local segment paths plus, for segments still on the CDN, where to fetch them
+struct PlaylistSource {
+  std::string videoFile;
+  std::vector<std::string> paths;
+  std::vector<std::string> urls;                    // remote URL per segment, empty when local
+  std::vector<std::shared_ptr<FetchBatch>> fetches; // in-flight lookahead download per segment
+  bool isPlaylist = false;
+  size_t firstSegment = 0;                          // segment firstIndex belongs to
+  std::shared_ptr<const TsSegmentIndex> firstIndex;
+  size_t firstAu = 0;                               // where in firstIndex playback starts
+  int64_t startMs = -1;                             // "<video>@<ms>": ms into firstSegment once set up
+  bool keepPosition = false;                        // cut in at the playhead's position, not at the start
+  bool queued = false;                              // from the playback queue, follows on from the video before
+  // Synchronized playback: the source plays on the epoch's timeline, which repeats every lengthUs
+  bool synced = false;
+  std::vector<int64_t> offsetsUs;                   // where each segment starts in the video
+  int64_t lengthUs = 0;
+  std::chrono::steady_clock::time_point readyTime; // when preloading finished
+  // Live playlists: refreshed while playing, the played segments dropped from the front
+  bool live = false;
+  std::string playlistPath;                         // local copy of the playlist, reloaded in place
+  std::string baseUrl;
+  std::string cacheDir;                             // where remote segments go, empty when local
+  std::vector<uint64_t> sequences;                  // media sequence number per segment
+  std::vector<double> durations;                    // #EXTINF seconds per segment
+  double targetDuration = 0;
+  std::shared_ptr<FetchBatch> reload;               // playlist download in flight
+  std::chrono::steady_clock::time_point nextReload;
+};
+
+// Where a switch may cut into the current source
+enum SwitchCut {
+  CUT_NOW,    // at the next frame
+  CUT_AT_GOP, // where the current source's next frame is a keyframe
+};
+
+// One entry of PlaylistManager's playback queue. The preload fills in `source` off the reader
+// thread; until then the reader keeps looping the current video.
+struct QueuedVideo {
+  std::string videoFile;
+  uint64_t id = 0;                      // control request answered when it starts
+  std::shared_ptr<PreloadTicket> ticket; // cancelled when the queue is cleared
+  std::unique_ptr<PlaylistSource> source;
+  bool failed = false;
+};
+
+class PlaylistManager {
+public:
+  // lookahead > 0 starts remote playlists once segment 0 is cached and keeps that many
+  // segments downloading ahead of the playhead; 0 downloads the whole playlist up front
+  explicit PlaylistManager(size_t lookahead = 0) : lookahead_(lookahead) {}
+  ~PlaylistManager() { delete ready_.exchange(nullptr); }
+
+  // Intra requests are answered by jumping to the nearest IDR at most once per interval; 0 ignores them
+  void setIntraRefreshInterval(int ms) { intraRefreshMs_ = ms; }
+  // Plays playlists without #EXT-X-ENDLIST as live: starts latencyMs behind their end (0 = three
+  // target durations), refreshes them while playing and skips ahead instead of falling behind
+  void setLive(bool enabled, int latencyMs) {
+    live_ = enabled;
+    liveLatencyMs_ = latencyMs;
+  }
+  // Plays videos on a timeline shared with other processes, position 0 at epochMs (Unix time)
+  // and repeating every video length: each one starts where the timeline is when it is set up,
+  // and the first frame of every segment carries its due time. 0 turns it off.
+  void setSyncEpoch(int64_t epochMs) { syncEpochMs_ = epochMs; }
+  // Safe to call from any thread, e.g. SampleLocalUserObserver's SDK callback
+  void requestKeyFrame() { keyFrameRequested_ = true; }
+
+  bool initialize(const std::string& input);
+  std::unique_ptr<HelperH264Frame> getNextFrame();
+  // Makes ticket the only preload allowed to publish, and drops an older one's result that was
+  // never switched to. Called by the requester before it submits the preload.
+  void claimPreload(std::shared_ptr<const PreloadTicket> ticket);
+  // keepPosition preloads another rendition of the current content: the cut continues from
+  // the playhead's segment and offset instead of starting the new source from the top.
+  // With a ticket the result is only published while that ticket holds the claim.
+  bool preloadNewPlaylist(const std::string& input, bool keepPosition = false,
+                          const PreloadTicket* ticket = nullptr);
+  // Downloads and indexes the first segments of `input` into the shared store without
+  // preloading it: the first lookahead + 1, or all of them without lookahead
+  bool warmPlaylist(const std::string& input, const PreloadTicket* ticket = nullptr);
+  
+  // Playback queue. The current video loops until the queue's front is preloaded, then plays to
+  // its last AU and the front follows from its first AU, timestamps continuing where the
+  // current video's ended. enqueue() adds an entry, a preload loads it with prepareQueued() and
+  // hands the result to fillQueued(); a null source makes the reader skip the entry.
+  std::shared_ptr<QueuedVideo> enqueue(const std::string& input, uint64_t id);
+  std::unique_ptr<PlaylistSource> prepareQueued(const std::string& input);
+  void fillQueued(QueuedVideo& entry, std::unique_ptr<PlaylistSource> source);
+  // Empties the queue, cancelling entries still loading; returns the removed entries that were
+  // not already answered as failed
+  std::vector<std::shared_ptr<QueuedVideo>> clearQueue();
+  // Cuts over to the preloaded playlist if the current source is at `cut`. readyTime receives
+  // when the preload finished.
+  bool switchToNewPlaylist(SwitchCut cut = CUT_NOW,
+                           std::chrono::steady_clock::time_point* readyTime = nullptr);
+  std::string getCurrentVideoFile() const;
+  
+private:
+  bool isM3U8(const std::string& path);
+  bool isURL(const std::string& path);
+  
+  // Current playlist
+  PlaylistSource current_;
+  size_t currentSegmentIndex_ = 0;
+  std::atomic<size_t> playheadSegment_{0}; // currentSegmentIndex_ for the preload thread
+  std::shared_ptr<const TsSegmentIndex> currentIndex_;
+  size_t currentAu_ = 0;
+  
+  // Set when a source starts; the first frame sent from it must be an IDR
+  bool needKeyFrame_ = true;
+  
+  // Playback queue, filled by enqueue() and the preloads, taken from by the reader
+  std::mutex queueMutex_;
+  std::deque<std::shared_ptr<QueuedVideo>> queue_;
+  
+  // Output timeline: loops and queued videos continue it by shifting the sources' timestamps,
+  // so the pacer sees one frame step instead of a discontinuity. Switches restart it.
+  int64_t timestampOffset_ = 0;
+  int64_t lastDts_ = -1;       // last frame's DTS on the output timeline
+  int64_t lastStep_ = 0;       // its distance to the frame before, 0 when unknown
+  bool rebase_ = false;        // the next frame starts a loop or a queued video
+  bool startsQueued_ = false;
+  uint64_t queuedId_ = 0;
+  
+  // Preloaded playlist, published whole by the preload thread and taken by the send thread.
+  // Checking for a pending switch is one atomic load, no lock.
+  std::atomic<PlaylistSource*> ready_{nullptr};
+  // Serializes publishing into ready_ with claimPreload(), so a superseded preload can't land
+  std::mutex preloadMutex_;
+  std::shared_ptr<const PreloadTicket> claimed_;
+  
+  size_t lookahead_;
+  bool live_ = false;
+  int liveLatencyMs_ = DEFAULT_LIVE_LATENCY_MS;
+  
+  int64_t syncEpochMs_ = 0;
+  bool syncPending_ = false; // the next frame starts a synchronized source
+  int64_t syncDueUs_ = 0;    // dueUs of the next frame
+  
+  // Intra request handling
+  int intraRefreshMs_ = 0;
+  std::atomic<bool> keyFrameRequested_{false};
+  std::chrono::steady_clock::time_point lastIntraRefresh_;
+  unsigned suppressedIntraRequests_ = 0;
+  
+  // Playback state is only touched by the thread pulling frames (the FramePrefetcher reader);
+  // this guards current_.videoFile
+  // for getCurrentVideoFile() callers on other threads
+  mutable std::mutex mutex_;
+  
+  // Internal setup methods
+  bool internalSetupSingleFile(const std::string& path, PlaylistSource& source);
+  bool internalSetupPlaylist(const std::string& path, PlaylistSource& source);
+  bool internalSetup(const std::string& input, PlaylistSource& source);
+  void addSegment(PlaylistSource& source, const M3U8Segment& segment, uint64_t sequence);
+  void requestLookahead(PlaylistSource& source, size_t from);
+  bool advanceSegment();
+  double liveLatency(const PlaylistSource& source) const;
+  size_t liveEdgeSegment(const PlaylistSource& source) const;
+  bool reloadLivePlaylist();
+  void pollLive();
+  bool advanceLiveSegment();
+  bool syncPlayhead();
+  bool alignToPlayhead(PlaylistSource& next, size_t& segment,
+                       std::shared_ptr<const TsSegmentIndex>& index, size_t& au);
+  std::unique_ptr<HelperH264Frame> startAtKeyFrame();
+  bool startQueued();
+  void attachAudio(HelperH264Frame& frame, const TsAccessUnit& au);
+  void stampTimestamps(HelperH264Frame& frame);
+  void answerIntraRequest();
+};
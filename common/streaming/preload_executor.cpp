@@ -0,0 +1,46 @@
+#include "preload_executor.h"
+
+#include <thread>
+
+#include "metrics_registry.h"
+
+void PreloadExecutor::submit(Priority priority, std::shared_ptr<const PreloadTicket> ticket,
+                             std::function<void()> job) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    (priority == SWITCH ? switches_ : warms_).push_back(Task{std::move(ticket), std::move(job)});
+    if (workersStarted_ < workerCount_) {
+      std::thread(&PreloadExecutor::workerLoop, this).detach();
+      ++workersStarted_;
+    }
+  }
+  available_.notify_one();
+}
+
+void PreloadExecutor::workerLoop() {
+  while (true) {
+    Task task;
+    bool warm;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      available_.wait(lock, [this] { return !switches_.empty() || warmAllowed(); });
+      warm = switches_.empty();
+      std::deque<Task>& queue = warm ? warms_ : switches_;
+      task = std::move(queue.front());
+      queue.pop_front();
+      warmsRunning_ += warm;
+    }
+    if (task.ticket && task.ticket->cancelled()) {
+      MetricsRegistry::instance().segments().preloadsCancelled.add();
+    } else {
+      task.job();
+    }
+    if (warm) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --warmsRunning_;
+      }
+      available_.notify_one();
+    }
+  }
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#define DEFAULT_PRELOAD_WORKERS (2)
+
+// One preload request. Whoever made it cancels it once a newer request supersedes it; the job
+// checks it between its stages and the PlaylistManager before publishing the result.
+class PreloadTicket {
+public:
+  void cancel() { cancelled_.store(true, std::memory_order_release); }
+  bool cancelled() const { return cancelled_.load(std::memory_order_acquire); }
+
+private:
+  std::atomic<bool> cancelled_{false};
+};
+
+// Bounded pool of threads that resolve, download and index videos ahead of a switch, shared by
+// every stream in the process. Switch preloads run before warm-ups, and warm-ups leave one
+// worker free for them. Jobs cancelled while still queued are dropped without running.
+class PreloadExecutor {
+public:
+  enum Priority { SWITCH, WARM };
+
+  static PreloadExecutor& instance() {
+    static PreloadExecutor* executor = new PreloadExecutor(); // never destroyed: workers are detached
+    return *executor;
+  }
+
+  // Takes effect for workers not started yet; call before the first preload
+  void setWorkerCount(int count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    workerCount_ = count;
+  }
+
+  void submit(Priority priority, std::shared_ptr<const PreloadTicket> ticket, std::function<void()> job);
+
+private:
+  struct Task {
+    std::shared_ptr<const PreloadTicket> ticket;
+    std::function<void()> job;
+  };
+
+  PreloadExecutor() {}
+  void workerLoop();
+  bool warmAllowed() const { return !warms_.empty() && (warmsRunning_ + 1 < workerCount_ || workerCount_ == 1); }
+
+  std::mutex mutex_;
+  std::condition_variable available_;
+  std::deque<Task> switches_;
+  std::deque<Task> warms_;
+  int warmsRunning_ = 0;
+  int workerCount_ = DEFAULT_PRELOAD_WORKERS;
+  int workersStarted_ = 0;
+};
@@ -0,0 +1,90 @@
+#include "rendition_controller.h"
+
+#include <algorithm>
+#include <cstdio>
+
+// adaptive renditions: consecutive estimates below the current bandwidth before stepping down,
+// and how far and how long the estimate must clear the next rendition before stepping up
+#define ABR_DOWN_SAMPLES (2)
+#define ABR_UP_HEADROOM (1.25)
+#define ABR_UP_HOLD_MS (8000)
+
+// The highest variant no richer than `bps`, the lowest one when none is
+size_t RenditionController::fitting(int bps) const {
+  size_t best = 0;
+  for (size_t i = 0; i < variants_.size(); ++i) {
+    if (variants_[i].bandwidth <= bps) {
+      best = i;
+    }
+  }
+  return best;
+}
+
+M3U8Variant RenditionController::reset(const std::vector<M3U8Variant>& variants) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  variants_ = variants;
+  belowCount_ = 0;
+  upCandidate_ = false;
+  if (variants_.empty()) {
+    return M3U8Variant{std::string(), 0};
+  }
+  // Without an estimate yet start at the top, the bitrate a plain playlist would be sent at
+  current_ = lastEstimate_ >= 0 ? fitting(lastEstimate_) : variants_.size() - 1;
+  printf("Adaptive renditions: %zu variants, starting at %ld kbps\n", variants_.size(),
+         variants_[current_].bandwidth / 1000);
+  return variants_[current_];
+}
+
+bool RenditionController::active() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return variants_.size() > 1;
+}
+
+bool RenditionController::onEstimate(int bps, std::chrono::steady_clock::time_point now,
+                                     M3U8Variant& variant) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  lastEstimate_ = bps;
+  if (variants_.size() < 2 || bps <= 0) {
+    return false;
+  }
+
+  if (bps < variants_[current_].bandwidth) {
+    upCandidate_ = false;
+    if (++belowCount_ < ABR_DOWN_SAMPLES || current_ == 0) {
+      return false;
+    }
+    current_ = std::min(fitting(bps), current_ - 1);
+  } else {
+    belowCount_ = 0;
+    if (current_ + 1 >= variants_.size() || bps < variants_[current_ + 1].bandwidth * ABR_UP_HEADROOM) {
+      upCandidate_ = false;
+      return false;
+    }
+    if (!upCandidate_) {
+      upCandidate_ = true;
+      upSince_ = now;
+    }
+    if (now - upSince_ < std::chrono::milliseconds(ABR_UP_HOLD_MS)) {
+      return false;
+    }
+    ++current_;
+    upCandidate_ = false;
+  }
+  belowCount_ = 0;
+  variant = variants_[current_];
+  return true;
+}
+
+std::string resolveRenditions(const std::string& videoFile, RenditionController& renditions,
+                              std::string* lowest) {
+  std::vector<M3U8Variant> variants;
+  if (!loadMasterPlaylist(videoFile, variants)) {
+    renditions.reset(variants);
+    return videoFile;
+  }
+  if (lowest) {
+    *lowest = variants.front().url;
+  }
+  return renditions.reset(variants).url;
+}
+
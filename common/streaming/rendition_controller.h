@@ -0,0 +1,38 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "m3u8_parser.h"
+
+// Picks the rendition of an HLS master playlist that fits the uplink bandwidth estimate.
+// It steps down once the estimate stays below the current rendition's bandwidth, and steps up
+// one rendition at a time, only after the estimate held well above the next one's.
+class RenditionController {
+public:
+  // Adopts a master playlist's variants (lowest bandwidth first, empty to stop adapting)
+  // and returns the one to start with.
+  M3U8Variant reset(const std::vector<M3U8Variant>& variants);
+  bool active() const;
+  // Feeds an estimate in bits per second; true with the variant to switch to
+  bool onEstimate(int bps, std::chrono::steady_clock::time_point now, M3U8Variant& variant);
+
+private:
+  size_t fitting(int bps) const;
+
+  mutable std::mutex mutex_; // reset() runs on a preload thread
+  std::vector<M3U8Variant> variants_;
+  size_t current_ = 0;
+  int lastEstimate_ = -1;
+  int belowCount_ = 0;
+  bool upCandidate_ = false;
+  std::chrono::steady_clock::time_point upSince_;
+};
+
+// Starts adaptive selection when `videoFile` is an HLS master playlist. Returns what to play:
+// the chosen variant, or videoFile itself when it isn't a master playlist. `lowest` receives
+// the master's lowest variant, if any.
+std::string resolveRenditions(const std::string& videoFile, RenditionController& renditions,
+                              std::string* lowest = nullptr);
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+#include "playlist_manager.h"
+#include "preload_executor.h"
+#include "segment_fetcher.h"
+#include "segment_store.h"
+
+#define DEFAULT_FRAME_RATE (30)
+#define DEFAULT_PACING_MODE "fps"
+#define DEFAULT_METADATA_MODE "none"
+#define DEFAULT_METADATA_PAYLOAD "timestamp"
+#define DEFAULT_VIDEO_FILE "test_data/send_video.ts"
+#define DEFAULT_CACHE_MB (4096)
+#define DEFAULT_LOOKAHEAD_SEGMENTS (0)
+#define DEFAULT_SWITCH_MODE "immediate"
+#define DEFAULT_INTRA_REFRESH_MS (0)
+#define DEFAULT_PREFETCH_DEPTH (16)
+#define DEFAULT_METRICS_INTERVAL_MS (1000)
+#define DEFAULT_LOW_STREAM_WIDTH (640)
+#define DEFAULT_LOW_STREAM_HEIGHT (360)
+#define DEFAULT_LOW_STREAM_KBPS (500)
+
+// Command line of agora_streaming_controlled, read by its send threads and the benchmark
+struct SampleOptions {
+  std::string appId;
+  std::string channelId;
+  std::string userId;
+  std::string videoFile = DEFAULT_VIDEO_FILE;
+  std::string localIP;
+  struct {
+    int frameRate = DEFAULT_FRAME_RATE;
+    std::string pacing = DEFAULT_PACING_MODE;
+    bool showBandwidthEstimation = false;
+    std::string metadata = DEFAULT_METADATA_MODE;        // none, trailer or sei, see FrameMetadata
+    std::string metadataPayload = DEFAULT_METADATA_PAYLOAD;
+  } video;
+  bool publishAudio = false; // the segments' AAC stream on a custom audio track
+  bool multiStream = false;
+  bool standby = false;
+  std::string warmVideos; // WARM_VIDEO at startup
+  bool stringUid = true;
+  int segmentStoreMb = DEFAULT_SEGMENT_STORE_MB;
+  int cacheMb = DEFAULT_CACHE_MB;
+  int fetchWorkers = DEFAULT_FETCH_WORKERS;
+  int preloadWorkers = DEFAULT_PRELOAD_WORKERS;
+  int lookahead = DEFAULT_LOOKAHEAD_SEGMENTS;
+  bool live = false; // refresh playlists without #EXT-X-ENDLIST while they play
+  int liveLatencyMs = DEFAULT_LIVE_LATENCY_MS;
+  int64_t syncEpochMs = 0; // play on a timeline shared with other processes, starting at this Unix time
+  std::string switchMode = DEFAULT_SWITCH_MODE;
+  int intraRefreshMs = DEFAULT_INTRA_REFRESH_MS;
+  int metricsFd = -1;
+  int metricsIntervalMs = DEFAULT_METRICS_INTERVAL_MS;
+  int controlFd = -1; // framed JSON requests and replies, next to the stdin commands
+  // Simulcast: a lower rendition of the same content published as the low stream
+  struct {
+    std::string videoFile;
+    int width = DEFAULT_LOW_STREAM_WIDTH;
+    int height = DEFAULT_LOW_STREAM_HEIGHT;
+    int bitrateKbps = DEFAULT_LOW_STREAM_KBPS;
+  } lowStream;
+  struct {
+    int depth = DEFAULT_PREFETCH_DEPTH;
+    int highWater = 0; // 0: depth
+    int lowWater = 0;  // 0: half the high water mark
+  } prefetch;
+};
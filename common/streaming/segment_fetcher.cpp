@@ -0,0 +1,141 @@
+#include "segment_fetcher.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <unistd.h>
+
+#include "disk_cache.h"
+#include "metrics_registry.h"
+#include "stream_util.h"
+
+std::shared_ptr<FetchBatch> SegmentFetcher::submit(const std::vector<FetchJob>& jobs) {
+  std::shared_ptr<FetchBatch> batch = std::make_shared<FetchBatch>();
+  batch->jobs_ = jobs.size();
+  batch->pending_ = jobs.size();
+  batch->start_ = std::chrono::steady_clock::now();
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& job : jobs) {
+      tasks_.push_back(Task{job, batch});
+    }
+    while (workersStarted_ < workerCount_ && (size_t)workersStarted_ < tasks_.size()) {
+      std::thread(&SegmentFetcher::workerLoop, this, workersStarted_++).detach();
+    }
+  }
+  available_.notify_all();
+  return batch;
+}
+
+void SegmentFetcher::workerLoop(int workerId) {
+  CURL* curl = curl_easy_init();
+  while (true) {
+    Task task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      available_.wait(lock, [this] { return !tasks_.empty(); });
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+
+    curl_off_t bytes = 0;
+    double elapsedMs = 0;
+    bool ok = curl && fetchOne(curl, workerId, task.job, bytes, elapsedMs);
+
+    FetchBatch& batch = *task.batch;
+    std::lock_guard<std::mutex> lock(batch.mutex_);
+    batch.success_ = batch.success_ && ok;
+    batch.bytes_ += bytes;
+    batch.slowestMs_ = std::max(batch.slowestMs_, elapsedMs);
+    if (--batch.pending_ == 0) {
+      double totalMs =
+          std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - batch.start_).count();
+      LOGF("Downloaded %zu file(s), %.1f MB in %.0f ms, slowest %.0f ms%s", batch.jobs_,
+           batch.bytes_ / (1024.0 * 1024.0), totalMs, batch.slowestMs_, batch.success_ ? "" : " (with failures)");
+      batch.done_.notify_all();
+    }
+  }
+}
+
+// Download target: the file, plus the running checksum the manifest records
+struct FetchOutput {
+  FILE* file;
+  Checksum checksum;
+  uint64_t bytes;
+};
+
+static size_t writeFetchOutput(char* data, size_t size, size_t count, void* userdata) {
+  FetchOutput* out = static_cast<FetchOutput*>(userdata);
+  size_t written = fwrite(data, 1, size * count, out->file);
+  out->checksum.update(reinterpret_cast<const uint8_t*>(data), written);
+  out->bytes += written;
+  return written;
+}
+
+bool SegmentFetcher::fetchOne(CURL* curl, int workerId, const FetchJob& job, curl_off_t& bytes,
+                              double& elapsedMs) {
+  size_t lastSlash = job.outputPath.find_last_of('/');
+  if (lastSlash != std::string::npos && !createDirectoryRecursive(job.outputPath.substr(0, lastSlash))) {
+    LOGF("Failed to create directory for: %s", job.outputPath.c_str());
+    return false;
+  }
+
+  // Other processes may be filling the same cache, so the temp name is unique per worker
+  std::string tmpPath = job.outputPath + ".part." + std::to_string(getpid()) + "." + std::to_string(workerId);
+  FetchOutput out = {fopen(tmpPath.c_str(), "wb"), Checksum(), 0};
+  if (!out.file) {
+    LOGF("Failed to open %s: %s", tmpPath.c_str(), strerror(errno));
+    return false;
+  }
+
+  char errorBuf[CURL_ERROR_SIZE] = {0};
+  curl_easy_setopt(curl, CURLOPT_URL, job.url.c_str());
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeFetchOutput);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &out);
+  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errorBuf);
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+  curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, (long)FETCH_CONNECT_TIMEOUT_S);
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long)FETCH_TIMEOUT_S);
+
+  LOGF("Downloading: %s", job.url.c_str());
+  CURLcode res = curl_easy_perform(curl);
+  bool ok = (fclose(out.file) == 0) && res == CURLE_OK;
+
+  double totalSec = 0;
+  long newConnections = 0;
+  curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &totalSec);
+  curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &newConnections);
+  curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, NULL);
+  elapsedMs = totalSec * 1000.0;
+
+  if (ok && rename(tmpPath.c_str(), job.outputPath.c_str()) != 0) {
+    LOGF("Failed to move %s into cache: %s", tmpPath.c_str(), strerror(errno));
+    ok = false;
+  }
+  SegmentMetrics& metrics = MetricsRegistry::instance().segments();
+  if (!ok) {
+    unlink(tmpPath.c_str());
+    LOGF("Failed to download %s: %s", job.url.c_str(), errorBuf[0] ? errorBuf : curl_easy_strerror(res));
+    metrics.downloadFailures.add();
+    return false;
+  }
+  DiskCache::instance().commit(job.outputPath, out.bytes, out.checksum.value());
+  metrics.downloads.add();
+  metrics.downloadBytes.add(bytes);
+  metrics.downloadUs.record(static_cast<int64_t>(elapsedMs * 1000.0));
+
+  LOGF("Fetched %s: %.1f KB in %.1f ms%s", job.url.c_str(), bytes / 1024.0, elapsedMs,
+       newConnections == 0 ? " (reused connection)" : "");
+  return true;
+}
+
+bool downloadFile(const std::string& url, const std::string& outputPath) {
+  return SegmentFetcher::instance().fetchAll(std::vector<FetchJob>(1, FetchJob{url, outputPath}));
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <curl/curl.h>
+
+#define DEFAULT_FETCH_WORKERS (8)
+#define FETCH_CONNECT_TIMEOUT_S (10)
+#define FETCH_TIMEOUT_S (60)
+
+struct FetchJob {
+  std::string url;
+  std::string outputPath;
+};
+
+// Completion state of one SegmentFetcher::submit(), shared by the caller and the workers
+class FetchBatch {
+public:
+  bool isDone() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_ == 0;
+  }
+
+  // Blocks until every job finished; true if all of them succeeded
+  bool wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return pending_ == 0; });
+    return success_;
+  }
+
+private:
+  friend class SegmentFetcher;
+
+  std::mutex mutex_;
+  std::condition_variable done_;
+  size_t jobs_ = 0;
+  size_t pending_ = 0;
+  bool success_ = true;
+  curl_off_t bytes_ = 0;
+  double slowestMs_ = 0;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Bounded pool of libcurl workers shared by every playlist in the process. Each worker keeps
+// one easy handle for its lifetime, so back-to-back segments from the same CDN host reuse the
+// keep-alive connection instead of paying a fresh TCP/TLS handshake.
+class SegmentFetcher {
+public:
+  static SegmentFetcher& instance() {
+    static SegmentFetcher* fetcher = new SegmentFetcher(); // never destroyed: workers are detached
+    return *fetcher;
+  }
+
+  // Takes effect for workers not started yet; call before the first fetch
+  void setWorkerCount(int count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    workerCount_ = count;
+  }
+
+  // Queues all jobs for the workers, each written to a temp file and renamed into place
+  std::shared_ptr<FetchBatch> submit(const std::vector<FetchJob>& jobs);
+
+  bool fetchAll(const std::vector<FetchJob>& jobs) {
+    return jobs.empty() || submit(jobs)->wait();
+  }
+
+private:
+  struct Task {
+    FetchJob job;
+    std::shared_ptr<FetchBatch> batch;
+  };
+
+  SegmentFetcher() { curl_global_init(CURL_GLOBAL_DEFAULT); }
+  void workerLoop(int workerId);
+  bool fetchOne(CURL* curl, int workerId, const FetchJob& job, curl_off_t& bytes, double& elapsedMs);
+
+  std::mutex mutex_;
+  std::condition_variable available_;
+  std::deque<Task> tasks_;
+  int workerCount_ = DEFAULT_FETCH_WORKERS;
+  int workersStarted_ = 0;
+};
+
+// Download a single file into the cache
+bool downloadFile(const std::string& url, const std::string& outputPath);
@@ -0,0 +1,147 @@
+#include "segment_index.h"
+
+#include "disk_cache.h"
+#include "metrics_registry.h"
+#include "stream_util.h"
+#include "ts_file_parser.h"
+#include "common/file_parser/helper_mp4_parser.h"
+
+#define MP4_TIMESTAMP_BASE (126000) // MP4 timestamps start at 0: shift them where a TS muxer's start, keeping DTS >= 0
+
+std::shared_ptr<const TsSegmentIndex> TsSegmentIndex::build(const std::string& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    LOGF("Failed to stat %s", path.c_str());
+    return nullptr;
+  }
+
+  std::shared_ptr<TsSegmentIndex> index(new TsSegmentIndex());
+  index->fileSize_ = st.st_size;
+  index->fileMtime_ = st.st_mtime;
+  if (!(HelperMp4FileParser::isMp4Path(path) ? index->buildMp4(path) : index->buildTs(path))) {
+    return nullptr;
+  }
+  if (index->aus_.empty()) {
+    LOGF("No access units found in %s", path.c_str());
+    return nullptr;
+  }
+  index->assignAudio();
+  for (size_t i = 0; i < index->aus_.size(); ++i) {
+    if (index->aus_[i].isKeyFrame) {
+      index->keyFrames_.push_back(i);
+    }
+  }
+
+  index->es_.shrink_to_fit();
+  index->aus_.shrink_to_fit();
+  index->audioEs_.shrink_to_fit();
+  index->audio_.shrink_to_fit();
+  index->keyFrames_.shrink_to_fit();
+  return index;
+}
+
+bool TsSegmentIndex::buildTs(const std::string& path) {
+  HelperTsH264FileParser parser(path.c_str());
+  if (!parser.initialize() || !DiskCache::instance().verify(path, parser.fileData(), parser.fileSize())) {
+    return false;
+  }
+
+  es_.reserve(fileSize_); // the elementary stream is always smaller than its TS
+  codec_ = parser.codec();
+  const unsigned paramSetFlags = nalParamSetFlags(codec_);
+  unsigned kept = 0;
+  std::vector<uint8_t> vps, sps, pps;
+  while (auto frame = parser.getH264Frame()) {
+    // The parser's scan already says whether there are parameter sets; only walk the NAL
+    // units to copy the segment's first ones
+    if ((frame->nalFlags & paramSetFlags & ~kept)) {
+      forEachNalUnit(codec_, frame->buffer, frame->bufferLen, [&](uint8_t type, size_t begin, size_t end) {
+        unsigned flag = nalTypeFlags(codec_, type);
+        std::vector<uint8_t>* keep = flag == NAL_FLAG_VPS ? &vps : flag == NAL_FLAG_SPS ? &sps
+                                   : flag == NAL_FLAG_PPS ? &pps : nullptr;
+        if (keep && !(kept & flag)) {
+          keep->assign(frame->buffer + begin, frame->buffer + end);
+          kept |= flag;
+        }
+        return !(flag & NAL_FLAG_VCL);
+      });
+    }
+
+    bool hasParamSets = (frame->nalFlags & paramSetFlags) == paramSetFlags;
+    TsAccessUnit au = {es_.size(), frame->bufferLen, frame->isKeyFrame, hasParamSets,
+                       frame->pts, frame->dts, 0, 0};
+    es_.insert(es_.end(), frame->buffer, frame->buffer + frame->bufferLen);
+    aus_.push_back(au);
+  }
+  if (kept == paramSetFlags) {
+    paramSets_ = vps;
+    paramSets_.insert(paramSets_.end(), sps.begin(), sps.end());
+    paramSets_.insert(paramSets_.end(), pps.begin(), pps.end());
+  }
+  MetricsRegistry::instance().segments().peakAuBytes.record(parser.peakAuSize());
+
+  parser.readAacFrames(audioEs_, audio_);
+  return true;
+}
+
+// Samples are in decode order like TS access units: each becomes one AU, its timestamps moved
+// from the track timescale onto the 90 kHz clock
+bool TsSegmentIndex::buildMp4(const std::string& path) {
+  HelperMp4FileParser parser(path.c_str());
+  if (!parser.initialize() || !DiskCache::instance().verify(path, parser.fileData(), parser.fileSize())) {
+    return false;
+  }
+
+  const Mp4VideoTrack& video = parser.video();
+  const int64_t wrap = (1LL << 33) - 1;
+  codec_ = video.codec;
+  paramSets_ = video.paramSets;
+  es_.reserve(fileSize_ + video.samples.size() * 4); // 1- and 2-byte length prefixes grow to start codes
+  const unsigned paramSetFlags = nalParamSetFlags(codec_);
+  size_t peak = 0;
+  for (const Mp4Sample& sample : video.samples) {
+    size_t offset = es_.size();
+    if (!parser.appendAnnexB(sample, es_)) {
+      LOGF("Skipping malformed sample at %llu in %s", (unsigned long long)sample.offset, path.c_str());
+      continue;
+    }
+    int size = (int)(es_.size() - offset);
+    unsigned flags = scanAccessUnit(codec_, es_.data() + offset, size);
+    TsAccessUnit au = {offset, size, sample.isSync, (flags & paramSetFlags) == paramSetFlags,
+                       (video.to90kHz(sample.pts) + MP4_TIMESTAMP_BASE) & wrap,
+                       (video.to90kHz(sample.dts) + MP4_TIMESTAMP_BASE) & wrap, 0, 0};
+    aus_.push_back(au);
+    peak = std::max(peak, (size_t)size);
+  }
+  MetricsRegistry::instance().segments().peakAuBytes.record(peak);
+
+  if (parser.hasAudio()) {
+    const Mp4AudioTrack& audio = parser.audio();
+    int channels = audio.channels ? audio.channels : 2;
+    for (const Mp4Sample& sample : audio.samples) {
+      size_t offset = audioEs_.size();
+      if (parser.appendAdts(sample, audioEs_)) {
+        audio_.push_back(TsAudioFrame{offset, (int)(audioEs_.size() - offset),
+                                      (audio.to90kHz(sample.pts) + MP4_TIMESTAMP_BASE) & wrap,
+                                      audio.sampleRateHz, channels, 1024});
+      }
+    }
+  }
+  return true;
+}
+
+// Both streams are in timestamp order: one merge hands each audio frame to the last AU
+// decoded at or before it, the ones ahead of the first AU go out with it
+void TsSegmentIndex::assignAudio() {
+  size_t j = 0;
+  for (size_t i = 0; i < audio_.size(); ++i) {
+    int64_t pts = audio_[i].pts;
+    while (pts >= 0 && j + 1 < aus_.size() && aus_[j + 1].dts >= 0 &&
+           ((pts - aus_[j + 1].dts) & ((1LL << 33) - 1)) < (1LL << 32)) { // 33-bit wrap
+      ++j;
+    }
+    TsAccessUnit& au = aus_[j];
+    if (!au.audioCount) au.audioBegin = i;
+    ++au.audioCount;
+  }
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "stream_frame.h"
+#include "common/file_parser/helper_nal_scanner.h"
+
+// One access unit of an indexed segment; `offset` points into TsSegmentIndex's ES buffer
+struct TsAccessUnit {
+  size_t offset;
+  int size;
+  bool isKeyFrame;
+  bool hasParamSets; // carries all of its codec's parameter sets (VPS,) SPS and PPS in-band
+  int64_t pts;
+  int64_t dts;
+  size_t audioBegin; // audio frames from this AU's DTS up to the next AU's
+  int audioCount;
+};
+
+// Demuxes a .ts segment once and keeps its access units (bytes, keyframe flags, PTS/DTS)
+// in memory, so looping playlists replay the segment as a table walk without re-parsing.
+// AAC frames are kept alongside, each listed under the AU it plays out with. MP4 files are
+// indexed the same way, their samples converted to Annex B and ADTS on the way in.
+class TsSegmentIndex {
+public:
+  static std::shared_ptr<const TsSegmentIndex> build(const std::string& path);
+
+  // True while the file on disk is still the one this index was built from
+  bool isCurrent(const struct stat& st) const {
+    return st.st_size == fileSize_ && st.st_mtime == fileMtime_;
+  }
+  size_t size() const { return aus_.size(); }
+  const TsAccessUnit& at(size_t i) const { return aus_[i]; }
+  const uint8_t* data(const TsAccessUnit& au) const { return es_.data() + au.offset; }
+  const TsAudioFrame* audio(const TsAccessUnit& au) const { return audio_.data() + au.audioBegin; }
+  const uint8_t* audioData() const { return audioEs_.data(); }
+  size_t memoryBytes() const {
+    return es_.capacity() + aus_.capacity() * sizeof(TsAccessUnit) + audioEs_.capacity() +
+           audio_.capacity() * sizeof(TsAudioFrame) + keyFrames_.capacity() * sizeof(size_t);
+  }
+
+  // First keyframe at or after `from`, SIZE_MAX if the rest of the segment has none
+  size_t nextKeyFrame(size_t from) const {
+    for (size_t i = from; i < aus_.size(); ++i) {
+      if (aus_[i].isKeyFrame) return i;
+    }
+    return SIZE_MAX;
+  }
+  // Last keyframe decoded at most `offset` (90 kHz) after the segment's first AU, the first
+  // keyframe when none is. A binary search of the keyframe table, without touching the AUs.
+  size_t keyFrameAt(int64_t offset) const {
+    if (keyFrames_.empty()) return 0;
+    auto after = std::upper_bound(keyFrames_.begin(), keyFrames_.end(), offset,
+                                  [this](int64_t o, size_t i) { return o < decodeOffset(i); });
+    return after == keyFrames_.begin() ? keyFrames_.front() : *(after - 1);
+  }
+  // Decode span of the segment in 90 kHz units: its last AU's offset plus one average frame step
+  int64_t duration() const {
+    if (aus_.size() < 2) return 0;
+    int64_t last = decodeOffset(aus_.size() - 1);
+    return last + last / (aus_.size() - 1);
+  }
+  // First (VPS,) SPS and PPS of the segment with their start codes, for IDRs that lack them in-band
+  const std::vector<uint8_t>& paramSets() const { return paramSets_; }
+  NalCodec codec() const { return codec_; }
+
+  // DTS of AU i after the first AU's, over a 33-bit wrap; AUs without one count from their index
+  int64_t decodeOffset(size_t i) const {
+    if (aus_[i].dts < 0 || aus_[0].dts < 0) return (int64_t)i;
+    return (aus_[i].dts - aus_[0].dts) & ((1LL << 33) - 1);
+  }
+
+private:
+  bool buildTs(const std::string& path);
+  bool buildMp4(const std::string& path);
+  void assignAudio();
+
+  NalCodec codec_ = NAL_CODEC_H264;
+  off_t fileSize_ = 0;
+  time_t fileMtime_ = 0;
+  std::vector<uint8_t> es_;
+  std::vector<TsAccessUnit> aus_;
+  std::vector<size_t> keyFrames_; // AU indexes of the keyframes, in decode order
+  std::vector<uint8_t> paramSets_;
+  std::vector<uint8_t> audioEs_;
+  std::vector<TsAudioFrame> audio_;
+};
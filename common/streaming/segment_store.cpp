@@ -0,0 +1,69 @@
+#include "segment_store.h"
+
+#include <chrono>
+#include <sys/stat.h>
+
+#include "disk_cache.h"
+#include "metrics_registry.h"
+
+std::shared_ptr<const TsSegmentIndex> SegmentStore::acquire(const std::string& path) {
+  struct stat st;
+  bool haveStat = (stat(path.c_str(), &st) == 0);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  // Let one caller parse a segment while the others wait for its result
+  built_.wait(lock, [this, &path] { return building_.count(path) == 0; });
+
+  auto it = entries_.find(path);
+  if (it != entries_.end()) {
+    // A file evicted from the disk cache since keeps playing from its index
+    if (!haveStat || it->second.index->isCurrent(st)) {
+      it->second.lastUse = ++useClock_;
+      MetricsRegistry::instance().segments().storeHits.add();
+      std::shared_ptr<const TsSegmentIndex> index = it->second.index;
+      lock.unlock();
+      DiskCache::instance().touch(path); // in use, keep it off the disk cache's eviction list
+      return index;
+    }
+    totalBytes_ -= it->second.bytes;
+    entries_.erase(it);
+  }
+
+  building_[path] = true;
+  lock.unlock();
+  auto buildStart = std::chrono::steady_clock::now();
+  std::shared_ptr<const TsSegmentIndex> index = TsSegmentIndex::build(path);
+  SegmentMetrics& metrics = MetricsRegistry::instance().segments();
+  metrics.storeMisses.add();
+  metrics.loadUs.record(std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - buildStart).count());
+  lock.lock();
+  building_.erase(path);
+  built_.notify_all();
+
+  if (index) {
+    Entry entry = {index, index->memoryBytes(), ++useClock_};
+    totalBytes_ += entry.bytes;
+    entries_[path] = entry;
+    evictLocked();
+  }
+  return index;
+}
+
+// use_count() is only a hint across threads, good enough to prefer evicting idle segments
+void SegmentStore::evictLocked() {
+  while (totalBytes_ > budgetBytes_) {
+    auto victim = entries_.end();
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+      if (it->second.index.use_count() == 1 &&
+          (victim == entries_.end() || it->second.lastUse < victim->second.lastUse)) {
+        victim = it;
+      }
+    }
+    if (victim == entries_.end()) {
+      break; // everything left is pinned by a playing stream
+    }
+    totalBytes_ -= victim->second.bytes;
+    entries_.erase(victim);
+  }
+}
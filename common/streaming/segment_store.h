@@ -0,0 +1,53 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "segment_index.h"
+
+#define DEFAULT_SEGMENT_STORE_MB (512)
+
+// Process-wide cache of segment indexes keyed by local path. Every PlaylistManager reads from
+// it, so streams looping the same playlist share one copy of each segment. Indexes still held
+// by a stream are pinned; the rest are kept for reuse and evicted LRU-first over the budget.
+class SegmentStore {
+public:
+  static SegmentStore& instance() {
+    static SegmentStore* store = new SegmentStore(); // leaked, detached workers acquire after main()
+    return *store;
+  }
+
+  void setBudget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    budgetBytes_ = bytes;
+    evictLocked();
+  }
+
+  std::shared_ptr<const TsSegmentIndex> acquire(const std::string& path);
+  // True when `path` is indexed, so reading it needs no disk access
+  bool resident(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.count(path) != 0;
+  }
+
+private:
+  struct Entry {
+    std::shared_ptr<const TsSegmentIndex> index;
+    size_t bytes;
+    uint64_t lastUse;
+  };
+
+  void evictLocked();
+
+  std::mutex mutex_;
+  std::condition_variable built_;
+  std::unordered_map<std::string, Entry> entries_;
+  std::unordered_map<std::string, bool> building_;
+  size_t budgetBytes_ = (size_t)DEFAULT_SEGMENT_STORE_MB << 20;
+  size_t totalBytes_ = 0;
+  uint64_t useClock_ = 0;
+};
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+
+#include "au_buffer_pool.h"
+#include "common/file_parser/helper_nal_scanner.h"
+
+// One ADTS frame of a segment's AAC stream, header included; `offset` points into
+// TsSegmentIndex's audio ES buffer
+struct TsAudioFrame {
+  size_t offset;
+  int size;
+  int64_t pts; // 90 kHz, the PES timestamp advanced by the samples of earlier frames in the PES
+  int sampleRateHz;
+  int channels;
+  int samplesPerChannel;
+};
+
+// An access unit ready to hand to sendEncodedVideoImage(). `buffer` points into
+// storage kept alive by `owner` (the mmap'd segment or its TsSegmentIndex) or into `pooled`.
+// `audio` lists the AAC frames due between this AU and the next one; they live in `owner`.
+struct HelperH264Frame {
+  bool isKeyFrame;
+  const uint8_t* buffer;
+  int bufferLen;
+  int64_t pts; // 90 kHz presentation timestamp from the PES header, -1 if absent
+  int64_t dts; // 90 kHz decode timestamp, equals pts when the PES carries none
+  unsigned nalFlags = 0; // NAL_FLAG_* from the parser's scan, 0 when not scanned
+  NalCodec codec = NAL_CODEC_H264;
+  const TsAudioFrame* audio = nullptr;
+  int audioCount = 0;
+  const uint8_t* audioData = nullptr; // base of TsAudioFrame::offset
+  int64_t timestampOffset = 0; // added to the PES timestamps in pts / dts, and due to the audio's too
+  bool startsQueued = false;   // first frame of a video from the playback queue
+  uint64_t queuedId = 0;       // and the control request that queued it
+  int64_t dueUs = 0;           // wall-clock time it is due on the shared epoch's timeline, 0 = paced as usual
+  std::shared_ptr<const void> owner;
+  PooledAuBuffer pooled;
+
+  HelperH264Frame(bool key, const uint8_t* buf, int len, int64_t p = -1, int64_t d = -1)
+    : isKeyFrame(key), buffer(buf), bufferLen(len), pts(p), dts(d) {}
+};
@@ -0,0 +1,114 @@
+#include "stream_util.h"
+
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+
+std::function<void(const char*)>& logger() {
+  static std::function<void(const char*)> cb = nullptr;
+  return cb;
+}
+
+void setLogger(std::function<void(const char*)> fn) {
+  logger() = std::move(fn);
+}
+
+bool isInteger(const std::string& str) {
+  if (str.empty()) return false;
+  
+  size_t start = 0;
+  if (str[0] == '-' || str[0] == '+') {
+    start = 1;
+    if (str.length() == 1) return false; // Just a sign character
+  }
+  
+  for (size_t i = start; i < str.length(); ++i) {
+    if (!std::isdigit(str[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int64_t splitStartPosition(std::string& video) {
+  size_t at = video.find_last_of('@');
+  if (at == std::string::npos || at + 1 == video.size() ||
+      video.find_first_not_of("0123456789", at + 1) != std::string::npos) {
+    return -1;
+  }
+  int64_t ms = std::strtoll(video.c_str() + at + 1, nullptr, 10);
+  video.erase(at);
+  return ms;
+}
+
+static bool isVerboseLoggingEnabled() {
+  // You can control this via environment variable or command line
+  const char* verbose = getenv("AGORA_VERBOSE");
+  return verbose && (strcmp(verbose, "1") == 0 || strcmp(verbose, "true") == 0);
+}
+
+void quietLogger(const char* msg) {
+  // Only log important messages, filter out verbose ones
+  std::string message(msg);
+  
+  // Skip verbose segment switching and H.264 detection messages
+  if (message.find("Switching to segment") != std::string::npos ||
+      message.find(" stream on PID ") != std::string::npos ||
+      message.find("Parsed M3U8: found") != std::string::npos ||
+      message.find("Using cached segment") != std::string::npos ||
+      message.find("Downloading:") != std::string::npos ||
+      message.find("Fetched ") != std::string::npos) {
+    
+    // Only show these if verbose mode is enabled
+    if (isVerboseLoggingEnabled()) {
+      std::fprintf(stderr, "[VERBOSE] %s\n", msg);
+    }
+    return;
+  }
+  
+  // Log important messages normally
+  std::fprintf(stderr, "%s\n", msg);
+}
+// Create directory recursively
+bool createDirectoryRecursive(const std::string& path) {
+  for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1)) {
+    std::string dir = path.substr(0, pos);
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+      return false;
+    }
+    if (pos == std::string::npos) {
+      return true;
+    }
+  }
+}
+
+// Check if file exists
+bool fileExists(const std::string& path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0;
+}
+
+// Extract cache path from URL
+std::string extractCachePath(const std::string& url) {
+  size_t vbaPos = url.find("/vba/");
+  if (vbaPos == std::string::npos) {
+    // Fallback: use last part of URL path
+    size_t lastSlash = url.find_last_of('/');
+    if (lastSlash != std::string::npos) {
+      return url.substr(lastSlash + 1);
+    }
+    return "default";
+  }
+  return url.substr(vbaPos + 1); // Skip the leading slash
+}
+
+// Get base URL from a full URL
+std::string getBaseUrl(const std::string& url) {
+  size_t lastSlash = url.find_last_of('/');
+  if (lastSlash != std::string::npos) {
+    return url.substr(0, lastSlash + 1);
+  }
+  return url;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+
+// Where LOGF messages go; unset, they are printed to stderr
+std::function<void(const char*)>& logger();
+void setLogger(std::function<void(const char*)> fn);
+// A logger that keeps per-segment chatter out of the output unless AGORA_VERBOSE is set
+void quietLogger(const char* msg);
+
+#define LOGF(fmt, ...)                                    \
+  do {                                                    \
+    char _buf[256];                                       \
+    std::snprintf(_buf, sizeof(_buf), fmt, ##__VA_ARGS__); \
+    if (logger())                                         \
+      logger()(_buf);                                     \
+    else                                                  \
+      std::fprintf(stderr, "%s\n", _buf);                \
+  } while (0)
+
+// Utility function to check if a string represents a valid integer
+bool isInteger(const std::string& str);
+// Splits a "<video>@<ms>" start position off `video`, returning -1 when it has none. An '@'
+// followed by anything but digits is part of the URL.
+int64_t splitStartPosition(std::string& video);
+
+bool createDirectoryRecursive(const std::string& path);
+bool fileExists(const std::string& path);
+// Where a URL is kept under the cache directory: from its /vba/ component on, else its file name
+std::string extractCachePath(const std::string& url);
+// The URL up to and including its last slash
+std::string getBaseUrl(const std::string& url);
@@ -0,0 +1,305 @@
+#include "ts_file_parser.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "stream_util.h"
+
+#define TS_PKT_SIZE      188
+#define TS_SYNC_BYTE     0x47
+#define ADAPT_FIELD_FLAG 0x20
+#define PAYLOAD_FLAG     0x10
+#define PES_START_CODE   0x000001
+
+static inline uint16_t pid(const uint8_t* p) { return ((p[1] & 0x1F) << 8) | p[2]; }
+static inline bool     payloadUnitStart(const uint8_t* p) { return p[1] & 0x40; }
+static inline int      adaptFieldLen(const uint8_t* p) {
+  if (!(p[3] & ADAPT_FIELD_FLAG)) return 0;
+  int len = p[4] + 1;                    // +1 = length byte itself
+  return len > 183 ? -1 /*invalid*/ : len;
+}
+// 33-bit PTS/DTS as laid out in the PES optional header (marker bits skipped)
+static inline int64_t  pesTimestamp(const uint8_t* p) {
+  return (static_cast<int64_t>((p[0] >> 1) & 0x07) << 30) |
+         (static_cast<int64_t>(p[1]) << 22) |
+         (static_cast<int64_t>(p[2] >> 1) << 15) |
+         (static_cast<int64_t>(p[3]) << 7) |
+         (static_cast<int64_t>(p[4] >> 1));
+}
+// Length of the PES header at the start of a unit's first payload, 0 when it is malformed.
+// pts/dts receive its timestamps, -1 when absent.
+static inline size_t   pesHeaderLength(const uint8_t* pay, size_t pay_len, int64_t& pts, int64_t& dts) {
+  pts = dts = -1;
+  if (pay_len < 9) return 0;         // PES header must fit
+  if (pay[0] != 0x00 || pay[1] != 0x00 || pay[2] != 0x01) return 0; // bad start
+
+  size_t pes_head = 9 + pay[8];
+  if (pes_head > pay_len) return 0;  // declared header longer than packet
+
+  // PTS_DTS_flags: '10' = PTS only, '11' = PTS followed by DTS
+  uint8_t pts_dts = pay[7] >> 6;
+  if ((pts_dts & 0x2) && pes_head >= 14) {
+    pts = dts = pesTimestamp(pay + 9);
+    if (pts_dts == 0x3 && pes_head >= 19) dts = pesTimestamp(pay + 14);
+  }
+  return pes_head;
+}
+
+static const int kAdtsSampleRates[16] = {96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050,
+                                         16000, 12000, 11025, 8000,  7350,  0,     0,     0};
+
+HelperTsH264FileParser::HelperTsH264FileParser(const char* filepath)
+    : file_path_(filepath) {}
+
+HelperTsH264FileParser::~HelperTsH264FileParser() {
+  if (fd_ >= 0) close(fd_);
+}
+
+bool HelperTsH264FileParser::initialize() {
+  struct stat st;
+  fd_ = open(file_path_.c_str(), O_RDONLY);
+  if (fd_ < 0 || fstat(fd_, &st) != 0) {
+    LOGF("Failed to open %s", file_path_.c_str());
+    return false;
+  }
+
+  size_ = st.st_size;
+  // Indexing reads every packet, so fault the whole file in with one call
+  data_ = static_cast<uint8_t*>(mmap(nullptr, size_, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd_, 0));
+  if (data_ == MAP_FAILED) {
+    data_ = nullptr;
+    LOGF("mmap() failed on %s", file_path_.c_str());
+    return false;
+  }
+  size_t mapped_size = size_;
+  mapping_.reset(data_, [mapped_size](uint8_t* p) { munmap(p, mapped_size); });
+
+  offset_ = 0;
+  return _probeProgramPids();
+}
+
+void HelperTsH264FileParser::setFileParseRestart() { offset_ = 0; }
+
+bool HelperTsH264FileParser::_probeProgramPids() {
+  for (size_t o = 0; o + TS_PKT_SIZE <= size_; o += TS_PKT_SIZE) {
+    const uint8_t* p = data_ + o;
+    if (p[0] != TS_SYNC_BYTE) continue;
+    if (pid(p) == 0 /* PAT */ && payloadUnitStart(p)) {
+      int adapt = adaptFieldLen(p);
+      if (adapt < 0) continue;
+      const uint8_t* pat = p + 4 + adapt;
+      
+      // Check bounds for pointer field
+      if (pat >= data_ + size_) continue;
+      uint8_t pointer = pat[0];
+      pat += 1 + pointer + 8; // skip pointer field and table hdr
+      
+      while (pat + 4 <= data_ + size_) {
+        uint16_t program = (pat[0] << 8) | pat[1];
+        uint16_t pmt_pid = ((pat[2] & 0x1F) << 8) | pat[3];
+        if (program) {
+          // Found a program, now look for its PMT
+          for (size_t o2 = 0; o2 + TS_PKT_SIZE <= size_; o2 += TS_PKT_SIZE) {
+            const uint8_t* q = data_ + o2;
+            if (q[0] != TS_SYNC_BYTE || pid(q) != pmt_pid || !payloadUnitStart(q))
+              continue;
+            int adapt2 = adaptFieldLen(q);
+            if (adapt2 < 0) continue;
+            const uint8_t* pmt = q + 4 + adapt2;
+            
+            // Check bounds for PMT
+            if (pmt >= data_ + size_) continue;
+            uint8_t ptr2 = pmt[0];
+            const uint8_t* section = pmt + 1 + ptr2;
+            pmt = section + 12; // skip pointer + PMT header + program info
+            
+            // The stream entries run up to the section's 4-byte CRC
+            const uint8_t* pmtEnd = data_ + size_;
+            if (section + 3 <= pmtEnd) {
+              pmtEnd = std::min(pmtEnd, section + 3 + (((section[1] & 0x0F) << 8) | section[2]) - 4);
+            }
+            while (pmt + 5 <= pmtEnd) {
+              uint8_t  stype = pmt[0];
+              uint16_t spid  = ((pmt[1] & 0x1F) << 8) | pmt[2];
+              uint16_t eslen = ((pmt[3] & 0x0F) << 8) | pmt[4];
+              if (!video_pid_ && (stype == 0x1B /* AVC/H.264 */ || stype == 0x24 /* HEVC/H.265 */)) {
+                video_pid_ = spid;
+                codec_ = stype == 0x24 ? NAL_CODEC_H265 : NAL_CODEC_H264;
+                LOGF("Found %s stream on PID %u", nalCodecName(codec_), video_pid_);
+              } else if (!audio_pid_ && stype == 0x0F /* ADTS AAC */) {
+                audio_pid_ = spid;
+                LOGF("Found AAC stream on PID %u", audio_pid_);
+              }
+              pmt += 5 + eslen;
+            }
+            if (video_pid_) {
+              return true;
+            }
+          }
+        }
+        pat += 4;
+      }
+      break;
+    }
+  }
+  LOGF("No H.264 or H.265 PID found in %s", file_path_.c_str());
+  return false;
+}
+
+size_t HelperTsH264FileParser::_readOnePes(const uint8_t*& out, PooledAuBuffer& pooled,
+                                           int64_t& pts, int64_t& dts) {
+  size_t au_len = 0;
+  bool   started = false;
+  pts = dts = -1;
+  chunks_.clear();
+
+  const int kMaxDesync = 128; // abort after this many bad syncs
+  int desyncCnt = 0;
+
+  for (; offset_ + TS_PKT_SIZE <= size_; offset_ += TS_PKT_SIZE) {
+    const uint8_t* p = data_ + offset_;
+    if (p[0] != TS_SYNC_BYTE) {
+      if (++desyncCnt >= kMaxDesync) {
+        LOGF("Transport stream desynchronized – aborting at offset %zu", offset_);
+        offset_ = size_; // force EOF
+        break;
+      }
+      continue;
+    }
+    desyncCnt = 0;
+
+    if (pid(p) != video_pid_) continue;
+
+    int adapt = adaptFieldLen(p);
+    if (adapt < 0) continue;              // invalid adaptation field length
+
+    const uint8_t* pay = p + 4 + adapt;
+    size_t pay_len = TS_PKT_SIZE - 4 - adapt;
+    if (pay_len == 0 || pay > data_ + size_) continue;
+
+    if (payloadUnitStart(p)) {
+      if (started) break;                // previous AU complete
+      started = true;
+
+      size_t pes_head = pesHeaderLength(pay, pay_len, pts, dts);
+      if (!pes_head) continue;
+
+      pay     += pes_head;
+      pay_len -= pes_head;
+    }
+
+    chunks_.push_back(std::make_pair(pay, pay_len));
+    au_len += pay_len;
+  }
+
+  if (chunks_.size() == 1) {
+    out = chunks_[0].first;  // whole PES sits in one packet: hand out the mapped bytes
+  } else if (au_len) {
+    pooled = PooledAuBuffer(AuBufferPool::instance().acquire(au_len));
+    uint8_t* dst = pooled.get();
+    for (const auto& chunk : chunks_) {
+      std::memcpy(dst, chunk.first, chunk.second);
+      dst += chunk.second;
+    }
+    out = pooled.get();
+  } else {
+    out = nullptr;
+  }
+  peakAuSize_ = std::max(peakAuSize_, au_len);
+  return au_len;
+}
+
+void HelperTsH264FileParser::readAacFrames(std::vector<uint8_t>& es, std::vector<TsAudioFrame>& frames) {
+  if (!audio_pid_) return;
+
+  // Gather the PID's payload into one ES first: an ADTS frame may straddle PES packets
+  struct PesStart {
+    size_t offset;
+    int64_t pts;
+  };
+  std::vector<PesStart> starts;
+  size_t base = es.size();
+  bool started = false;
+  for (size_t o = 0; o + TS_PKT_SIZE <= size_; o += TS_PKT_SIZE) {
+    const uint8_t* p = data_ + o;
+    if (p[0] != TS_SYNC_BYTE || pid(p) != audio_pid_) continue;
+    int adapt = adaptFieldLen(p);
+    if (adapt < 0) continue;
+    const uint8_t* pay = p + 4 + adapt;
+    size_t pay_len = TS_PKT_SIZE - 4 - adapt;
+    if (pay_len == 0) continue;
+    if (payloadUnitStart(p)) {
+      int64_t pts, dts;
+      size_t pes_head = pesHeaderLength(pay, pay_len, pts, dts);
+      started = pes_head != 0;
+      if (!started) continue;
+      starts.push_back(PesStart{es.size(), pts});
+      pay     += pes_head;
+      pay_len -= pes_head;
+    }
+    if (started) es.insert(es.end(), pay, pay + pay_len);
+  }
+
+  // Split into ADTS frames. A PES timestamp belongs to the first frame starting in that PES,
+  // the ones after it are timed by the samples in between.
+  size_t nextStart = 0;
+  int64_t basePts = -1;
+  int64_t samplesSinceBase = 0;
+  size_t pos = base;
+  while (pos + 7 <= es.size()) {
+    const uint8_t* h = es.data() + pos;
+    int frameLen = ((h[3] & 0x03) << 11) | (h[4] << 3) | (h[5] >> 5);
+    int sampleRate = kAdtsSampleRates[(h[2] >> 2) & 0x0F];
+    if (h[0] != 0xFF || (h[1] & 0xF6) != 0xF0 || frameLen < 7 || !sampleRate) {
+      ++pos; // lost sync, look for the next frame
+      continue;
+    }
+    if (pos + frameLen > es.size()) break; // truncated last frame
+
+    bool fromPes = false;
+    while (nextStart < starts.size() && starts[nextStart].offset <= pos) {
+      if (starts[nextStart].pts >= 0) {
+        basePts = starts[nextStart].pts;
+        fromPes = true;
+      }
+      ++nextStart;
+    }
+    if (fromPes) samplesSinceBase = 0;
+    int samples = 1024 * ((h[6] & 0x03) + 1);
+    int64_t pts = basePts < 0 ? -1 : (basePts + samplesSinceBase * 90000 / sampleRate) & ((1LL << 33) - 1);
+    int channels = ((h[2] & 0x01) << 2) | (h[3] >> 6);
+    frames.push_back(TsAudioFrame{pos, frameLen, pts, sampleRate, channels ? channels : 2, samples});
+    samplesSinceBase += samples;
+    pos += frameLen;
+  }
+}
+
+std::unique_ptr<HelperH264Frame> HelperTsH264FileParser::getH264Frame() {
+  const uint8_t* ptr; 
+  PooledAuBuffer pooled;
+  int64_t pts, dts;
+  
+  size_t len = _readOnePes(ptr, pooled, pts, dts);
+  if (!len) { 
+    // EOF reached, reset for looping
+    offset_ = 0; 
+    return nullptr; 
+  }
+
+  // One scan of the assembled AU, also across start codes split between TS packets
+  unsigned flags = scanAccessUnit(codec_, ptr, len);
+  std::unique_ptr<HelperH264Frame> frame(
+      new HelperH264Frame(flags & NAL_FLAG_IDR, ptr, static_cast<int>(len), pts, dts));
+  frame->nalFlags = flags;
+  frame->codec = codec_;
+  if (pooled) {
+    frame->pooled = std::move(pooled);
+  } else {
+    frame->owner = mapping_;
+  }
+  return frame;
+}
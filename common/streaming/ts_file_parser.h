@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "stream_frame.h"
+
+// Demuxes the first H.264 (stream type 0x1B) or H.265 (0x24) program of a segment into
+// access units; codec() tells which one the segment carries. readAacFrames() returns the
+// program's ADTS AAC stream (0x0F), if it has one.
+class HelperTsH264FileParser {
+public:
+  explicit HelperTsH264FileParser(const char* filepath);
+  ~HelperTsH264FileParser();
+  
+  bool initialize();
+  void setFileParseRestart();
+  std::unique_ptr<HelperH264Frame> getH264Frame();
+  NalCodec codec() const { return codec_; }
+  bool hasAudio() const { return audio_pid_ != 0; }
+  // The mapped file, valid after initialize()
+  const uint8_t* fileData() const { return data_; }
+  size_t fileSize() const { return size_; }
+  // Largest access unit assembled so far
+  size_t peakAuSize() const { return peakAuSize_; }
+  // Appends every ADTS frame of the audio PID to es/frames, independent of getH264Frame()'s position
+  void readAacFrames(std::vector<uint8_t>& es, std::vector<TsAudioFrame>& frames);
+  static void setLogger(std::function<void(const char*)> fn);
+
+private:
+  bool _probeProgramPids();
+  size_t _readOnePes(const uint8_t*& out, PooledAuBuffer& pooled, int64_t& pts, int64_t& dts);
+  
+  std::string file_path_;
+  int fd_ = -1;
+  uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  size_t offset_ = 0;
+  uint16_t video_pid_ = 0;
+  uint16_t audio_pid_ = 0;
+  NalCodec codec_ = NAL_CODEC_H264;
+  std::shared_ptr<const void> mapping_; // owns the mmap, shared with frames that point into it
+  std::vector<std::pair<const uint8_t*, size_t>> chunks_; // payload runs of the current PES
+  size_t peakAuSize_ = 0;
+};
@@ -0,0 +1,869 @@
+#include "video_send_task.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+
+#include "common/helper.h"
+#include "control_channel.h"
+#include "frame_prefetcher.h"
+#include "preload_executor.h"
+#include "stream_util.h"
+
+#define PACING_STATS_INTERVAL_S (10)
+// low stream frames within this many 90 kHz ticks of the high stream are paced by timestamp
+#define SIMULCAST_MAX_SKEW (90000)
+// pts pacing sends audio at most this far behind the video frame it rides on
+#define AUDIO_MAX_LEAD_MS (100)
+
+void sendOneH264Frame(int frameRate, std::unique_ptr<HelperH264Frame> h264Frame,
+                      agora::agora_refptr<agora::rtc::IVideoEncodedImageSender> videoH264FrameSender,
+                      agora::rtc::VIDEO_STREAM_TYPE streamType, StreamMetrics* metrics, FrameMetadata* metadata,
+                      uint64_t frameIndex) {
+  if (metadata && metadata->enabled()) {
+    metadata->apply(*h264Frame, frameIndex);
+  }
+  agora::rtc::EncodedVideoFrameInfo videoEncodedFrameInfo;
+  videoEncodedFrameInfo.rotation = agora::rtc::VIDEO_ORIENTATION_0;
+  videoEncodedFrameInfo.codecType =
+      h264Frame->codec == NAL_CODEC_H265 ? agora::rtc::VIDEO_CODEC_H265 : agora::rtc::VIDEO_CODEC_H264;
+  videoEncodedFrameInfo.framesPerSecond = frameRate;
+  videoEncodedFrameInfo.streamType = streamType;
+  videoEncodedFrameInfo.frameType =
+      (h264Frame.get()->isKeyFrame ? agora::rtc::VIDEO_FRAME_TYPE::VIDEO_FRAME_TYPE_KEY_FRAME
+                                   : agora::rtc::VIDEO_FRAME_TYPE::VIDEO_FRAME_TYPE_DELTA_FRAME);
+
+  auto callStart = std::chrono::steady_clock::now();
+  videoH264FrameSender->sendEncodedVideoImage(
+      h264Frame.get()->buffer, h264Frame.get()->bufferLen,
+      videoEncodedFrameInfo);
+  if (metrics) {
+    metrics->sendCallUs.record(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - callStart).count());
+    metrics->framesSent.add();
+    metrics->bytesSent.add(h264Frame->bufferLen);
+    if (h264Frame->isKeyFrame) metrics->keyFrames.add();
+    if (metrics->startup.mark(metrics->startup.firstFrameUs)) {
+      const StartupMetrics& startup = metrics->startup;
+      printf("Startup of %s: first frame after %.1f ms (media loaded %.1f ms, service %.1f ms, connected %.1f ms)\n",
+             metrics->streamId.c_str(), startup.firstFrameUs / 1e3, startup.mediaUs / 1e3,
+             startup.serviceUs / 1e3, startup.connectUs / 1e3);
+    }
+  }
+}
+
+void sendOneAacFrame(const TsAudioFrame& audio, const uint8_t* audioData,
+                     agora::agora_refptr<agora::rtc::IAudioEncodedFrameSender> audioFrameSender,
+                     StreamMetrics* metrics) {
+  agora::rtc::EncodedAudioFrameInfo audioFrameInfo;
+  audioFrameInfo.speech = false;
+  audioFrameInfo.codec = agora::rtc::AUDIO_CODEC_AACLC;
+  audioFrameInfo.sampleRateHz = audio.sampleRateHz;
+  audioFrameInfo.samplesPerChannel = audio.samplesPerChannel;
+  audioFrameInfo.sendEvenIfEmpty = true;
+  audioFrameInfo.numberOfChannels = audio.channels;
+  audioFrameSender->sendEncodedAudioFrame(audioData + audio.offset, audio.size, audioFrameInfo);
+  if (metrics) {
+    metrics->audioFramesSent.add();
+  }
+}
+
+void warmVideos(const std::string& data, uint64_t id, size_t lookahead) {
+  std::vector<std::string> videos;
+  std::istringstream fields(data);
+  std::string video;
+  while (fields >> video) {
+    videos.push_back(video);
+  }
+  if (videos.empty()) {
+    ControlChannel::instance().error(id, "video required");
+    return;
+  }
+  auto start = std::chrono::steady_clock::now();
+  std::shared_ptr<std::atomic<size_t>> left = std::make_shared<std::atomic<size_t>>(videos.size());
+  std::shared_ptr<std::atomic<bool>> failed = std::make_shared<std::atomic<bool>>(false);
+  for (const std::string& input : videos) {
+    PreloadExecutor::instance().submit(PreloadExecutor::WARM, nullptr, [input, id, lookahead, start, left, failed]() {
+      RenditionController renditions;
+      PlaylistManager manager(lookahead);
+      if (manager.warmPlaylist(resolveRenditions(input, renditions))) {
+        printf("Warmed video: %s\n", input.c_str());
+      } else {
+        printf("Failed to warm video: %s\n", input.c_str());
+        *failed = true;
+      }
+      if (--*left == 0) {
+        if (*failed) {
+          ControlChannel::instance().error(id, "warm failed");
+        } else {
+          ControlChannel::instance().reply(id, "done",
+              ",\"warm_ms\":" + jsonMs(start, std::chrono::steady_clock::now()));
+        }
+      }
+    });
+  }
+}
+
+// Where preload threads report to their send thread. Built on a dup of the send thread's wake
+// eventfd, so a late post after the stream is gone touches nothing it freed.
+class PreloadMailbox {
+public:
+  explicit PreloadMailbox(int wakeFd) : wakeFd_(wakeFd >= 0 ? dup(wakeFd) : -1) {}
+  ~PreloadMailbox() {
+    if (wakeFd_ >= 0) close(wakeFd_);
+  }
+
+  void post(unsigned seq, bool loaded) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      done_.push_back(std::make_pair(seq, loaded));
+    }
+    if (wakeFd_ >= 0) {
+      uint64_t one = 1;
+      ssize_t ret = write(wakeFd_, &one, sizeof(one));
+      (void)ret;
+    }
+  }
+
+  // Moves the finished preloads, oldest first, into out
+  void take(std::vector<std::pair<unsigned, bool>>& out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::swap(out, done_);
+  }
+
+private:
+  std::mutex mutex_;
+  std::vector<std::pair<unsigned, bool>> done_;
+  int wakeFd_;
+};
+
+static int64_t steadyNowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// One stream's send loop. Its state is only touched by the send thread; the preloads it starts
+// run on the PreloadExecutor's workers and report back through the mailbox.
+class VideoSendTask {
+public:
+  VideoSendTask(const SampleOptions& options,
+                agora::agora_refptr<agora::rtc::IVideoEncodedImageSender> videoH264FrameSender,
+                agora::agora_refptr<agora::rtc::IAudioEncodedFrameSender> audioFrameSender,
+                std::shared_ptr<PlaylistManager> playlistManager, std::shared_ptr<PlaylistManager> lowPlaylistManager,
+                std::shared_ptr<RenditionController> renditions, std::shared_ptr<StreamMetrics> metrics,
+                CommandQueue& commands, const std::atomic<bool>& stopFlag);
+
+  void run();
+
+private:
+  enum SendResult { SENT, DROPPED, STOPPED };
+
+  void sendLowStream(unsigned highGeneration, int64_t highDts);
+  unsigned startPreload(const std::string& data, std::shared_ptr<PreloadTicket>& ticket, bool seek);
+  unsigned startRenditionPreload(const std::string& url, std::shared_ptr<PreloadTicket>& ticket);
+  void cancelPendingSwitch();
+  void requestDueCut();
+  void handlePreloadsDone();
+  void handleCommands();
+  void handleSwitch(Command& cmd);
+  void handlePreload(const Command& cmd);
+  void handleQueue(const Command& cmd);
+  void handleClearQueue(const Command& cmd);
+  void handleBandwidthEstimate(const Command& cmd);
+  bool sleepUntil(int64_t deadlineNs);
+  bool sleepUntilSyncPoint(int64_t deadlineNs, unsigned generation);
+  bool sendAudio(const TsAudioFrame* audio, int count, const uint8_t* audioData, int64_t anchorNs,
+                 int64_t dts, int64_t maxLeadNs);
+  SendResult sendFrame(std::unique_ptr<HelperH264Frame> h264Frame, unsigned generation, int64_t& audioAnchorNs);
+  void finishQueuedStart(uint64_t queuedId);
+  void finishSwitch();
+  void shutdown();
+
+  const SampleOptions& options_;
+  agora::agora_refptr<agora::rtc::IVideoEncodedImageSender> videoH264FrameSender_;
+  agora::agora_refptr<agora::rtc::IAudioEncodedFrameSender> audioFrameSender_;
+  std::shared_ptr<PlaylistManager> playlistManager_;
+  std::shared_ptr<PlaylistManager> lowPlaylistManager_;
+  std::shared_ptr<RenditionController> renditions_;
+  std::shared_ptr<StreamMetrics> metrics_;
+  CommandQueue& commands_;
+  const std::atomic<bool>& stopFlag_;
+
+  PacerInfo pacer_;
+  // "pts" pacing schedules each frame from its DTS on an absolute monotonic clock
+  bool ptsPacing_;
+  PtsPacerInfo ptsPacer_;
+
+  // Validated by main(); frameIndex_ numbers the high stream's frames for it
+  FrameMetadata metadata_;
+  uint64_t frameIndex_ = 0;
+
+  std::string pendingVideoSwitch_;
+  bool switchRequested_ = false;
+  bool switchIsRendition_ = false; // the pending switch only changes rendition, not content
+
+  // "gop" lets the current GOP finish before cutting, "immediate" cuts as soon as preload is done
+  const SwitchCut defaultCut_;
+  std::chrono::steady_clock::time_point switchRequestTime_, switchReadyTime_, switchCutTime_;
+  // The pending content switch: its control request, its preload, and when and where it may cut
+  uint64_t switchId_ = 0;
+  unsigned switchSeq_ = 0;
+  std::shared_ptr<PreloadTicket> switchTicket_;
+  bool switchPreloaded_ = false;
+  bool cutRequested_ = false;
+  int64_t switchAtMs_ = 0;
+  SwitchCut switchCut_; // kept after the cut, the low stream's stale frames follow it
+
+  // PRELOAD_VIDEO: the one loading, then the video a SWITCH_VIDEO can cut to without loading
+  unsigned preloadSeq_ = 0;
+  uint64_t preloadId_ = 0;
+  std::shared_ptr<PreloadTicket> preloadTicket_;
+  std::string preloadVideo_, preloadedVideo_;
+  std::chrono::steady_clock::time_point preloadRequestTime_;
+
+  // QUEUE_VIDEO entries not started yet, in queue order: their request ids and when they were queued
+  std::deque<std::pair<uint64_t, std::chrono::steady_clock::time_point>> queued_;
+
+  // Parsing, segment transitions and switches run on the prefetcher's reader thread,
+  // this thread only dequeues frames and sends them on time
+  std::shared_ptr<FramePrefetcher> prefetcher_;
+  unsigned sentGeneration_ = 0;
+  // Content switches sent so far; the low stream's generation follows this, rendition
+  // switches of the high stream don't cut the low stream
+  unsigned contentGeneration_ = 0;
+  // Simulcast low stream, read ahead the same way and sent in lockstep behind each high frame
+  std::shared_ptr<FramePrefetcher> lowPrefetcher_;
+
+  // The thread only ever blocks on its next deadline; a push() on the queue ends the sleep
+  // early through the eventfd, so commands cost nothing while none are pending.
+  int wakeFd_;
+  std::queue<Command> received_;
+
+  // Preloads run on the PreloadExecutor's workers holding the managers, so a stream can go away
+  // under one. They report back through the mailbox, which shares the queue's eventfd.
+  std::shared_ptr<PreloadMailbox> mailbox_;
+  unsigned lastPreloadSeq_ = 0;
+  std::vector<std::pair<unsigned, bool>> preloadsDone_;
+};
+
+VideoSendTask::VideoSendTask(const SampleOptions& options,
+                             agora::agora_refptr<agora::rtc::IVideoEncodedImageSender> videoH264FrameSender,
+                             agora::agora_refptr<agora::rtc::IAudioEncodedFrameSender> audioFrameSender,
+                             std::shared_ptr<PlaylistManager> playlistManager,
+                             std::shared_ptr<PlaylistManager> lowPlaylistManager,
+                             std::shared_ptr<RenditionController> renditions, std::shared_ptr<StreamMetrics> metrics,
+                             CommandQueue& commands, const std::atomic<bool>& stopFlag)
+  : options_(options), videoH264FrameSender_(videoH264FrameSender), audioFrameSender_(audioFrameSender),
+    playlistManager_(std::move(playlistManager)), lowPlaylistManager_(std::move(lowPlaylistManager)),
+    renditions_(std::move(renditions)), metrics_(std::move(metrics)), commands_(commands), stopFlag_(stopFlag),
+    pacer_{0, 1000 / options.video.frameRate, 0, std::chrono::steady_clock::now()},
+    ptsPacing_(options.video.pacing == "pts"),
+    defaultCut_((options.switchMode == "gop") ? CUT_AT_GOP : CUT_NOW), switchCut_(defaultCut_),
+    wakeFd_(commands.wakeFd()), mailbox_(std::make_shared<PreloadMailbox>(wakeFd_)) {
+  initPtsPacer(ptsPacer_, options.video.frameRate);
+  metadata_.configure(options.video.metadata, options.video.metadataPayload);
+  prefetcher_ = std::make_shared<FramePrefetcher>(playlistManager_, options.prefetch.depth,
+                                                  options.prefetch.highWater, options.prefetch.lowWater, commands);
+  if (lowPlaylistManager_) {
+    lowPrefetcher_ = std::make_shared<FramePrefetcher>(lowPlaylistManager_, options.prefetch.depth,
+                                                       options.prefetch.highWater, options.prefetch.lowWater,
+                                                       commands);
+  }
+}
+
+// Sends the low stream frames due by the high frame just sent: those up to its timestamp,
+// or one per high frame where the two renditions' timestamps can't be matched
+void VideoSendTask::sendLowStream(unsigned highGeneration, int64_t highDts) {
+  unsigned generation;
+  while (const HelperH264Frame* next = lowPrefetcher_->peek(generation)) {
+    int ahead = static_cast<int>(generation - highGeneration);
+    if (ahead > 0) {
+      break; // already cut over, held until the high stream follows
+    }
+    bool stale = ahead < 0;
+    int64_t skew = -1;
+    if (!stale && next->dts >= 0 && highDts >= 0) {
+      skew = ((next->dts - highDts + (1LL << 32)) & ((1LL << 33) - 1)) - (1LL << 32); // 33-bit wrap
+    }
+    bool matched = skew >= -SIMULCAST_MAX_SKEW && skew <= SIMULCAST_MAX_SKEW;
+    if (matched && skew > 0) {
+      break;
+    }
+    std::unique_ptr<HelperH264Frame> lowFrame;
+    lowPrefetcher_->pop(lowFrame, generation);
+    if (stale && switchCut_ == CUT_NOW) {
+      continue;
+    }
+    // numbered like the high frame it goes out behind
+    sendOneH264Frame(options_.video.frameRate, std::move(lowFrame), videoH264FrameSender_,
+                     agora::rtc::VIDEO_STREAM_LOW, metrics_.get(), &metadata_, frameIndex_ - 1);
+    if (!matched) {
+      break;
+    }
+  }
+}
+
+// Loads "<url> [<low rendition url>]" into both managers, posting its sequence number when done.
+// Both renditions are preloaded before either may cut, so they switch together. Cancelling
+// the ticket drops the job if it hasn't run and its result if it hasn't been published.
+// A seek names the sources already playing, so their renditions stay as they are.
+static void preloadSwitchJob(std::shared_ptr<PlaylistManager> playlistManager,
+                             std::shared_ptr<PlaylistManager> lowPlaylistManager,
+                             std::shared_ptr<RenditionController> renditions, std::shared_ptr<PreloadMailbox> mailbox,
+                             const std::string& data, unsigned seq, std::shared_ptr<const PreloadTicket> job,
+                             bool seek) {
+  std::string videoFile = data;
+  std::string lowVideoFile;
+  size_t space = videoFile.find(' ');
+  if (space != std::string::npos) {
+    lowVideoFile = videoFile.substr(space + 1);
+    videoFile.erase(space);
+  }
+  // "<url>@<ms>" starts both renditions at that position
+  int64_t startMs = splitStartPosition(videoFile);
+  std::string position = startMs >= 0 ? "@" + std::to_string(startMs) : std::string();
+  splitStartPosition(lowVideoFile); // the low rendition follows the high one's position
+  std::string lowestVariant;
+  if (!seek) {
+    videoFile = resolveRenditions(videoFile, *renditions, &lowestVariant);
+  }
+  videoFile += position;
+  if (!lowVideoFile.empty()) {
+    lowVideoFile += position;
+  } else if (!lowestVariant.empty()) {
+    lowestVariant += position;
+  }
+  if (lowPlaylistManager) {
+    if (lowVideoFile.empty() && !lowestVariant.empty()) {
+      lowVideoFile = lowestVariant;
+    }
+    if (lowVideoFile.empty()) {
+      printf("No low rendition given, the low stream carries %s too\n", videoFile.c_str());
+      lowVideoFile = videoFile;
+    }
+    if (!lowPlaylistManager->preloadNewPlaylist(lowVideoFile, false, job.get())) {
+      mailbox->post(seq, false);
+      return;
+    }
+  }
+  mailbox->post(seq, !job->cancelled() && playlistManager->preloadNewPlaylist(videoFile, false, job.get()));
+}
+
+unsigned VideoSendTask::startPreload(const std::string& data, std::shared_ptr<PreloadTicket>& ticket, bool seek) {
+  unsigned seq = ++lastPreloadSeq_;
+  ticket = std::make_shared<PreloadTicket>();
+  if (lowPlaylistManager_) {
+    lowPlaylistManager_->claimPreload(ticket);
+  }
+  playlistManager_->claimPreload(ticket);
+  std::shared_ptr<const PreloadTicket> job = ticket;
+  PreloadExecutor::instance().submit(PreloadExecutor::SWITCH, job,
+                                     std::bind(preloadSwitchJob, playlistManager_, lowPlaylistManager_, renditions_,
+                                               mailbox_, data, seq, job, seek));
+  return seq;
+}
+
+// Another rendition of what is playing, for the high stream only
+static void preloadRenditionJob(std::shared_ptr<PlaylistManager> playlistManager,
+                                std::shared_ptr<PreloadMailbox> mailbox, const std::string& url, unsigned seq,
+                                std::shared_ptr<const PreloadTicket> job) {
+  mailbox->post(seq, playlistManager->preloadNewPlaylist(url, true, job.get()));
+}
+
+unsigned VideoSendTask::startRenditionPreload(const std::string& url, std::shared_ptr<PreloadTicket>& ticket) {
+  unsigned seq = ++lastPreloadSeq_;
+  ticket = std::make_shared<PreloadTicket>();
+  playlistManager_->claimPreload(ticket);
+  std::shared_ptr<const PreloadTicket> job = ticket;
+  PreloadExecutor::instance().submit(PreloadExecutor::SWITCH, job,
+                                     std::bind(preloadRenditionJob, playlistManager_, mailbox_, url, seq, job));
+  return seq;
+}
+
+// Withdraws the pending switch: its preload, and its cut if the reader hasn't made it yet
+void VideoSendTask::cancelPendingSwitch() {
+  if (switchTicket_) {
+    switchTicket_->cancel();
+  }
+  if (cutRequested_) {
+    if (lowPrefetcher_ && !switchIsRendition_) {
+      lowPrefetcher_->cancelSwitch();
+    }
+    prefetcher_->cancelSwitch();
+  }
+}
+
+// Asks the prefetchers to cut once the pending switch is preloaded and due
+void VideoSendTask::requestDueCut() {
+  if (!switchRequested_ || !switchPreloaded_ || cutRequested_) return;
+  if (switchIsRendition_) {
+    // Same content, so the cut keeps the playhead's position and waits for a keyframe
+    prefetcher_->requestSwitch(CUT_AT_GOP);
+    cutRequested_ = true;
+    return;
+  }
+  if (switchAtMs_ > 0 && static_cast<int64_t>(now_ms_t()) < switchAtMs_) return;
+  if (lowPrefetcher_) {
+    lowPrefetcher_->requestSwitch(switchCut_);
+  }
+  prefetcher_->requestSwitch(switchCut_);
+  cutRequested_ = true;
+}
+
+void VideoSendTask::handlePreloadsDone() {
+  mailbox_->take(preloadsDone_);
+  for (const auto& done : preloadsDone_) {
+    if (done.first == preloadSeq_) {
+      if (done.second) {
+        printf("Video preloaded: %s\n", preloadVideo_.c_str());
+        ControlChannel::instance().reply(preloadId_, "done",
+            ",\"preload_ms\":" + jsonMs(preloadRequestTime_, std::chrono::steady_clock::now()));
+        if (done.first != switchSeq_) {
+          preloadedVideo_ = preloadVideo_;
+        }
+      } else {
+        ControlChannel::instance().error(preloadId_, "preload failed");
+      }
+      preloadSeq_ = 0;
+      preloadTicket_.reset();
+    }
+    if (switchRequested_ && done.first == switchSeq_) {
+      if (done.second) {
+        switchPreloaded_ = true;
+      } else {
+        printf("Video switch failed, could not load: %s\n", pendingVideoSwitch_.c_str());
+        ControlChannel::instance().error(switchId_, "preload failed");
+        switchRequested_ = false;
+        pendingVideoSwitch_.clear();
+      }
+    }
+  }
+  preloadsDone_.clear();
+  requestDueCut();
+}
+
+void VideoSendTask::handleCommands() {
+  commands_.drain(received_);
+  while (!received_.empty()) {
+    Command cmd = received_.front();
+    received_.pop();
+    switch (cmd.type) {
+      case Command::EXIT:
+        printf("Received exit command\n");
+        exitFlag = true;
+        break;
+
+      case Command::SEEK:
+      case Command::SWITCH_VIDEO:
+        handleSwitch(cmd);
+        break;
+
+      case Command::PRELOAD_VIDEO:
+        handlePreload(cmd);
+        break;
+
+      case Command::WARM_VIDEO:
+        warmVideos(cmd.data, cmd.id, options_.lookahead);
+        break;
+
+      case Command::ASSIGN:
+        printf("Stream already assigned, ignoring: %s\n", cmd.data.c_str());
+        ControlChannel::instance().error(cmd.id, "stream already assigned");
+        break;
+
+      case Command::QUEUE_VIDEO:
+        handleQueue(cmd);
+        break;
+
+      case Command::CLEAR_QUEUE:
+        handleClearQueue(cmd);
+        break;
+
+      case Command::BANDWIDTH_ESTIMATE:
+        handleBandwidthEstimate(cmd);
+        break;
+
+      default:
+        break;
+    }
+  }
+  handlePreloadsDone();
+}
+
+void VideoSendTask::handleSwitch(Command& cmd) {
+  bool seek = cmd.type == Command::SEEK;
+  if (seek) {
+    // A switch to the sources playing now, at the position; the output timeline restarts there
+    if (!isInteger(cmd.data) || cmd.data[0] == '-') {
+      printf("Invalid seek position: %s\n", cmd.data.c_str());
+      ControlChannel::instance().error(cmd.id, "invalid position");
+      return;
+    }
+    std::string at = "@" + cmd.data;
+    cmd.data = playlistManager_->getCurrentVideoFile() + at;
+    if (lowPlaylistManager_) {
+      cmd.data += " " + lowPlaylistManager_->getCurrentVideoFile() + at;
+    }
+    printf("Processing seek to: %s\n", cmd.data.c_str());
+  } else {
+    printf("Processing video switch to: %s\n", cmd.data.c_str());
+  }
+  if (switchRequested_) {
+    cancelPendingSwitch(); // only the newest switch wins
+    ControlChannel::instance().error(switchId_, "superseded by a newer switch");
+  }
+  pendingVideoSwitch_ = cmd.data;
+  switchRequested_ = true;
+  switchIsRendition_ = false;
+  switchRequestTime_ = std::chrono::steady_clock::now();
+  switchId_ = cmd.id;
+  switchAtMs_ = cmd.atMs;
+  switchCut_ = defaultCut_;
+  switchPreloaded_ = false;
+  cutRequested_ = false;
+  if (!seek && !preloadedVideo_.empty() && cmd.data == preloadedVideo_) {
+    switchSeq_ = 0; // a PRELOAD_VIDEO already loaded it
+    switchTicket_.reset();
+    switchPreloaded_ = true;
+  } else if (!seek && preloadSeq_ && cmd.data == preloadVideo_) {
+    switchSeq_ = preloadSeq_; // finishes with the preload still loading it
+    switchTicket_ = preloadTicket_;
+  } else {
+    if (preloadSeq_) {
+      preloadTicket_->cancel();
+      ControlChannel::instance().error(preloadId_, "superseded by a switch");
+      preloadSeq_ = 0;
+    }
+    switchSeq_ = startPreload(cmd.data, switchTicket_, seek);
+  }
+  preloadedVideo_.clear();
+}
+
+void VideoSendTask::handlePreload(const Command& cmd) {
+  // ready_ holds one preloaded source, a pending switch needs it
+  if (switchRequested_) {
+    ControlChannel::instance().error(cmd.id, "a switch is in progress");
+    return;
+  }
+  if (preloadSeq_) {
+    preloadTicket_->cancel();
+    ControlChannel::instance().error(preloadId_, "superseded by a newer preload");
+  }
+  printf("Preloading video: %s\n", cmd.data.c_str());
+  preloadVideo_ = cmd.data;
+  preloadedVideo_.clear();
+  preloadId_ = cmd.id;
+  preloadRequestTime_ = std::chrono::steady_clock::now();
+  preloadSeq_ = startPreload(cmd.data, preloadTicket_, false);
+}
+
+// Loads a queued video into both managers' entries. A master playlist plays its top variant;
+// adaptive switching stays with the content a stream was started or switched to.
+static void prepareQueuedJob(std::shared_ptr<PlaylistManager> playlistManager,
+                             std::shared_ptr<PlaylistManager> lowPlaylistManager, std::shared_ptr<QueuedVideo> entry,
+                             std::shared_ptr<QueuedVideo> lowEntry, const std::string& videoFile,
+                             const std::string& lowVideoFile) {
+  RenditionController variants;
+  std::string lowest;
+  std::string high = resolveRenditions(videoFile, variants, &lowest);
+  std::unique_ptr<PlaylistSource> source = playlistManager->prepareQueued(high);
+  std::unique_ptr<PlaylistSource> lowSource;
+  if (lowEntry && source && !entry->ticket->cancelled()) {
+    lowSource = lowPlaylistManager->prepareQueued(
+        !lowVideoFile.empty() ? lowVideoFile : !lowest.empty() ? lowest : high);
+  }
+  // Both renditions play the entry, or both skip it
+  bool loaded = source && (!lowEntry || lowSource);
+  if (lowEntry) {
+    lowPlaylistManager->fillQueued(*lowEntry, loaded ? std::move(lowSource) : nullptr);
+  }
+  playlistManager->fillQueued(*entry, loaded ? std::move(source) : nullptr);
+  if (!loaded && !entry->ticket->cancelled()) {
+    printf("Queued video failed to load: %s\n", videoFile.c_str());
+    ControlChannel::instance().error(entry->id, "preload failed");
+  }
+}
+
+// QUEUE_VIDEO:<url> [<low rendition url>], both renditions follow on at their own end
+void VideoSendTask::handleQueue(const Command& cmd) {
+  printf("Queueing video: %s\n", cmd.data.c_str());
+  std::string videoFile = cmd.data;
+  std::string lowVideoFile;
+  size_t space = videoFile.find(' ');
+  if (space != std::string::npos) {
+    lowVideoFile = videoFile.substr(space + 1);
+    videoFile.erase(space);
+  }
+  std::shared_ptr<QueuedVideo> entry = playlistManager_->enqueue(videoFile, cmd.id);
+  std::shared_ptr<QueuedVideo> lowEntry = lowPlaylistManager_ ? lowPlaylistManager_->enqueue(videoFile, 0) : nullptr;
+  if (lowEntry) {
+    lowEntry->ticket = entry->ticket; // cleared together
+  }
+  queued_.push_back(std::make_pair(cmd.id, std::chrono::steady_clock::now()));
+  PreloadExecutor::instance().submit(PreloadExecutor::SWITCH, entry->ticket,
+                                     std::bind(prepareQueuedJob, playlistManager_, lowPlaylistManager_, entry,
+                                               lowEntry, videoFile, lowVideoFile));
+}
+
+void VideoSendTask::handleClearQueue(const Command& cmd) {
+  std::vector<std::shared_ptr<QueuedVideo>> removed = playlistManager_->clearQueue();
+  if (lowPlaylistManager_) {
+    lowPlaylistManager_->clearQueue();
+  }
+  for (const auto& entry : removed) {
+    ControlChannel::instance().error(entry->id, "queue cleared");
+  }
+  queued_.clear();
+  printf("Cleared %zu queued video(s)\n", removed.size());
+  ControlChannel::instance().reply(cmd.id, "done", ",\"cleared\":" + std::to_string(removed.size()));
+}
+
+void VideoSendTask::handleBandwidthEstimate(const Command& cmd) {
+  // One adaptive switch at a time, and none while a requested video is loading
+  M3U8Variant variant;
+  auto now = std::chrono::steady_clock::now();
+  if (switchRequested_ || preloadSeq_ || !renditions_->onEstimate(std::atoi(cmd.data.c_str()), now, variant)) {
+    return;
+  }
+  printf("Bandwidth estimate %d kbps, switching rendition to %ld kbps: %s\n",
+         std::atoi(cmd.data.c_str()) / 1000, variant.bandwidth / 1000, variant.url.c_str());
+  pendingVideoSwitch_ = variant.url;
+  switchRequested_ = true;
+  switchIsRendition_ = true;
+  switchRequestTime_ = now;
+  switchId_ = 0;
+  switchPreloaded_ = false;
+  cutRequested_ = false;
+  preloadedVideo_.clear(); // its preload replaces the held one
+  switchSeq_ = startRenditionPreload(variant.url, switchTicket_);
+}
+
+// Sleeps until deadlineNs, serving commands as they arrive. False once the stream is stopping.
+bool VideoSendTask::sleepUntil(int64_t deadlineNs) {
+  while (!sleepUntilDeadline(deadlineNs, wakeFd_)) {
+    handleCommands();
+    if (exitFlag || stopFlag_) return false;
+  }
+  return !exitFlag && !stopFlag_;
+}
+
+// Sleeps until a sync point of the epoch's timeline, which can be seconds away. An immediate cut
+// drops the frame meanwhile, so that is checked every 10 ms. False when it did or the stream is stopping.
+bool VideoSendTask::sleepUntilSyncPoint(int64_t deadlineNs, unsigned generation) {
+  while (sleepUntil(std::min<int64_t>(deadlineNs, steadyNowNs() + 10 * 1000000LL))) {
+    if (steadyNowNs() >= deadlineNs) return true;
+    if (switchRequested_ && !switchIsRendition_ && switchCut_ == CUT_NOW && generation != prefetcher_->generation()) {
+      return false;
+    }
+  }
+  return false;
+}
+
+// Sends the AAC frames riding on the high frame just sent, each at its PTS offset from the
+// frame's DTS on the frame's own schedule, so both follow one clock. False once the stream is stopping.
+bool VideoSendTask::sendAudio(const TsAudioFrame* audio, int count, const uint8_t* audioData, int64_t anchorNs,
+                              int64_t dts, int64_t maxLeadNs) {
+  for (int i = 0; i < count; ++i) {
+    int64_t lead = 0;
+    if (audio[i].pts >= 0 && dts >= 0) {
+      lead = ((audio[i].pts - dts + (1LL << 32)) & ((1LL << 33) - 1)) - (1LL << 32); // 33-bit wrap
+      lead = std::max<int64_t>(0, std::min(lead * 100000 / 9, maxLeadNs));
+    }
+    if (lead > 0 && !sleepUntil(anchorNs + lead)) return false;
+    sendOneAacFrame(audio[i], audioData, audioFrameSender_, metrics_.get());
+  }
+  return true;
+}
+
+// Sends a high stream frame when it is due. audioAnchorNs receives the time its audio is
+// scheduled from: its deadline with pts pacing, the send time with fps pacing.
+VideoSendTask::SendResult VideoSendTask::sendFrame(std::unique_ptr<HelperH264Frame> h264Frame, unsigned generation,
+                                                   int64_t& audioAnchorNs) {
+  if (!ptsPacing_) {
+    audioAnchorNs = steadyNowNs();
+    sendOneH264Frame(options_.video.frameRate, std::move(h264Frame), videoH264FrameSender_,
+                     agora::rtc::VIDEO_STREAM_HIGH, metrics_.get(), &metadata_, frameIndex_++);
+    return SENT;
+  }
+  if (h264Frame->dueUs) {
+    // A sync point of the shared epoch's timeline, wall clock onto the monotonic one
+    int64_t wallUs = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    audioAnchorNs = anchorFrameDeadline(ptsPacer_, h264Frame->dts,
+                                        steadyNowNs() + (h264Frame->dueUs - wallUs) * 1000);
+    if (!sleepUntilSyncPoint(audioAnchorNs, generation)) {
+      return exitFlag || stopFlag_ ? STOPPED : DROPPED; // an immediate cut dropped it
+    }
+  } else {
+    audioAnchorNs = scheduleFrameDeadline(ptsPacer_, h264Frame->dts);
+    if (!sleepUntil(audioAnchorNs)) return STOPPED;
+  }
+  metrics_->latenessUs.record(recordFrameLateness(ptsPacer_) / 1000);
+  sendOneH264Frame(options_.video.frameRate, std::move(h264Frame), videoH264FrameSender_,
+                   agora::rtc::VIDEO_STREAM_HIGH, metrics_.get(), &metadata_, frameIndex_++);
+  reportPtsPacerStats(ptsPacer_, PACING_STATS_INTERVAL_S);
+  return SENT;
+}
+
+// A queued video took over at the end of the last one, with no cut on this side
+void VideoSendTask::finishQueuedStart(uint64_t queuedId) {
+  auto sent = std::chrono::steady_clock::now();
+  printf("Now playing queued video: %s\n", playlistManager_->getCurrentVideoFile().c_str());
+  // Rendition steps of the video before no longer apply
+  renditions_->reset(std::vector<M3U8Variant>());
+  if (switchRequested_ && switchIsRendition_) {
+    cancelPendingSwitch();
+    switchRequested_ = false;
+  }
+  while (!queued_.empty() && queued_.front().first != queuedId) {
+    queued_.pop_front(); // failed to load and skipped
+  }
+  if (!queued_.empty()) {
+    ControlChannel::instance().reply(queuedId, "done",
+        ",\"video\":\"" + jsonEscape(playlistManager_->getCurrentVideoFile()) + "\",\"wait_ms\":" +
+        jsonMs(queued_.front().second, sent));
+    queued_.pop_front();
+  }
+}
+
+// Measured up to the first frame of the new source leaving for the SDK
+void VideoSendTask::finishSwitch() {
+  typedef std::chrono::duration<double, std::milli> Ms;
+  auto sent = std::chrono::steady_clock::now();
+  prefetcher_->lastSwitchTimes(switchReadyTime_, switchCutTime_);
+  switchReadyTime_ = std::max(switchReadyTime_, switchRequestTime_); // preloaded ahead with PRELOAD_VIDEO
+  printf("Successfully switched video to: %s\n", pendingVideoSwitch_.c_str());
+  printf("Switch latency: %.1f ms (preload %.1f ms, wait for cut %.1f ms, first frame %.1f ms)\n",
+         Ms(sent - switchRequestTime_).count(), Ms(switchReadyTime_ - switchRequestTime_).count(),
+         Ms(switchCutTime_ - switchReadyTime_).count(), Ms(sent - switchCutTime_).count());
+  metrics_->switchUs.record(std::chrono::duration_cast<std::chrono::microseconds>(sent - switchRequestTime_).count());
+  ControlChannel::instance().reply(switchId_, "done",
+      ",\"video\":\"" + jsonEscape(pendingVideoSwitch_) + "\",\"preload_ms\":" +
+      jsonMs(switchRequestTime_, switchReadyTime_) + ",\"wait_ms\":" + jsonMs(switchReadyTime_, switchCutTime_) +
+      ",\"first_frame_ms\":" + jsonMs(switchCutTime_, sent) + ",\"total_ms\":" + jsonMs(switchRequestTime_, sent));
+  switchRequested_ = false;
+  pendingVideoSwitch_.clear();
+}
+
+void VideoSendTask::run() {
+  prefetcher_->start();
+  sentGeneration_ = prefetcher_->generation();
+  if (lowPrefetcher_) {
+    lowPrefetcher_->start();
+  }
+
+  handleCommands();
+  bool dry = true;
+  while (!exitFlag && !stopFlag_) {
+    requestDueCut(); // a timed switch comes due at the frame sent at or after its time
+    std::unique_ptr<HelperH264Frame> h264Frame;
+    unsigned generation;
+    if (!prefetcher_->pop(h264Frame, generation)) {
+      if (!dry) {
+        metrics_->underruns.add();
+        dry = true;
+      }
+      // Ring ran dry (next segment still downloading), the reader wakes us with its next frame
+      sleepUntil(steadyNowNs() + 10 * 1000000LL);
+      continue;
+    }
+    dry = false;
+    metrics_->prefetchDepth.store(prefetcher_->size(), std::memory_order_relaxed);
+
+    // An immediate cut drops what was prefetched from the old source; other cuts play it out
+    if (switchRequested_ && !switchIsRendition_ && switchCut_ == CUT_NOW && generation != prefetcher_->generation()) {
+      continue;
+    }
+    int64_t dts = h264Frame->dts;
+    // Audio timestamps are the source's own, before the output timeline's offset
+    int64_t audioDts = dts < 0 ? dts : (dts - h264Frame->timestampOffset) & ((1LL << 33) - 1);
+    bool startsQueued = h264Frame->startsQueued;
+    uint64_t queuedId = h264Frame->queuedId;
+    const TsAudioFrame* audio = audioFrameSender_ ? h264Frame->audio : nullptr;
+    int audioCount = audio ? h264Frame->audioCount : 0;
+    const uint8_t* audioData = h264Frame->audioData;
+    std::shared_ptr<const void> audioOwner; // keeps the audio frames alive past the video send
+    if (audioCount) {
+      audioOwner = h264Frame->owner;
+    }
+    bool firstOfSwitch = false;
+    if (generation != sentGeneration_) {
+      sentGeneration_ = generation;
+      firstOfSwitch = switchRequested_;
+      if (firstOfSwitch && !switchIsRendition_) {
+        ++contentGeneration_;
+      }
+    }
+
+    int64_t audioAnchorNs;
+    SendResult result = sendFrame(std::move(h264Frame), generation, audioAnchorNs);
+    if (result == STOPPED) break;
+    if (result == DROPPED) continue;
+    if (lowPrefetcher_) {
+      sendLowStream(contentGeneration_, dts);
+    }
+    // fps pacing keeps audio inside the frame's tick so the video cadence never slips
+    if (audioCount && !sendAudio(audio, audioCount, audioData, audioAnchorNs, audioDts,
+                                 ptsPacing_ ? AUDIO_MAX_LEAD_MS * 1000000LL : pacer_.sendIntervalInMs * 1000000LL)) {
+      break;
+    }
+    prefetcher_->reportStats(PACING_STATS_INTERVAL_S);
+
+    if (startsQueued) {
+      finishQueuedStart(queuedId);
+    }
+    if (firstOfSwitch) {
+      finishSwitch();
+    }
+    if (!ptsPacing_) {
+      int64_t deadline = nextSendDeadline(pacer_);
+      if (sleepUntil(deadline)) {
+        metrics_->latenessUs.record((steadyNowNs() - deadline) / 1000);
+      }
+    }
+  }
+  shutdown();
+}
+
+// Stops the readers and fails whatever is still pending
+void VideoSendTask::shutdown() {
+  prefetcher_->stop();
+  if (lowPrefetcher_) {
+    lowPrefetcher_->stop();
+  }
+  if (switchRequested_) {
+    cancelPendingSwitch();
+    ControlChannel::instance().error(switchId_, "stream stopped");
+  }
+  if (preloadSeq_) {
+    preloadTicket_->cancel();
+    ControlChannel::instance().error(preloadId_, "stream stopped");
+  }
+  for (const auto& entry : playlistManager_->clearQueue()) {
+    ControlChannel::instance().error(entry->id, "stream stopped");
+  }
+  if (lowPlaylistManager_) {
+    lowPlaylistManager_->clearQueue();
+  }
+}
+
+void SampleSendVideoH264Task(
+    const SampleOptions& options,
+    agora::agora_refptr<agora::rtc::IVideoEncodedImageSender> videoH264FrameSender,
+    agora::agora_refptr<agora::rtc::IAudioEncodedFrameSender> audioFrameSender,
+    std::shared_ptr<PlaylistManager> playlistManager, std::shared_ptr<PlaylistManager> lowPlaylistManager,
+    std::shared_ptr<RenditionController> renditions, std::shared_ptr<StreamMetrics> metrics,
+    CommandQueue& commands, const std::atomic<bool>& stopFlag) {
+  VideoSendTask task(options, videoH264FrameSender, audioFrameSender, std::move(playlistManager),
+                     std::move(lowPlaylistManager), std::move(renditions), std::move(metrics), commands, stopFlag);
+  task.run();
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "NGIAgoraMediaNode.h"
+#include "command_queue.h"
+#include "frame_metadata.h"
+#include "metrics_registry.h"
+#include "playlist_manager.h"
+#include "rendition_controller.h"
+#include "sample_options.h"
+#include "stream_frame.h"
+
+void sendOneH264Frame(int frameRate, std::unique_ptr<HelperH264Frame> h264Frame,
+                      agora::agora_refptr<agora::rtc::IVideoEncodedImageSender> videoH264FrameSender,
+                      agora::rtc::VIDEO_STREAM_TYPE streamType = agora::rtc::VIDEO_STREAM_HIGH,
+                      StreamMetrics* metrics = nullptr, FrameMetadata* metadata = nullptr, uint64_t frameIndex = 0);
+
+// ADTS frames go out whole, header included, as the SDK takes for AAC
+void sendOneAacFrame(const TsAudioFrame& audio, const uint8_t* audioData,
+                     agora::agora_refptr<agora::rtc::IAudioEncodedFrameSender> audioFrameSender,
+                     StreamMetrics* metrics = nullptr);
+
+// WARM_VIDEO:<url> [<url> ...] indexes videos the app expects to switch to into the shared
+// segment store, at warm priority so they never hold up a switch. Master playlists warm the
+// variant a stream would start on. The request is answered once every video was warmed.
+void warmVideos(const std::string& data, uint64_t id, size_t lookahead);
+
+// The send thread of one stream: paces the prefetched frames of playlistManager out to the SDK,
+// the simulcast low stream and the audio behind them, and serves the stream's commands until
+// an EXIT, exitFlag or stopFlag. lowPlaylistManager and audioFrameSender may be null.
+void SampleSendVideoH264Task(
+    const SampleOptions& options,
+    agora::agora_refptr<agora::rtc::IVideoEncodedImageSender> videoH264FrameSender,
+    agora::agora_refptr<agora::rtc::IAudioEncodedFrameSender> audioFrameSender,
+    std::shared_ptr<PlaylistManager> playlistManager, std::shared_ptr<PlaylistManager> lowPlaylistManager,
+    std::shared_ptr<RenditionController> renditions, std::shared_ptr<StreamMetrics> metrics,
+    CommandQueue& commands, const std::atomic<bool>& stopFlag);
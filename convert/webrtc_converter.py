@@ -20,13 +20,15 @@ import urllib.parse
 from pathlib import Path
 
 class WebRTCConverter:
-    def __init__(self, input_file, bitrate_kbps, output_dir, segment_length=2, width=None, height=None):
+    def __init__(self, input_file, bitrate_kbps, output_dir, segment_length=2, width=None, height=None,
+                 audio=False):
         self.input_file = input_file
         self.bitrate_kbps = bitrate_kbps
         self.output_dir = output_dir
         self.segment_length = segment_length
         self.width = width
         self.height = height
+        self.audio = audio
         self.temp_file = None
         self.temp_dir = None
         self.is_url = self.is_remote_url(input_file)
@@ -313,10 +315,16 @@ class WebRTCConverter:
             '-refs', '1',                  # Single reference frame
             '-coder', '0',                 # CAVLC (not CABAC)
             '-fast-pskip', '1',            # Fast skip decisions
-            
+        ])
+        
+        if self.audio:
+            # AAC in ADTS, published by the controller with --audio
+            ffmpeg_cmd.extend(['-c:a', 'aac', '-b:a', '128k', '-ar', '48000'])
+        else:
             # Disable audio output
-            '-an',
-            
+            ffmpeg_cmd.append('-an')
+        
+        ffmpeg_cmd.extend([
             # HLS segmentation
             '-f', 'hls',
             '-hls_time', str(self.segment_length),
@@ -492,7 +500,10 @@ class WebRTCConverter:
             print("✓ Keyframes every 2 seconds")
             print("✓ No B-frames (P-frames only)")
             print("✓ Single reference frame")
-            print("✓ Video-only output (no audio)")
+            if self.audio:
+                print("✓ AAC audio (128kbps, 48kHz)")
+            else:
+                print("✓ Video-only output (no audio)")
             if self.width or self.height:
                 print(f"✓ Custom resolution: {self.width or 'auto'}x{self.height or 'auto'}")
             
@@ -531,6 +542,8 @@ Examples:
                        help='Output width in pixels (optional, maintains aspect ratio if height not specified)')
     parser.add_argument('--height', type=int,
                        help='Output height in pixels (optional, maintains aspect ratio if width not specified)')
+    parser.add_argument('--audio', action='store_true',
+                       help='Keep the audio as AAC instead of dropping it')
     
     args = parser.parse_args()
     
@@ -558,7 +571,8 @@ Examples:
             output_dir=args.output,
             segment_length=args.segment_length,
             width=args.width,
-            height=args.height
+            height=args.height,
+            audio=args.audio
         )
         
         output_m3u8 = converter.convert()
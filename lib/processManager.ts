@@ -1,4 +1,91 @@
 import { spawn, ChildProcess } from 'child_process';
+import * as os from 'os';
+import { Duplex } from 'stream';
+
+// Standby pool: AGORA_STANDBY_WORKERS binaries kept running with --standby, their SDK service up,
+// each handed the next start with an assign request. AGORA_STANDBY_WARM lists videos (separated by
+// spaces) they index ahead. A worker is only added while the host keeps this share of its memory
+// free with it, at the largest RSS a worker reported so far.
+const STANDBY_MIN_FREE_FRACTION = 0.2;
+const STANDBY_DEFAULT_RSS_BYTES = 200 * 1024 * 1024;
+const STANDBY_REFILL_DELAY_MS = 1000;
+
+// A reply on the control channel; 'done' replies carry the request's results
+export interface ControlReply {
+  id: number;
+  status: 'accepted' | 'done' | 'error';
+  error?: string;
+  [field: string]: any;
+}
+
+// Requests to the binary's --controlFd socket: each message is a 4-byte big-endian length
+// followed by a JSON object. The binary answers every request by id, first 'accepted', then
+// 'done' or 'error'.
+export class ControlClient {
+  private nextId = 1;
+  private buffer = Buffer.alloc(0);
+  private pending = new Map<number, { resolve: (reply: ControlReply) => void; reject: (error: Error) => void; timer?: NodeJS.Timeout }>();
+
+  constructor(private socket: Duplex) {
+    socket.on('data', (chunk: Buffer) => this.onData(chunk));
+    socket.on('close', () => this.failAll(new Error('Control channel closed')));
+    socket.on('error', (error) => this.failAll(error));
+  }
+
+  // Resolves with the 'done' reply, rejects on 'error' or after timeoutMs (0 waits forever)
+  request(cmd: string, fields: Record<string, string | number> = {}, timeoutMs = 30000): Promise<ControlReply> {
+    const id = this.nextId++;
+    const body = Buffer.from(JSON.stringify({ id, cmd, ...fields }), 'utf8');
+    const header = Buffer.alloc(4);
+    header.writeUInt32BE(body.length, 0);
+    return new Promise<ControlReply>((resolve, reject) => {
+      const timer = timeoutMs > 0 ? setTimeout(() => {
+        this.pending.delete(id);
+        reject(new Error(`Timeout waiting for ${cmd} reply`));
+      }, timeoutMs) : undefined;
+      this.pending.set(id, { resolve, reject, timer });
+      this.socket.write(Buffer.concat([header, body]));
+    });
+  }
+
+  private onData(chunk: Buffer): void {
+    this.buffer = Buffer.concat([this.buffer, chunk]);
+    while (this.buffer.length >= 4) {
+      const length = this.buffer.readUInt32BE(0);
+      if (this.buffer.length < 4 + length) break;
+      const message = this.buffer.subarray(4, 4 + length).toString('utf8');
+      this.buffer = this.buffer.subarray(4 + length);
+      let reply: ControlReply;
+      try {
+        reply = JSON.parse(message);
+      } catch (error) {
+        console.error(`⚠️  Bad control reply: ${message}`);
+        continue;
+      }
+      const request = this.pending.get(reply.id);
+      if (!request) {
+        if (reply.status === 'error') console.error(`⚠️  Control error: ${reply.error}`);
+        continue;
+      }
+      if (reply.status === 'accepted') continue;
+      this.pending.delete(reply.id);
+      if (request.timer) clearTimeout(request.timer);
+      if (reply.status === 'done') {
+        request.resolve(reply);
+      } else {
+        request.reject(new Error(reply.error || 'Control request failed'));
+      }
+    }
+  }
+
+  private failAll(error: Error): void {
+    for (const request of this.pending.values()) {
+      if (request.timer) clearTimeout(request.timer);
+      request.reject(error);
+    }
+    this.pending.clear();
+  }
+}
 
 export interface StreamingProcess {
   id: string;
@@ -13,9 +100,15 @@ export interface StreamingProcess {
   channel: string;
   token: string;  // Required since we always resolve it from env or param
   uid: string;    // Required since we always provide a default
-  status: 'starting' | 'running' | 'stopping' | 'stopped';
+  status: 'standby' | 'starting' | 'running' | 'stopping' | 'stopped';
+  // Standby worker whose service is up, waiting for its assign request
+  standbyReady?: boolean;
   createdAt: Date;
   lastActivity: Date;
+  // Latest metrics line the binary wrote on fd 3
+  metrics?: any;
+  // Framed JSON requests on fd 4, stdin commands are the fallback
+  control?: ControlClient;
 }
 
 export interface StartProcessParams {
@@ -44,6 +137,15 @@ export interface SwitchProcessParams {
   uid?: string;    // Optional since it has a default
 }
 
+// Timings of a finished switch as the binary measured them, in ms
+export interface SwitchResult {
+  video?: string;
+  preload_ms?: number;
+  wait_ms?: number;
+  first_frame_ms?: number;
+  total_ms?: number;
+}
+
 export interface StopProcessParams {
   channel: string;
   token?: string;  // Optional since it can come from env
@@ -53,11 +155,15 @@ export interface StopProcessParams {
 // Global registry that survives hot reloads
 declare global {
   var __AGORA_PROCESS_REGISTRY: Map<string, StreamingProcess> | undefined;
+  var __AGORA_STANDBY_POOL: StreamingProcess[] | undefined;
   var __AGORA_PROCESS_MANAGER_INSTANCE: ProcessManager | undefined;
 }
 
 class ProcessManager {
   private processes: Map<string, StreamingProcess>;
+  private standby: StreamingProcess[];
+  private standbyTarget: number = parseInt(process.env.AGORA_STANDBY_WORKERS || '0', 10) || 0;
+  private refillTimer?: NodeJS.Timeout;
   private executablePath: string = './build/agora_streaming_controlled';
   private libraryPath: string = '/home/ubuntu/agora_rtc_sdk/agora_sdk';
   private instanceId: string;
@@ -74,6 +180,10 @@ class ProcessManager {
     }
     
     this.processes = global.__AGORA_PROCESS_REGISTRY;
+    if (!global.__AGORA_STANDBY_POOL) {
+      global.__AGORA_STANDBY_POOL = [];
+    }
+    this.standby = global.__AGORA_STANDBY_POOL;
     
     if (executablePath) {
       this.executablePath = executablePath;
@@ -84,6 +194,7 @@ class ProcessManager {
 
     // Clean up any dead processes that might be left from previous hot reloads
     this.cleanupDeadProcesses();
+    this.refillPool();
   }
 
   private cleanupDeadProcesses(): void {
@@ -138,6 +249,30 @@ class ProcessManager {
     return token.substring(0, 4) + '***' + token.substring(token.length - 4);
   }
 
+  // Arguments every binary gets, whether it starts on a channel or in standby
+  private commonArgs(): string[] {
+    return [
+      '--pacing', 'pts',
+      '--lookahead', '3',
+      '--intraRefreshMs', '1000',
+      '--audio', '1',
+      '--metricsFd', '3',
+      '--controlFd', '4'
+    ];
+  }
+
+  private spawnBinary(args: string[]): ChildProcess {
+    // Set up environment with LD_LIBRARY_PATH
+    const env = {
+      ...process.env,
+      LD_LIBRARY_PATH: this.libraryPath
+    };
+    return spawn(this.executablePath, args, {
+      stdio: ['pipe', 'pipe', 'pipe', 'pipe', 'pipe'] as const,
+      env: env
+    }) as ChildProcess;
+  }
+
   async startProcess(params: StartProcessParams): Promise<string> {
     const processId = `${params.channel}_${Date.now()}`;
     
@@ -153,13 +288,19 @@ class ProcessManager {
     
     // Resolve video file from either direct videoFile or avatar parameters
     const videoFile = this.resolveVideoFile(params);
+
+    const worker = this.takeStandbyWorker(resolvedToken, resolvedUid);
+    if (worker) {
+      return this.assignWorker(worker, processId, params, videoFile, resolvedUid);
+    }
     
     // Build command line arguments
     const args = [
       '--token', resolvedToken,
       '--channelId', params.channel,
       '--userId', resolvedUid,
-      '--videoFile', videoFile
+      '--videoFile', videoFile,
+      ...this.commonArgs()
     ];
 
     console.log(`📋 Command line arguments:`);
@@ -173,17 +314,8 @@ class ProcessManager {
     console.log(`   LD_LIBRARY_PATH: ${this.libraryPath}`);
 
     try {
-      // Set up environment with LD_LIBRARY_PATH
-      const env = {
-        ...process.env,
-        LD_LIBRARY_PATH: this.libraryPath
-      };
-
       console.log(`🚀 Spawning process with PID...`);
-      const childProcess = spawn(this.executablePath, args, {
-        stdio: ['pipe', 'pipe', 'pipe'] as const,
-        env: env
-      }) as ChildProcess;
+      const childProcess = this.spawnBinary(args);
 
       const streamingProcess: StreamingProcess = {
         id: processId,
@@ -199,85 +331,8 @@ class ProcessManager {
         createdAt: new Date(),
         lastActivity: new Date()
       };
-
       this.processes.set(processId, streamingProcess);
-
-      // Handle process events
-      childProcess.on('spawn', () => {
-        console.log(`✅ Stream started: ${params.channel} (PID: ${childProcess.pid})`);
-        streamingProcess.status = 'running';
-        streamingProcess.lastActivity = new Date();
-      });
-
-      childProcess.on('error', (error) => {
-        console.error(`❌ Stream error ${params.channel}:`, error.message);
-        streamingProcess.status = 'stopped';
-        streamingProcess.lastActivity = new Date();
-      });
-
-      childProcess.on('exit', (code, signal) => {
-        console.log(`🛑 Process ${params.channel} exit event:`);
-        console.log(`   Exit code: ${code}`);
-        console.log(`   Signal: ${signal}`);
-        console.log(`   PID was: ${childProcess.pid}`);
-        console.log(`   Status was: ${streamingProcess.status}`);
-        
-        streamingProcess.status = 'stopped';
-        streamingProcess.lastActivity = new Date();
-        
-        // Remove from registry after a short delay
-        setTimeout(() => {
-          if (this.processes.has(processId)) {
-            this.processes.delete(processId);
-            console.log(`🗑️  Process ${processId} removed from registry`);
-          }
-        }, 5000);
-      });
-
-      // Handle stdout - only log important messages
-      childProcess.stdout?.on('data', (data) => {
-        const output = data.toString();
-        streamingProcess.lastActivity = new Date();
-        
-        console.log(`📺 [${params.channel}] STDOUT: ${output.trim()}`);
-        
-        // Only log important messages
-        const lines = output.split('\n');
-        for (const line of lines) {
-          if (line.trim() && (
-              line.includes('Process ready for commands') ||
-              line.includes('Successfully switched to:') ||
-              line.includes('Start sending video data') ||
-              line.includes('Disconnected from Agora')
-            )) {
-            console.log(`📺 [${params.channel}] IMPORTANT: ${line.trim()}`);
-          }
-        }
-      });
-
-      // Handle stderr - log everything for debugging
-      childProcess.stderr?.on('data', (data) => {
-        const output = data.toString();
-        streamingProcess.lastActivity = new Date();
-        
-        console.error(`⚠️  [${params.channel}] STDERR: ${output.trim()}`);
-        
-        // Check for specific error patterns
-        if (output.includes('Failed to connect to Agora channel')) {
-          console.error(`🚨 [${params.channel}] AGORA CONNECTION FAILED - Check token and channel`);
-        }
-        if (output.includes('terminate called')) {
-          console.error(`💥 [${params.channel}] PROCESS CRASHED - Unexpected termination`);
-        }
-      });
-
-      // Ensure stdin is available and writable
-      if (!childProcess.stdin) {
-        throw new Error('Failed to establish stdin pipe to child process');
-      }
-
-      // Set stdin encoding to ensure proper text handling
-      childProcess.stdin.setDefaultEncoding('utf8');
+      this.watchProcess(streamingProcess);
 
       // Give the process a moment to initialize
       setTimeout(() => {
@@ -294,26 +349,345 @@ class ProcessManager {
     }
   }
 
-  async switchVideo(params: SwitchProcessParams): Promise<boolean> {
-    // Resolve token and uid to ensure they're never undefined
+  // Wires up the control channel and the process events, output and metrics of a spawned binary;
+  // channel and id are read at each event, as a standby worker only gets them when it is assigned
+  private watchProcess(streamingProcess: StreamingProcess): void {
+    const childProcess = streamingProcess.process;
+    const label = () => streamingProcess.channel || `standby ${childProcess.pid}`;
+
+    // Extra 'pipe' entries are sockets, so one carries requests and replies both ways
+    const controlSocket = childProcess.stdio[4] as Duplex | null;
+    if (controlSocket) {
+      streamingProcess.control = new ControlClient(controlSocket);
+    }
+
+    // Handle process events
+    childProcess.on('spawn', () => {
+      console.log(`✅ ${streamingProcess.status === 'standby' ? 'Standby worker' : 'Stream'} started: ${label()} (PID: ${childProcess.pid})`);
+      if (streamingProcess.status === 'starting') {
+        streamingProcess.status = 'running';
+      }
+      streamingProcess.lastActivity = new Date();
+    });
+
+    childProcess.on('error', (error) => {
+      console.error(`❌ Stream error ${label()}:`, error.message);
+      streamingProcess.status = 'stopped';
+      streamingProcess.lastActivity = new Date();
+      this.dropStandbyWorker(streamingProcess);
+    });
+
+    childProcess.on('exit', (code, signal) => {
+      console.log(`🛑 Process ${label()} exit event:`);
+      console.log(`   Exit code: ${code}`);
+      console.log(`   Signal: ${signal}`);
+      console.log(`   PID was: ${childProcess.pid}`);
+      console.log(`   Status was: ${streamingProcess.status}`);
+      
+      const wasStandby = streamingProcess.status === 'standby';
+      streamingProcess.status = 'stopped';
+      streamingProcess.lastActivity = new Date();
+      if (wasStandby) {
+        this.dropStandbyWorker(streamingProcess);
+        return;
+      }
+      
+      // Remove from registry after a short delay
+      const processId = streamingProcess.id;
+      setTimeout(() => {
+        if (this.processes.has(processId)) {
+          this.processes.delete(processId);
+          console.log(`🗑️  Process ${processId} removed from registry`);
+        }
+      }, 5000);
+    });
+
+    // Handle stdout - only log important messages
+    childProcess.stdout?.on('data', (data) => {
+      const output = data.toString();
+      streamingProcess.lastActivity = new Date();
+      
+      console.log(`📺 [${label()}] STDOUT: ${output.trim()}`);
+      
+      // Only log important messages
+      const lines = output.split('\n');
+      for (const line of lines) {
+        if (line.includes('Standing by for an assignment')) {
+          streamingProcess.standbyReady = true;
+        }
+        if (line.trim() && (
+            line.includes('Process ready for commands') ||
+            line.includes('Successfully switched to:') ||
+            line.includes('Start sending video data') ||
+            line.includes('Disconnected from Agora')
+          )) {
+          console.log(`📺 [${label()}] IMPORTANT: ${line.trim()}`);
+        }
+      }
+    });
+
+    // Handle metrics - one JSON object per line, keep only the latest
+    let metricsBuffer = '';
+    const metricsStream = childProcess.stdio[3] as NodeJS.ReadableStream | null;
+    metricsStream?.on('data', (data) => {
+      metricsBuffer += data.toString();
+      const lines = metricsBuffer.split('\n');
+      metricsBuffer = lines.pop() || '';
+      for (const line of lines) {
+        if (!line.trim()) continue;
+        try {
+          streamingProcess.metrics = JSON.parse(line);
+        } catch (error) {
+          console.error(`⚠️  [${label()}] Bad metrics line: ${line.trim()}`);
+        }
+      }
+    });
+
+    // Handle stderr - log everything for debugging
+    childProcess.stderr?.on('data', (data) => {
+      const output = data.toString();
+      streamingProcess.lastActivity = new Date();
+      
+      console.error(`⚠️  [${label()}] STDERR: ${output.trim()}`);
+      
+      // Check for specific error patterns
+      if (output.includes('Failed to connect to Agora channel')) {
+        console.error(`🚨 [${label()}] AGORA CONNECTION FAILED - Check token and channel`);
+      }
+      if (output.includes('terminate called')) {
+        console.error(`💥 [${label()}] PROCESS CRASHED - Unexpected termination`);
+      }
+    });
+
+    // Ensure stdin is available and writable
+    if (!childProcess.stdin) {
+      throw new Error('Failed to establish stdin pipe to child process');
+    }
+
+    // Set stdin encoding to ensure proper text handling
+    childProcess.stdin.setDefaultEncoding('utf8');
+  }
+
+  // A standby worker can take the start if it joins with the same token, and with a string uid
+  // as its service was created for; ready workers go first
+  private takeStandbyWorker(token: string, uid: string): StreamingProcess | undefined {
+    if (/^[+-]?\d+$/.test(uid)) {
+      return undefined;
+    }
+    const candidates = this.standby.filter(worker => worker.token === token && worker.control && !worker.process.killed);
+    const worker = candidates.find(candidate => candidate.standbyReady) || candidates[0];
+    if (worker) {
+      this.standby.splice(this.standby.indexOf(worker), 1);
+      this.scheduleRefill();
+    }
+    return worker;
+  }
+
+  private assignWorker(worker: StreamingProcess, processId: string, params: StartProcessParams,
+                       videoFile: string, uid: string): string {
+    console.log(`⚡ Assigning standby worker ${worker.process.pid} to ${params.channel}${worker.standbyReady ? '' : ' (still starting)'}`);
+    Object.assign(worker, {
+      id: processId,
+      avatarId: params.avatarId,
+      state: params.state,
+      expression: params.expression,
+      videoFile: params.videoFile,
+      channel: params.channel,
+      uid: uid,
+      status: 'starting',
+      lastActivity: new Date()
+    });
+    this.processes.set(processId, worker);
+    worker.control!.request('assign', { channel: params.channel, uid, video: videoFile }, 60000).then((reply) => {
+      console.log(`✅ Standby worker started ${params.channel}: media ${reply.media_ms} ms, connected ${reply.connect_ms} ms`);
+      if (worker.status === 'starting') {
+        worker.status = 'running';
+      }
+    }).catch((error) => {
+      console.error(`💥 Standby worker failed to start ${params.channel}:`, error.message);
+      worker.status = 'stopping';
+      worker.process.kill('SIGTERM');
+    });
+    return processId;
+  }
+
+  private dropStandbyWorker(worker: StreamingProcess): void {
+    const index = this.standby.indexOf(worker);
+    if (index >= 0) {
+      this.standby.splice(index, 1);
+      this.scheduleRefill();
+    }
+  }
+
+  // Refills the pool off the request path, also spacing out respawns of workers that exit early
+  private scheduleRefill(): void {
+    if (this.standbyTarget > 0 && !this.refillTimer) {
+      this.refillTimer = setTimeout(() => {
+        this.refillTimer = undefined;
+        this.refillPool();
+      }, STANDBY_REFILL_DELAY_MS);
+    }
+  }
+
+  private refillPool(): void {
+    const token = process.env.AGORA_APP_TOKEN;
+    if (this.standbyTarget <= 0 || !token) {
+      return;
+    }
+    while (this.standby.length < this.standbyTarget) {
+      if (!this.hasMemoryForWorker()) {
+        console.log(`🧊 Standby pool held at ${this.standby.length} of ${this.standbyTarget} workers, host memory is low`);
+        return;
+      }
+      if (!this.spawnStandbyWorker(token)) {
+        this.scheduleRefill();
+        return;
+      }
+    }
+  }
+
+  // Counts workers that haven't grown to their size yet as if they had
+  private hasMemoryForWorker(): boolean {
+    let workerBytes = STANDBY_DEFAULT_RSS_BYTES;
+    for (const worker of [...this.processes.values(), ...this.standby]) {
+      if (worker.metrics?.rss_kb) {
+        workerBytes = Math.max(workerBytes, worker.metrics.rss_kb * 1024);
+      }
+    }
+    const growing = this.standby.filter(worker => !worker.metrics).length;
+    return os.freemem() - workerBytes * (growing + 1) >= os.totalmem() * STANDBY_MIN_FREE_FRACTION;
+  }
+
+  private spawnStandbyWorker(token: string): boolean {
+    const args = ['--token', token, '--standby', '1', ...this.commonArgs()];
+    const warm = process.env.AGORA_STANDBY_WARM;
+    if (warm) {
+      args.push('--warm', warm);
+    }
+    try {
+      const worker: StreamingProcess = {
+        id: '',
+        process: this.spawnBinary(args),
+        channel: '',
+        token: token,
+        uid: '',
+        status: 'standby',
+        createdAt: new Date(),
+        lastActivity: new Date()
+      };
+      this.watchProcess(worker);
+      this.standby.push(worker);
+      return true;
+    } catch (error) {
+      console.error(`💥 Failed to start standby worker:`, error);
+      return false;
+    }
+  }
+
+  getStandbyCount(): number {
+    return this.standby.length;
+  }
+
+  private findRunningProcess(params: SwitchProcessParams): StreamingProcess {
     const resolvedToken = params.token || process.env.AGORA_APP_TOKEN;
     const resolvedUid = params.uid || 'user123';
-    
+
     if (!resolvedToken) {
       throw new Error('AGORA_APP_TOKEN not found in environment and no token provided');
     }
-    
-    // Find process by channel, token, and uid
+
     const streamingProcess = this.findProcessByCredentials(params.channel, resolvedToken, resolvedUid);
-    
     if (!streamingProcess) {
       throw new Error(`No process found for channel ${params.channel} with matching credentials`);
     }
-
     if (streamingProcess.status !== 'running') {
       throw new Error(`Process not running (status: ${streamingProcess.status})`);
     }
+    return streamingProcess;
+  }
+
+  private rememberVideo(streamingProcess: StreamingProcess, params: SwitchProcessParams): void {
+    if (params.avatarId && params.state && params.expression) {
+      streamingProcess.avatarId = params.avatarId;
+      streamingProcess.state = params.state;
+      streamingProcess.expression = params.expression;
+      streamingProcess.videoFile = undefined; // Clear direct videoFile since we're using avatar params
+    } else if (params.videoFile) {
+      streamingProcess.videoFile = params.videoFile;
+      streamingProcess.avatarId = undefined; // Clear avatar params since we're using direct videoFile
+      streamingProcess.state = undefined;
+      streamingProcess.expression = undefined;
+    }
+    streamingProcess.lastActivity = new Date();
+  }
+
+  // Loads a video ahead so a later switchVideo to it cuts without waiting for the download
+  async preloadVideo(params: SwitchProcessParams): Promise<SwitchResult> {
+    const streamingProcess = this.findRunningProcess(params);
+    if (!streamingProcess.control) {
+      throw new Error('Process has no control channel');
+    }
+    const reply = await streamingProcess.control.request('preload', { video: this.resolveVideoFile(params) });
+    return { preload_ms: reply.preload_ms };
+  }
+
+  // Indexes videos likely to come next into the binary's segment store, so switching to any of
+  // them later finds its segments resident
+  async warmVideos(params: StopProcessParams, videoFiles: string[]): Promise<SwitchResult> {
+    const streamingProcess = this.findRunningProcess(params);
+    if (!streamingProcess.control) {
+      throw new Error('Process has no control channel');
+    }
+    const reply = await streamingProcess.control.request('warm', { video: videoFiles.join(' ') }, 60000);
+    return { preload_ms: reply.warm_ms };
+  }
+
+  // Appends a video to the playback queue. It follows on gaplessly once everything queued before
+  // it has played to its end; resolves when its first frame was sent
+  async queueVideo(params: SwitchProcessParams): Promise<SwitchResult> {
+    const streamingProcess = this.findRunningProcess(params);
+    if (!streamingProcess.control) {
+      throw new Error('Process has no control channel');
+    }
+    const reply = await streamingProcess.control.request('queue', { video: this.resolveVideoFile(params) }, 0);
+    this.rememberVideo(streamingProcess, params);
+    return reply;
+  }
+
+  // Drops every queued video that has not started yet; their queueVideo promises reject
+  async clearQueue(params: StopProcessParams): Promise<number> {
+    const streamingProcess = this.findRunningProcess(params);
+    if (!streamingProcess.control) {
+      throw new Error('Process has no control channel');
+    }
+    const reply = await streamingProcess.control.request('clear_queue', {});
+    return reply.cleared;
+  }
+
+  // Restarts the current video at positionMs from its nearest IDR; resolves like switchVideo
+  async seekVideo(params: StopProcessParams, positionMs: number): Promise<SwitchResult> {
+    const streamingProcess = this.findRunningProcess(params);
+    if (!streamingProcess.control) {
+      throw new Error('Process has no control channel');
+    }
+    return streamingProcess.control.request('seek', { position_ms: Math.max(0, Math.floor(positionMs)) });
+  }
+
+  async switchVideo(params: SwitchProcessParams): Promise<SwitchResult> {
+    const streamingProcess = this.findRunningProcess(params);
+
+    // Resolves once the first frame of the new video was sent, or rejects with the binary's error
+    if (streamingProcess.control) {
+      console.log(`🔄 Switching video: ${params.channel} -> ${params.avatarId ? `${params.avatarId}/${params.state}/${params.expression}` : params.videoFile}`);
+      const reply = await streamingProcess.control.request('switch', { video: this.resolveVideoFile(params) });
+      this.rememberVideo(streamingProcess, params);
+      console.log(`✅ Video switched: ${params.channel} in ${reply.total_ms} ms`);
+      return reply;
+    }
+    return this.switchVideoOnStdin(streamingProcess, params);
+  }
 
+  private async switchVideoOnStdin(streamingProcess: StreamingProcess, params: SwitchProcessParams): Promise<SwitchResult> {
     if (!streamingProcess.process.stdin?.writable) {
       throw new Error(`Process stdin not available`);
     }
@@ -347,21 +721,10 @@ class ProcessManager {
       }
       
       // Update process information based on what was provided
-      if (params.avatarId && params.state && params.expression) {
-        streamingProcess.avatarId = params.avatarId;
-        streamingProcess.state = params.state;
-        streamingProcess.expression = params.expression;
-        streamingProcess.videoFile = undefined; // Clear direct videoFile since we're using avatar params
-      } else if (params.videoFile) {
-        streamingProcess.videoFile = params.videoFile;
-        streamingProcess.avatarId = undefined; // Clear avatar params since we're using direct videoFile
-        streamingProcess.state = undefined;
-        streamingProcess.expression = undefined;
-      }
-      streamingProcess.lastActivity = new Date();
+      this.rememberVideo(streamingProcess, params);
       
       console.log(`✅ Video switch command sent: ${params.channel}`);
-      return true;
+      return {};
       
     } catch (error) {
       console.error(`💥 Failed to switch video:`, error);
@@ -390,7 +753,9 @@ class ProcessManager {
       streamingProcess.status = 'stopping';
       
       // Send graceful shutdown command
-      if (streamingProcess.process.stdin?.writable) {
+      if (streamingProcess.control) {
+        streamingProcess.control.request('exit', {}, 5000).catch(() => {});
+      } else if (streamingProcess.process.stdin?.writable) {
         streamingProcess.process.stdin.write('EXIT\n', 'utf8');
       }
       
@@ -458,12 +823,18 @@ class ProcessManager {
       pid: process.process.pid || 0,
       killed: process.process.killed,
       exitCode: process.process.exitCode,
+      metrics: process.metrics || null,
       resolvedVideoFile: process.videoFile || (process.avatarId && process.state && process.expression ? 
         this.generateVideoFile(process.avatarId, process.state, process.expression) : null)
     };
   }
 
   async cleanup(): Promise<void> {
+    this.standbyTarget = 0;
+    for (const worker of this.standby.splice(0)) {
+      worker.control?.request('exit', {}, 5000).catch(() => {});
+      setTimeout(() => worker.process.kill('SIGTERM'), 5000);
+    }
     const promises = Array.from(this.processes.values()).map(process => 
       this.stopProcess({ channel: process.channel, token: process.token, uid: process.uid })
     );
@@ -14,6 +14,7 @@ export default async function handler(req: NextApiRequest, res: NextApiResponse)
         success: true,
         processes: processData,
         count: processData.length,
+        standbyWorkers: processManager.getStandbyCount(),
         timestamp: new Date().toISOString()
       });
     } catch (error) {
@@ -38,7 +38,7 @@ export default async function handler(req: NextApiRequest, res: NextApiResponse)
 
     // Attempt to switch the video
     try {
-      const success = await processManager.switchVideo({
+      const timings = await processManager.switchVideo({
         avatarId,
         state,
         expression,
@@ -48,18 +48,13 @@ export default async function handler(req: NextApiRequest, res: NextApiResponse)
         uid: actualUid
       });
       
-      if (success) {
-        res.status(200).json({
-          success: true,
-          message: 'Video switch command sent successfully',
-          channel,
-          ...(hasAvatarParams ? { avatarId, state, expression } : { videoFile })
-        });
-      } else {
-        res.status(500).json({ 
-          error: 'Failed to send video switch command' 
-        });
-      }
+      res.status(200).json({
+        success: true,
+        message: 'Video switched successfully',
+        channel,
+        timings,
+        ...(hasAvatarParams ? { avatarId, state, expression } : { videoFile })
+      });
     } catch (switchError) {
       console.error('Switch error:', switchError);
       res.status(500).json({ 
@@ -72,11 +72,12 @@ function check_prerequisites() {
         all_good=false
     fi
     
-    # Check curl
-    if command -v curl &> /dev/null; then
-        print_success "curl is installed"
+    # Check libcurl headers
+    if [ -f /usr/include/curl/curl.h ] || [ -f /usr/include/x86_64-linux-gnu/curl/curl.h ]; then
+        print_success "libcurl development headers are installed"
     else
-        print_warning "curl is not installed (needed for M3U8 segment downloads)"
+        print_error "libcurl development headers are not installed (sudo apt install libcurl4-openssl-dev)"
+        all_good=false
     fi
     
     if [ "$all_good" = false ]; then